@@ -0,0 +1,87 @@
+#ifndef JS_CONTEXT_POOL_H_
+#define JS_CONTEXT_POOL_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <pthread.h>
+#include <jsc/jsc.h>
+#include "clib-stack.h"
+#include "js-utils.h"
+
+struct js_job
+{
+	char * source;
+	size_t cb_source;
+	char * uri;
+
+	void * user_data;
+	/*
+	 * on_completed() runs on the worker thread, the callee owns the job and should free it by js_job_free().
+	 * if on_completed is NULL, use pool->wait() to wait for the result.
+	 */
+	void (* on_completed)(struct js_job * job, void * user_data);
+
+	// results (filled by the worker)
+	int worker_id;
+	int err_code;		// 0: success, -1: exception, ECANCELED: pool shutdown
+	char * result;		// JSON (or string) representation of the return value, nullable
+	char * exception;	// nullable
+	double time_cost;
+	int done;
+};
+void js_job_free(struct js_job * job);
+
+struct js_worker_stats
+{
+	long num_jobs;
+	long num_errors;
+	double warmup_time;	// time to create the context and evaluate all libraries
+	double busy_time;
+	double uptime;
+};
+
+struct js_worker;
+struct js_context_pool
+{
+	void * priv;
+	void * user_data;
+
+	int num_workers;
+	struct js_worker * workers;
+
+	int quit;
+	int num_ready;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	clib_queue_t jobs[1];
+
+	// libraries to be pre-evaluated in every context, only valid during js_context_pool_init()
+	const struct js_source * libraries;
+	int num_libraries;
+
+	// public methods
+	struct js_job * (* submit)(struct js_context_pool * pool,
+		const char * source, ssize_t cb_source, const char * uri,
+		void (* on_completed)(struct js_job * job, void * user_data), void * user_data);
+	int (* wait)(struct js_context_pool * pool, struct js_job * job);
+	int (* get_stats)(struct js_context_pool * pool, int worker_id, struct js_worker_stats * stats);
+};
+
+/*
+ * create one JSCVirtualMachine + JSCContext per worker thread,
+ * and evaluate all libraries in each context before returning.
+ * each job runs in a new scope object of its worker's js_context_template.
+ */
+struct js_context_pool * js_context_pool_init(struct js_context_pool * pool, int num_workers,
+	const struct js_source * libraries, int num_libraries,
+	void * user_data);
+void js_context_pool_cleanup(struct js_context_pool * pool);
+void js_context_pool_dump_stats(struct js_context_pool * pool, FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,52 @@
+#ifndef JS_DOM_H_
+#define JS_DOM_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <jsc/jsc.h>
+#include "w3c-dom.h"
+
+/*
+ * struct js_dom
+ * @brief expose a (server-side parsed) w3c_dom to javascript as a native document object.
+ *
+ * Element wrappers are created on first access and cached in xmlNode->_private,
+ * so the same node always maps to the same JS object (===).
+ * Only one js_dom can be bound to a xmlDoc at a time.
+ *
+ * supported:
+ *   document: documentElement, head, body, title,
+ *             getElementById(), getElementsByTagName(), querySelector(), querySelectorAll()
+ *   element:  tagName, nodeName, id, className, textContent, outerHTML, parentNode, children,
+ *             getAttribute(), getElementsByTagName(), querySelector(), querySelectorAll()
+ *   selectors: compound simple selectors (tag, #id, .class, '*') joined by descendant combinators,
+ *             e.g. "div.item a", "#main .price"
+ */
+struct js_dom
+{
+	JSCContext * js;
+	struct w3c_dom * dom;
+	void * priv;
+	void * user_data;
+
+	JSCClass * document_class;
+	JSCClass * element_class;
+	JSCValue * document;	// the document object
+
+	long num_wrappers;	// number of xmlNodes that have been wrapped
+};
+struct js_dom * js_dom_init(struct js_dom * jdom, JSCContext * js, struct w3c_dom * dom, void * user_data);
+void js_dom_cleanup(struct js_dom * jdom);
+
+/*
+ * js_dom_wrap_node()
+ * @return the (cached) JS object of the node, or null if node is NULL. should be released by g_object_unref()
+ */
+JSCValue * js_dom_wrap_node(struct js_dom * jdom, xmlNode * node);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,43 @@
+#ifndef JS_LOADER_H_
+#define JS_LOADER_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <sys/types.h>
+#include <jsc/jsc.h>
+
+/*
+ * js_loader_init()
+ * @brief create the http connection pool, open the script cache and the http cache, configured by environment variables:
+ *     JS_SCRIPT_CACHE_DIR (default: .script-cache), JS_HTTP_CACHE_DIR (default: .http-cache), empty string: disabled
+ *     JS_SCRIPT_CACHE_MAX_AGE (seconds, default: 3600): older scripts are revalidated by a conditional GET 
+ *         and refreshed in the script cache on '200' or '304'.
+ */
+int js_loader_init(void);
+void js_loader_cleanup(FILE * fp);	// print cache stats to fp (nullable)
+
+/*
+ * js_loader_load()
+ * @brief load a script without extra copying: 
+ *     local files are memory-mapped, http(s) responses are detached from the client's in_buf.
+ * @param uri	local file or http(s) url
+ * @param p_cache_flags 	nullable, set to the script_cache flags if the script is cached
+ * @return the content (NOT nul-terminated), should be released by g_bytes_unref(). NULL on error.
+ */
+GBytes * js_loader_load(const char * uri, uint32_t * p_cache_flags);
+
+/*
+ * check the syntax of a cached script only once, the result is saved in the cache index.
+ * A script is marked as a syntax error only if jsc_context_check_syntax() reported an exception.
+ * @param js	a real context, e.g. jsc_context_new(); on an invalid context the cache is not touched and -1 is returned.
+ * @return 0 if the script can be evaluated
+ */
+int js_loader_check_syntax(JSCContext * js, const char * uri, const char * js_code, ssize_t cb_code, uint32_t cache_flags);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -8,6 +8,50 @@ extern "C" {
 
 void js_utils_dump_value(JSCValue * var);
 
+struct js_source
+{
+	const char * code;
+	ssize_t cb_code;	// -1: strlen(code)
+	const char * uri;
+};
+
+/*
+ * js_utils_take_result()
+ * @brief check the exception of the last evaluation and convert ret_val to a string (JSON if possible).
+ *     ret_val will be released, *p_result and *p_exception (if set) should be freed by free().
+ * @return 0 on success, -1 if an exception was thrown (the exception will be cleared).
+ */
+int js_utils_take_result(JSCContext * js, JSCValue * ret_val, char ** p_result, char ** p_exception);
+
+/*
+ * struct js_context_template
+ * @brief evaluate libraries only once, then run each script in a new scope object 
+ *     (jsc_context_evaluate_in_object) whose lookups fall back to the template's global object.
+ * 
+ * Symbols declared by a script are added to its own scope object, 
+ * but assignments to undeclared variables or library objects still go to the shared globals.
+ */
+struct js_context_template
+{
+	JSCContext * js;
+	void * user_data;
+	
+	double load_time;	// time to evaluate all libraries
+	long num_instances;
+	
+	/*
+	 * evaluate()
+	 * @param p_scope	nullable, the scope object that holds symbols declared by the script
+	 * @return ret_val, should be released by g_object_unref()
+	 */
+	JSCValue * (* evaluate)(struct js_context_template * tmpl, const char * code, ssize_t cb_code, const char * uri, JSCValue ** p_scope);
+};
+struct js_context_template * js_context_template_init(struct js_context_template * tmpl, 
+	JSCContext * js, // nullable, create a new context if null
+	const struct js_source * libraries, int num_libraries,
+	void * user_data);
+void js_context_template_cleanup(struct js_context_template * tmpl);
+
 #ifdef __cplusplus
 }
 #endif
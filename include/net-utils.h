@@ -7,10 +7,13 @@ extern "C" {
 #endif
 
 #include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <curl/curl.h>
 
 #include "auto_buffer.h"
 #include "skey_value_pair.h"
+#include "clib-stack.h"
 
 struct net_utils_http_headers
 {
@@ -20,15 +23,84 @@ struct net_utils_http_headers
 	
 	int (* add_line)(struct net_utils_http_headers * headers, const char * line, ssize_t cb_line);
 	int (* add)(struct net_utils_http_headers * headers, const char * key, const char * value);
+	const char * (* get)(struct net_utils_http_headers * headers, const char * key);	// case-insensitive, returns the first match
 };
 struct net_utils_http_headers * net_utils_http_headers_init(struct net_utils_http_headers * headers, size_t size);
 void net_utils_http_headers_cleanup(struct net_utils_http_headers * headers);
 
+/*
+ * struct net_utils_http_cache
+ * @brief local response cache for conditional GET requests (rfc7232)
+ *   ${cache_dir}/<url_hash>.meta :  url, ETag, Last-Modified, length
+ *   ${cache_dir}/<url_hash>.body :  response body, read() into in_buf on '304 Not Modified'
+ *   An entry whose body is missing or doesn't match the length is removed and the request is sent unconditionally.
+ */
+struct net_utils_http_cache
+{
+	char cache_dir[PATH_MAX];
+	
+	// stats
+	long hits;		// 304, served from the cache
+	long misses;
+	long stores;
+	int64_t bytes_saved;
+	int64_t bytes_downloaded;
+};
+struct net_utils_http_cache * net_utils_http_cache_init(struct net_utils_http_cache * cache, const char * cache_dir);
+void net_utils_http_cache_cleanup(struct net_utils_http_cache * cache);
+
+/*
+ * struct net_utils_http_pool
+ * @brief connection reuse across requests and clients (thread-safe)
+ *   - a CURLSH object shares the DNS cache, TLS sessions and the connection cache between all easy handles
+ *   - easy handles of cleaned-up clients are kept warm, new clients borrow one instead of curl_easy_init()
+ *   - per-host keep-alive limit: send_request() waits until fewer than max_host_connections transfers
+ *     to the same host are in progress, so no more connections than that are opened and kept alive.
+ *     net_utils_http_multi can't wait: the connection of a transfer over the limit is closed when
+ *     it's done (CURLOPT_FORBID_REUSE).
+ */
+struct net_utils_http_pool_stats
+{
+	long num_borrows;
+	long num_warm;			// borrows served by an idle handle
+	long num_requests;
+	long num_connects;		// new connections (tcp / tls handshakes)
+	long num_reused;		// requests which reused a connection
+	long num_waits;			// requests which waited for a free slot of their host
+	long num_forbid_reuse;	// connections not kept alive because of max_host_connections
+};
+
+struct net_utils_http_pool
+{
+	CURLSH * share;
+	void * priv;	// per-host table
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;	// a host slot was released
+	pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+	
+	int max_idle;
+	int num_idle;
+	int num_borrowed;
+	CURL ** idle;
+	int max_host_connections;
+	
+	struct net_utils_http_pool_stats stats[1];
+};
+/*
+ * net_utils_http_pool_init()
+ * @param max_idle: idle handles kept, <= 0: default 16
+ * @param max_host_connections: <= 0: default 6
+ */
+struct net_utils_http_pool * net_utils_http_pool_init(struct net_utils_http_pool * pool, int max_idle, int max_host_connections);
+void net_utils_http_pool_cleanup(struct net_utils_http_pool * pool);	// all pooled clients must be cleaned up first
+void net_utils_http_pool_get_stats(struct net_utils_http_pool * pool, struct net_utils_http_pool_stats * stats);
+
 struct net_utils_http_client
 {
 	CURL * curl;
 	void * priv;
 	void * user_data;
+	struct net_utils_http_pool * pool;	// nullable, not owned
 	
 	// data
 	char url[PATH_MAX];
@@ -47,6 +119,9 @@ struct net_utils_http_client
 	long response_code;
 	const char * last_error;
 	
+	struct net_utils_http_cache * cache;	// nullable
+	int cache_hit;	// the body of the last response was served from the cache
+	
 	// public methods
 	int (* set_url)(struct net_utils_http_client * client, const char * url);
 	int (* set_option)(struct net_utils_http_client * client, CURLoption option, void * option_value);
@@ -54,15 +129,68 @@ struct net_utils_http_client
 	void (* reset)(struct net_utils_http_client * client);
 	
 	// custom callbacks
+	void * on_response_data;	// nullable, user_data passed to on_response(), default: in_buf
 	size_t (* on_parse_header)(char * ptr, size_t size, size_t n, void * user_data);
 	size_t (* on_response)(char * ptr, size_t size, size_t n, void * user_data);
 	size_t (* on_post_data)(char * ptr, size_t size, size_t n, void * user_data);
 };
 
 struct net_utils_http_client * net_utils_http_client_init(struct net_utils_http_client * client, void * user_data);
+// borrow the curl handle from @pool, it's given back by net_utils_http_client_cleanup()
+struct net_utils_http_client * net_utils_http_client_init_with_pool(struct net_utils_http_client * client, 
+	struct net_utils_http_pool * pool, void * user_data);
 void net_utils_http_client_cleanup(struct net_utils_http_client * client);
 
 
+/*
+ * struct net_utils_http_multi
+ * @brief concurrent fetcher: runs many net_utils_http_client requests on a single curl_multi event-loop thread.
+ * 
+ * A client MUST NOT be touched by the caller until its on_completed() callback has been called.
+ * on_completed() runs on the event-loop thread.
+ */
+typedef void (* net_utils_http_multi_callback)(struct net_utils_http_client * client, 
+	int rc, // 0 on success, -1 on error (see client->err_code and client->last_error)
+	void * user_data);
+
+struct net_utils_http_multi_stats
+{
+	long num_requests;
+	long num_completed;
+	long num_failed;
+	long num_connects;	// new connections
+	long num_reused;	// transfers which reused an existing connection
+	int max_in_flight;	// peak number of concurrent transfers
+};
+
+struct net_utils_http_multi
+{
+	CURLM * multi;
+	void * priv;
+	void * user_data;
+	
+	int max_in_flight;
+	int num_in_flight;
+	int quit;
+	
+	pthread_t th;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;		// new requests
+	pthread_cond_t done_cond;	// requests completed
+	clib_queue_t pending[1];
+	struct net_utils_http_multi_stats stats[1];
+	
+	// public methods
+	int (* add_request)(struct net_utils_http_multi * multi, struct net_utils_http_client * client, 
+		const char * method, const void * payload, size_t cb_payload,
+		net_utils_http_multi_callback on_completed, void * user_data);
+	int (* wait_all)(struct net_utils_http_multi * multi);	// wait until all added requests are completed
+	void (* get_stats)(struct net_utils_http_multi * multi, struct net_utils_http_multi_stats * stats);
+};
+struct net_utils_http_multi * net_utils_http_multi_init(struct net_utils_http_multi * multi, int max_in_flight, void * user_data);
+void net_utils_http_multi_cleanup(struct net_utils_http_multi * multi);
+
+
 #ifdef __cplusplus
 }
 #endif
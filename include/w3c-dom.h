@@ -0,0 +1,74 @@
+#ifndef W3C_DOM_H_
+#define W3C_DOM_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <libxml/tree.h>
+
+/*
+ * struct w3c_dom_tag_index
+ * @brief hash multi-map: case-folded tag name ==> all elements with that name, in document order
+ */
+struct w3c_dom_tag_list
+{
+	char * name;	// interned, lower-case. NULL: empty bucket
+	uint32_t hash;
+	size_t count;
+	size_t size;
+	xmlNode ** nodes;
+};
+
+struct w3c_dom_tag_index
+{
+	size_t size;	// number of buckets, power of 2
+	size_t count;	// number of distinct tag names
+	size_t num_elements;
+	struct w3c_dom_tag_list * buckets;
+
+	// cache of the last inserted list: libxml2 interns names in the document's dict, so pointers can be compared
+	const xmlChar * last_name;
+	struct w3c_dom_tag_list * last_list;
+};
+struct w3c_dom_tag_index * w3c_dom_tag_index_init(struct w3c_dom_tag_index * index, size_t size);
+void w3c_dom_tag_index_cleanup(struct w3c_dom_tag_index * index);
+int w3c_dom_tag_index_add(struct w3c_dom_tag_index * index, xmlNode * node);
+struct w3c_dom_tag_list * w3c_dom_tag_index_find(const struct w3c_dom_tag_index * index, const char * name);
+
+struct w3c_dom
+{
+	xmlDoc * doc;
+	xmlNode * root;
+
+	void * priv;
+	void * user_data;
+	struct w3c_dom_tag_index tags[1];
+
+	xmlNode * (*getElementByTagName)(struct w3c_dom * document, const char * tagName);
+	/*
+	 * getElementsByTagName()
+	 * @return all matching elements in document order, NULL if not found.
+	 *     The array is owned by the document and valid until w3c_dom_cleanup().
+	 */
+	xmlNode ** (*getElementsByTagName)(struct w3c_dom * document, const char * tagName, size_t * p_count);
+};
+struct w3c_dom * w3c_dom_init(struct w3c_dom * dom, xmlDoc * doc, xmlNode * root, void * user_data);
+
+/*
+ * w3c_dom_init_parallel()
+ * @brief index the subtrees rooted at @split_depth on @num_threads threads, then merge them in document order.
+ * @param num_threads: <= 0: use the number of online CPUs, 1: same as w3c_dom_init()
+ * @param split_depth: <= 0: use W3C_DOM_DEFAULT_SPLIT_DEPTH
+ */
+#define W3C_DOM_DEFAULT_SPLIT_DEPTH (3)
+struct w3c_dom * w3c_dom_init_parallel(struct w3c_dom * dom, xmlDoc * doc, xmlNode * root, 
+	int num_threads, int split_depth, 
+	void * user_data);
+void w3c_dom_cleanup(struct w3c_dom * dom);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
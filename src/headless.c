@@ -0,0 +1,389 @@
+/*
+ * headless.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <curl/curl.h>
+
+#include <jsc/jsc.h>
+#include <libxml/HTMLparser.h>
+
+#include "app_timer.h"
+#include "js-utils.h"
+#include "js-loader.h"
+#include "js-dom.h"
+
+/*
+ * headless runtime: javascriptcoregtk only, no GTK / WebKitWebView.
+ * host objects: console, setTimeout / setInterval / clearTimeout / clearInterval, document (js_dom)
+ */
+struct js_timer
+{
+	struct headless_runtime * rt;
+	struct js_timer * next;
+	
+	long id;
+	guint source_id;
+	int repeat;
+	JSCValue * callback;
+	GPtrArray * args;	// extra arguments of setTimeout()
+};
+
+struct headless_runtime
+{
+	JSCContext * js;
+	GMainLoop * loop;
+	
+	long next_timer_id;
+	long num_timers;
+	struct js_timer * timers;	// pending timers
+	
+	xmlDoc * doc;
+	struct w3c_dom dom[1];
+	struct js_dom jdom[1];
+};
+
+static void runtime_print_exception(JSCContext * js)
+{
+	JSCException * exception = jsc_context_get_exception(js);
+	if(NULL == exception) return;
+	char * err_msg = jsc_exception_to_string(exception);
+	fprintf(stderr, "[ERROR]: %s (from: %s@%u)\n", err_msg, 
+		jsc_exception_get_source_uri(exception), jsc_exception_get_line_number(exception));
+	g_free(err_msg);
+	jsc_context_clear_exception(js);
+}
+
+/******************************************************
+ * console
+ *****************************************************/
+static void console_print(FILE * fp, GPtrArray * args)
+{
+	for(guint i = 0; i < args->len; ++i) {
+		JSCValue * value = args->pdata[i];
+		char * text = NULL;
+		if(!jsc_value_is_string(value) && jsc_value_is_object(value) && !jsc_value_is_function(value)) {
+			text = jsc_value_to_json(value, 0);
+		}
+		if(NULL == text) text = jsc_value_to_string(value);
+		fprintf(fp, "%s%s", (i > 0)?" ":"", text?text:"");
+		g_free(text);
+	}
+	fprintf(fp, "\n");
+}
+
+static void console_log(GPtrArray * args, struct headless_runtime * rt)
+{
+	console_print(stdout, args);
+}
+
+static void console_error(GPtrArray * args, struct headless_runtime * rt)
+{
+	console_print(stderr, args);
+}
+
+static void add_function(JSCValue * object, const char * name, GCallback callback, struct headless_runtime * rt, GType return_type)
+{
+	JSCValue * func = jsc_value_new_function_variadic(rt->js, name, callback, rt, NULL, return_type);
+	jsc_value_object_set_property(object, name, func);
+	g_object_unref(func);
+}
+
+/******************************************************
+ * timers
+ *****************************************************/
+static void js_timer_free(struct js_timer * timer)
+{
+	struct headless_runtime * rt = timer->rt;
+	struct js_timer ** p_timer = &rt->timers;
+	while(*p_timer && *p_timer != timer) p_timer = &(*p_timer)->next;
+	if(*p_timer) {
+		*p_timer = timer->next;
+		--rt->num_timers;
+	}
+	
+	g_object_unref(timer->callback);
+	if(timer->args) g_ptr_array_unref(timer->args);
+	free(timer);
+	
+	if(0 == rt->num_timers && rt->loop) g_main_loop_quit(rt->loop);
+}
+
+static gboolean on_js_timer(struct js_timer * timer)
+{
+	struct headless_runtime * rt = timer->rt;
+	JSCValue ** args = timer->args?(JSCValue **)timer->args->pdata:NULL;
+	guint num_args = timer->args?timer->args->len:0;
+	
+	JSCValue * ret_val = jsc_value_function_callv(timer->callback, num_args, args);
+	if(ret_val) g_object_unref(ret_val);
+	runtime_print_exception(rt->js);
+	
+	return timer->repeat?G_SOURCE_CONTINUE:G_SOURCE_REMOVE;	// js_timer_free() will be called by GLib on removal
+}
+
+static JSCValue * add_timer(GPtrArray * args, struct headless_runtime * rt, int repeat)
+{
+	if(args->len < 1 || !jsc_value_is_function(args->pdata[0])) {
+		jsc_context_throw(rt->js, "TypeError: callback is not a function");
+		return jsc_value_new_undefined(rt->js);
+	}
+	
+	int delay = 0;
+	if(args->len > 1) delay = jsc_value_to_int32(args->pdata[1]);
+	if(delay < 0) delay = 0;
+	
+	struct js_timer * timer = calloc(1, sizeof(*timer));
+	assert(timer);
+	timer->rt = rt;
+	timer->id = ++rt->next_timer_id;
+	timer->repeat = repeat;
+	timer->callback = g_object_ref(args->pdata[0]);
+	if(args->len > 2) {
+		timer->args = g_ptr_array_new_full(args->len - 2, g_object_unref);
+		for(guint i = 2; i < args->len; ++i) g_ptr_array_add(timer->args, g_object_ref(args->pdata[i]));
+	}
+	
+	timer->next = rt->timers;
+	rt->timers = timer;
+	++rt->num_timers;
+	
+	timer->source_id = g_timeout_add_full(G_PRIORITY_DEFAULT, delay, 
+		(GSourceFunc)on_js_timer, timer, (GDestroyNotify)js_timer_free);
+	return jsc_value_new_number(rt->js, timer->id);
+}
+
+static JSCValue * js_set_timeout(GPtrArray * args, struct headless_runtime * rt)
+{
+	return add_timer(args, rt, 0);
+}
+
+static JSCValue * js_set_interval(GPtrArray * args, struct headless_runtime * rt)
+{
+	return add_timer(args, rt, 1);
+}
+
+static void js_clear_timer(GPtrArray * args, struct headless_runtime * rt)
+{
+	if(args->len < 1) return;
+	long id = jsc_value_to_int32(args->pdata[0]);
+	for(struct js_timer * timer = rt->timers; timer; timer = timer->next) {
+		if(timer->id == id) {
+			g_source_remove(timer->source_id);	// js_timer_free()
+			return;
+		}
+	}
+}
+
+/******************************************************
+ * runtime
+ *****************************************************/
+static const char * s_empty_html = "<html><head></head><body></body></html>";
+static int runtime_init(struct headless_runtime * rt, const char * html, ssize_t cb_html, const char * html_uri)
+{
+	memset(rt, 0, sizeof(*rt));
+	rt->js = jsc_context_new();
+	assert(rt->js);
+	
+	JSCValue * global = jsc_context_get_global_object(rt->js);
+	
+	JSCValue * console = jsc_value_new_object(rt->js, NULL, NULL);
+	add_function(console, "log", G_CALLBACK(console_log), rt, G_TYPE_NONE);
+	add_function(console, "info", G_CALLBACK(console_log), rt, G_TYPE_NONE);
+	add_function(console, "debug", G_CALLBACK(console_log), rt, G_TYPE_NONE);
+	add_function(console, "warn", G_CALLBACK(console_error), rt, G_TYPE_NONE);
+	add_function(console, "error", G_CALLBACK(console_error), rt, G_TYPE_NONE);
+	jsc_value_object_set_property(global, "console", console);
+	g_object_unref(console);
+	
+	add_function(global, "setTimeout", G_CALLBACK(js_set_timeout), rt, JSC_TYPE_VALUE);
+	add_function(global, "setInterval", G_CALLBACK(js_set_interval), rt, JSC_TYPE_VALUE);
+	add_function(global, "clearTimeout", G_CALLBACK(js_clear_timer), rt, G_TYPE_NONE);
+	add_function(global, "clearInterval", G_CALLBACK(js_clear_timer), rt, G_TYPE_NONE);
+	
+	// document
+	if(NULL == html) {
+		html = s_empty_html;
+		cb_html = strlen(html);
+	}
+	rt->doc = htmlReadMemory(html, cb_html, html_uri, NULL, 
+		HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+	if(NULL == rt->doc) {
+		fprintf(stderr, "[ERROR]: parse html '%s' failed\n", html_uri?html_uri:"(null)");
+		g_object_unref(global);
+		return -1;
+	}
+	w3c_dom_init(rt->dom, rt->doc, xmlDocGetRootElement(rt->doc), rt);
+	js_dom_init(rt->jdom, rt->js, rt->dom, rt);
+	jsc_value_object_set_property(global, "document", rt->jdom->document);
+	jsc_value_object_set_property(global, "window", global);
+	
+	g_object_unref(global);
+	return 0;
+}
+
+static void runtime_cleanup(struct headless_runtime * rt)
+{
+	while(rt->timers) g_source_remove(rt->timers->source_id);
+	if(rt->loop) g_main_loop_unref(rt->loop);
+	rt->loop = NULL;
+	
+	if(rt->doc) {
+		js_dom_cleanup(rt->jdom);
+		w3c_dom_cleanup(rt->dom);
+		xmlFreeDoc(rt->doc);
+		rt->doc = NULL;
+	}
+	if(rt->js) g_object_unref(rt->js);
+	rt->js = NULL;
+}
+
+/*
+ * run the main loop until there are no pending timers
+ */
+static void runtime_run(struct headless_runtime * rt)
+{
+	if(0 == rt->num_timers) return;
+	if(NULL == rt->loop) rt->loop = g_main_loop_new(NULL, FALSE);
+	g_main_loop_run(rt->loop);
+}
+
+static int runtime_evaluate(struct headless_runtime * rt, const char * uri, int print_result)
+{
+	uint32_t cache_flags = 0;
+	GBytes * bytes = js_loader_load(uri, &cache_flags);
+	if(NULL == bytes) {
+		fprintf(stderr, "[ERROR]: load script '%s' failed\n", uri);
+		return -1;
+	}
+	gsize cb_code = 0;
+	const char * js_code = g_bytes_get_data(bytes, &cb_code);
+	
+	int rc = js_loader_check_syntax(rt->js, uri, js_code, cb_code, cache_flags);
+	if(0 == rc) {
+		char * result = NULL, * exception = NULL;
+		JSCValue * ret_val = jsc_context_evaluate_with_source_uri(rt->js, js_code, cb_code, uri, 1);
+		rc = js_utils_take_result(rt->js, ret_val, &result, &exception);
+		if(rc) fprintf(stderr, "[ERROR]: %s: %s\n", uri, exception);
+		else if(print_result && result) printf("%s: %s\n", uri, result);
+		free(result);
+		free(exception);
+	}
+	g_bytes_unref(bytes);
+	return rc;
+}
+
+/*
+ * startup benchmark: create a context and install all host objects, then evaluate an empty script
+ */
+static void run_startup_benchmark(int iterations)
+{
+	app_timer_t timer[1];
+	double total = 0, min_time = 0, max_time = 0;
+	for(int i = 0; i < iterations; ++i) {
+		struct headless_runtime rt[1];
+		app_timer_start(timer);
+		runtime_init(rt, NULL, 0, NULL);
+		JSCValue * ret_val = jsc_context_evaluate(rt->js, "0", -1);
+		g_object_unref(ret_val);
+		double time_cost = app_timer_stop(timer);
+		runtime_cleanup(rt);
+		
+		total += time_cost;
+		if(i == 0 || time_cost < min_time) min_time = time_cost;
+		if(time_cost > max_time) max_time = time_cost;
+	}
+	printf("startup: iterations=%d, avg=%.3f ms, min=%.3f ms, max=%.3f ms\n", 
+		iterations, total * 1000.0 / iterations, min_time * 1000.0, max_time * 1000.0);
+}
+
+/*
+ * usage: headless [--html <html_uri>] [-l <library_uri>]... [--startup-bench <iterations>] <script_uri>...
+ */
+int main(int argc, char **argv)
+{
+	int rc = 0;
+	app_timer_t timer[1];
+	app_timer_start(timer);
+	
+	const char * html_uri = NULL;
+	int num_libraries = 0;
+	const char ** libraries = calloc(argc, sizeof(*libraries));
+	int num_scripts = 0;
+	const char ** scripts = calloc(argc, sizeof(*scripts));
+	assert(libraries && scripts);
+	
+	for(int i = 1; i < argc; ++i) {
+		if(0 == strcmp(argv[i], "--html") && (i + 1) < argc) html_uri = argv[++i];
+		else if(0 == strcmp(argv[i], "-l") && (i + 1) < argc) libraries[num_libraries++] = argv[++i];
+		else if(0 == strcmp(argv[i], "--startup-bench") && (i + 1) < argc) {
+			int iterations = atoi(argv[++i]);
+			run_startup_benchmark((iterations > 0)?iterations:100);
+			goto label_final;
+		}
+		else scripts[num_scripts++] = argv[i];
+	}
+	
+	curl_global_init(CURL_GLOBAL_ALL);
+	js_loader_init();
+	
+	const char * html = NULL;
+	gsize cb_html = 0;
+	GBytes * html_bytes = NULL;
+	if(html_uri) {
+		html_bytes = js_loader_load(html_uri, NULL);
+		if(NULL == html_bytes) {
+			fprintf(stderr, "[ERROR]: load html '%s' failed\n", html_uri);
+			rc = -1;
+			goto label_cleanup;
+		}
+		html = g_bytes_get_data(html_bytes, &cb_html);
+	}
+	
+	struct headless_runtime rt[1];
+	rc = runtime_init(rt, html, cb_html, html_uri);
+	if(html_bytes) g_bytes_unref(html_bytes);
+	if(rc) goto label_cleanup;
+	fprintf(stderr, "[INFO]: startup: %.3f ms\n", app_timer_get_elapsed(timer) * 1000.0);
+	
+	for(int i = 0; 0 == rc && i < num_libraries; ++i) rc = runtime_evaluate(rt, libraries[i], 0);
+	for(int i = 0; 0 == rc && i < num_scripts; ++i) rc = runtime_evaluate(rt, scripts[i], 1);
+	runtime_run(rt);
+	
+	runtime_cleanup(rt);
+	
+label_cleanup:
+	js_loader_cleanup(stderr);
+	curl_global_cleanup();
+label_final:
+	free(libraries);
+	free(scripts);
+	return rc;
+}
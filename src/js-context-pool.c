@@ -0,0 +1,286 @@
+/*
+ * js-context-pool.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "js-context-pool.h"
+#include "app_timer.h"
+#include "utils.h"
+
+struct js_worker
+{
+	struct js_context_pool * pool;
+	int id;
+	pthread_t th;
+
+	JSCVirtualMachine * vm;
+	struct js_context_template tmpl[1];	// libraries are evaluated once, each job runs in its own scope object
+
+	app_timer_t timer[1];
+	struct js_worker_stats stats[1];
+};
+
+void js_job_free(struct js_job * job)
+{
+	if(NULL == job) return;
+	free(job->source);
+	free(job->uri);
+	free(job->result);
+	free(job->exception);
+	free(job);
+}
+
+static void js_job_complete(struct js_context_pool * pool, struct js_job * job)
+{
+	if(job->on_completed) {
+		job->on_completed(job, job->user_data);	// the job may be freed by the callback
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex);
+	job->done = 1;
+	pthread_cond_broadcast(&pool->done_cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void * worker_thread(void * user_data)
+{
+	struct js_worker * worker = user_data;
+	struct js_context_pool * pool = worker->pool;
+	assert(worker && pool);
+
+	// step 0. warm up: create a new virtual machine per thread and pre-evaluate libraries
+	app_timer_start(worker->timer);
+	worker->vm = jsc_virtual_machine_new();
+	JSCContext * js = jsc_context_new_with_virtual_machine(worker->vm);
+	assert(js);
+	
+	struct js_context_template * tmpl = js_context_template_init(worker->tmpl, js, pool->libraries, pool->num_libraries, worker);
+	g_object_unref(js);	// owned by the template
+	worker->stats->warmup_time = app_timer_get_elapsed(worker->timer);
+
+	pthread_mutex_lock(&pool->mutex);
+	++pool->num_ready;
+	pthread_cond_broadcast(&pool->done_cond);
+
+	// step 1. process jobs
+	app_timer_t job_timer[1];
+	while(!pool->quit) {
+		struct js_job * job = pool->jobs->pop(pool->jobs);
+		if(NULL == job) {
+			pthread_cond_wait(&pool->job_cond, &pool->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		app_timer_start(job_timer);
+		job->worker_id = worker->id;
+		JSCValue * ret_val = tmpl->evaluate(tmpl, job->source, job->cb_source, job->uri, NULL);
+		job->err_code = js_utils_take_result(tmpl->js, ret_val, &job->result, &job->exception);
+		job->time_cost = app_timer_stop(job_timer);
+
+		pthread_mutex_lock(&pool->mutex);
+		++worker->stats->num_jobs;
+		if(job->err_code) ++worker->stats->num_errors;
+		worker->stats->busy_time += job->time_cost;
+		pthread_mutex_unlock(&pool->mutex);
+
+		js_job_complete(pool, job);
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	js_context_template_cleanup(worker->tmpl);
+	g_object_unref(worker->vm);
+	worker->vm = NULL;
+	pthread_exit((void *)(long)0);
+}
+
+static struct js_job * pool_submit(struct js_context_pool * pool,
+	const char * source, ssize_t cb_source, const char * uri,
+	void (* on_completed)(struct js_job * job, void * user_data), void * user_data)
+{
+	assert(pool && source);
+	if(cb_source == -1) cb_source = strlen(source);
+	if(NULL == uri) uri = "(anonymous)";
+
+	struct js_job * job = calloc(1, sizeof(*job));
+	assert(job);
+	job->source = malloc(cb_source + 1);
+	assert(job->source);
+	memcpy(job->source, source, cb_source);
+	job->source[cb_source] = '\0';
+	job->cb_source = cb_source;
+	job->uri = strdup(uri);
+	job->on_completed = on_completed;
+	job->user_data = user_data;
+	job->worker_id = -1;
+
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->quit) {
+		pthread_mutex_unlock(&pool->mutex);
+		js_job_free(job);
+		return NULL;
+	}
+	pool->jobs->push(pool->jobs, job);
+	pthread_cond_signal(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	return job;
+}
+
+static int pool_wait(struct js_context_pool * pool, struct js_job * job)
+{
+	assert(pool && job);
+	assert(NULL == job->on_completed);
+
+	pthread_mutex_lock(&pool->mutex);
+	while(!job->done) pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+	return job->err_code;
+}
+
+static int pool_get_stats(struct js_context_pool * pool, int worker_id, struct js_worker_stats * stats)
+{
+	assert(pool && stats);
+	if(worker_id < 0 || worker_id >= pool->num_workers) return -1;
+
+	struct js_worker * worker = &pool->workers[worker_id];
+	pthread_mutex_lock(&pool->mutex);
+	*stats = *worker->stats;
+	pthread_mutex_unlock(&pool->mutex);
+
+	app_timer_t timer = *worker->timer;
+	stats->uptime = app_timer_get_elapsed(&timer);
+	return 0;
+}
+
+struct js_context_pool * js_context_pool_init(struct js_context_pool * pool, int num_workers,
+	const struct js_source * libraries, int num_libraries,
+	void * user_data)
+{
+	int rc = 0;
+	if(num_workers <= 0) {
+		num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+		if(num_workers <= 0) num_workers = 1;
+	}
+
+	if(NULL == pool) pool = calloc(1, sizeof(*pool));
+	else memset(pool, 0, sizeof(*pool));
+	assert(pool);
+
+	pool->user_data = user_data;
+	pool->submit = pool_submit;
+	pool->wait = pool_wait;
+	pool->get_stats = pool_get_stats;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->job_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	clib_queue_init(pool->jobs);
+
+	pool->libraries = libraries;
+	pool->num_libraries = num_libraries;
+
+	struct js_worker * workers = calloc(num_workers, sizeof(*workers));
+	assert(workers);
+	pool->workers = workers;
+	pool->num_workers = num_workers;
+
+	for(int i = 0; i < num_workers; ++i) {
+		workers[i].pool = pool;
+		workers[i].id = i;
+		rc = pthread_create(&workers[i].th, NULL, worker_thread, &workers[i]);
+		assert(0 == rc);
+	}
+
+	// wait for all contexts to be warmed up, the libraries can be released after init()
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->num_ready < num_workers) pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pool->libraries = NULL;
+	pool->num_libraries = 0;
+	pthread_mutex_unlock(&pool->mutex);
+
+	return pool;
+}
+
+void js_context_pool_cleanup(struct js_context_pool * pool)
+{
+	if(NULL == pool || NULL == pool->workers) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->job_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for(int i = 0; i < pool->num_workers; ++i) {
+		void * exit_code = NULL;
+		pthread_join(pool->workers[i].th, &exit_code);
+	}
+
+	// cancel pending jobs
+	struct js_job * job = NULL;
+	while((job = pool->jobs->pop(pool->jobs))) {
+		job->err_code = ECANCELED;
+		js_job_complete(pool, job);
+	}
+	clib_queue_cleanup(pool->jobs);
+
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->num_workers = 0;
+
+	pthread_cond_destroy(&pool->job_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	return;
+}
+
+void js_context_pool_dump_stats(struct js_context_pool * pool, FILE * fp)
+{
+	assert(pool);
+	if(NULL == fp) fp = stdout;
+
+	long total_jobs = 0;
+	for(int i = 0; i < pool->num_workers; ++i) {
+		struct js_worker_stats stats[1];
+		memset(stats, 0, sizeof(stats));
+		pool_get_stats(pool, i, stats);
+		total_jobs += stats->num_jobs;
+
+		fprintf(fp, "worker %.2d: jobs=%ld, errors=%ld, warmup=%.3f ms, busy=%.3f s, "
+			"throughput=%.1f jobs/s (busy), %.1f jobs/s (uptime)\n",
+			i, stats->num_jobs, stats->num_errors, stats->warmup_time * 1000.0, stats->busy_time,
+			(stats->busy_time > 0)?(double)stats->num_jobs / stats->busy_time:0.0,
+			(stats->uptime > 0)?(double)stats->num_jobs / stats->uptime:0.0);
+	}
+	fprintf(fp, "total jobs: %ld, workers: %d\n", total_jobs, pool->num_workers);
+}
@@ -0,0 +1,675 @@
+/*
+ * js-dom.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+
+#include <libxml/tree.h>
+#include <libxml/HTMLtree.h>
+
+#include "js-dom.h"
+
+#define SELECTOR_MAX_PARTS (16)
+#define SELECTOR_MAX_CLASSES (8)
+#define SELECTOR_NAME_MAX_LENGTH (128)
+
+struct simple_selector
+{
+	char tag[SELECTOR_NAME_MAX_LENGTH];	// empty or "*": any
+	char id[SELECTOR_NAME_MAX_LENGTH];
+	int num_classes;
+	char classes[SELECTOR_MAX_CLASSES][SELECTOR_NAME_MAX_LENGTH];
+};
+
+struct js_dom_private
+{
+	struct js_dom * jdom;
+	
+	// wrapped nodes, to release the cached JSCValues in js_dom_cleanup()
+	xmlNode ** wrapped;
+	size_t count;
+	size_t size;
+	
+	GHashTable * ids;	// id ==> the first xmlNode with that id, built on the first getElementById()
+};
+
+/******************************************************
+ * selectors
+ *****************************************************/
+static inline int is_name_char(int c)
+{
+	return isalnum(c) || c == '-' || c == '_';
+}
+
+static const char * parse_name(const char * p, char name[static SELECTOR_NAME_MAX_LENGTH])
+{
+	int i = 0;
+	while(is_name_char((unsigned char)*p)) {
+		if(i >= (SELECTOR_NAME_MAX_LENGTH - 1)) return NULL;
+		name[i++] = *p++;
+	}
+	name[i] = '\0';
+	return (i > 0)?p:NULL;
+}
+
+/*
+ * parse_selector()
+ * @return number of parts (simple selectors joined by descendant combinators), -1 if not supported
+ */
+static int parse_selector(const char * selector, struct simple_selector parts[static SELECTOR_MAX_PARTS])
+{
+	int num_parts = 0;
+	const char * p = selector;
+	while(*p) {
+		while(isspace((unsigned char)*p)) ++p;
+		if(!*p) break;
+		if(num_parts >= SELECTOR_MAX_PARTS) return -1;
+		
+		struct simple_selector * sel = &parts[num_parts++];
+		memset(sel, 0, sizeof(*sel));
+		if(*p == '*') { ++p; strcpy(sel->tag, "*"); }
+		else if(is_name_char((unsigned char)*p)) p = parse_name(p, sel->tag);
+		
+		while(p && *p && !isspace((unsigned char)*p)) {
+			if(*p == '#') p = parse_name(p + 1, sel->id);
+			else if(*p == '.') {
+				if(sel->num_classes >= SELECTOR_MAX_CLASSES) return -1;
+				p = parse_name(p + 1, sel->classes[sel->num_classes++]);
+			}else return -1;	// combinators other than ' ', attributes, pseudo-classes, groups ...
+		}
+		if(NULL == p) return -1;
+	}
+	return num_parts;
+}
+
+static const char * node_get_attr(xmlNode * node, const char * name)
+{
+	xmlAttr * attr = xmlHasProp(node, BAD_CAST name);
+	if(attr && attr->children && attr->children->type == XML_TEXT_NODE) return (const char *)attr->children->content;
+	return NULL;
+}
+
+static int has_class(const char * class_list, const char * name)
+{
+	size_t cb_name = strlen(name);
+	const char * p = class_list;
+	while(*p) {
+		while(isspace((unsigned char)*p)) ++p;
+		const char * end = p;
+		while(*end && !isspace((unsigned char)*end)) ++end;
+		if((size_t)(end - p) == cb_name && 0 == strncmp(p, name, cb_name)) return 1;
+		p = end;
+	}
+	return 0;
+}
+
+static int match_simple(xmlNode * node, const struct simple_selector * sel)
+{
+	if(node->type != XML_ELEMENT_NODE) return 0;
+	if(sel->tag[0] && sel->tag[0] != '*' && strcasecmp((char *)node->name, sel->tag)) return 0;
+	if(sel->id[0]) {
+		const char * id = node_get_attr(node, "id");
+		if(NULL == id || strcmp(id, sel->id)) return 0;
+	}
+	if(sel->num_classes > 0) {
+		const char * class_list = node_get_attr(node, "class");
+		if(NULL == class_list) return 0;
+		for(int i = 0; i < sel->num_classes; ++i) {
+			if(!has_class(class_list, sel->classes[i])) return 0;
+		}
+	}
+	return 1;
+}
+
+static int match_selector(xmlNode * node, const struct simple_selector * parts, int num_parts)
+{
+	if(!match_simple(node, &parts[num_parts - 1])) return 0;
+	
+	// descendant combinators only: matching the nearest ancestors greedily is sufficient
+	int k = num_parts - 2;
+	for(xmlNode * parent = node->parent; parent && k >= 0; parent = parent->parent) {
+		if(match_simple(parent, &parts[k])) --k;
+	}
+	return (k < 0);
+}
+
+/*
+ * collect matched elements of the subtree (exclusive) in document order
+ * @return 1 if max_results has been reached
+ */
+static int query_subtree(xmlNode * root, const struct simple_selector * parts, int num_parts, GPtrArray * results, size_t max_results)
+{
+	for(xmlNode * cur = root->children; cur; cur = cur->next) {
+		if(cur->type != XML_ELEMENT_NODE) continue;
+		if(match_selector(cur, parts, num_parts)) {
+			g_ptr_array_add(results, cur);
+			if(max_results && results->len >= max_results) return 1;
+		}
+		if(query_subtree(cur, parts, num_parts, results, max_results)) return 1;
+	}
+	return 0;
+}
+
+static xmlNode * dom_get_element_by_id(struct js_dom * jdom, const char * id);
+
+/*
+ * js_dom_query()
+ * @param scope: NULL: the whole document
+ * @return number of elements added to results, -1 if the selector is not supported
+ */
+static int js_dom_query(struct js_dom * jdom, xmlNode * scope, const char * selector, GPtrArray * results, size_t max_results)
+{
+	struct simple_selector parts[SELECTOR_MAX_PARTS];
+	int num_parts = parse_selector(selector, parts);
+	if(num_parts <= 0) return -1;
+	
+	const struct simple_selector * last = &parts[num_parts - 1];
+	guint start = results->len;
+	if(NULL == scope) {
+		// use the document's indexes if possible
+		if(last->id[0]) {
+			xmlNode * node = dom_get_element_by_id(jdom, last->id);
+			if(node && match_selector(node, parts, num_parts)) g_ptr_array_add(results, node);
+			return results->len - start;
+		}
+		if(last->tag[0] && last->tag[0] != '*') {
+			size_t count = 0;
+			xmlNode ** nodes = jdom->dom->getElementsByTagName(jdom->dom, last->tag, &count);
+			for(size_t i = 0; i < count; ++i) {
+				if(!match_selector(nodes[i], parts, num_parts)) continue;
+				g_ptr_array_add(results, nodes[i]);
+				if(max_results && results->len >= max_results) break;
+			}
+			return results->len - start;
+		}
+		scope = (xmlNode *)jdom->dom->doc;
+	}
+	query_subtree(scope, parts, num_parts, results, max_results);
+	return results->len - start;
+}
+
+/******************************************************
+ * wrappers
+ *****************************************************/
+JSCValue * js_dom_wrap_node(struct js_dom * jdom, xmlNode * node)
+{
+	if(NULL == node) return jsc_value_new_null(jdom->js);
+	if(node->type == XML_DOCUMENT_NODE || node->type == XML_HTML_DOCUMENT_NODE) return g_object_ref(jdom->document);
+	
+	JSCValue * value = node->_private;
+	if(NULL == value) {
+		struct js_dom_private * priv = jdom->priv;
+		if(priv->count >= priv->size) {
+			size_t new_size = priv->size?(priv->size * 2):256;
+			xmlNode ** wrapped = realloc(priv->wrapped, sizeof(*wrapped) * new_size);
+			assert(wrapped);
+			priv->wrapped = wrapped;
+			priv->size = new_size;
+		}
+		
+		value = jsc_value_new_object(jdom->js, node, jdom->element_class);
+		assert(value);
+		node->_private = value;	// the cache holds one reference
+		priv->wrapped[priv->count++] = node;
+		++jdom->num_wrappers;
+	}
+	return g_object_ref(value);
+}
+
+static JSCValue * wrap_nodes(struct js_dom * jdom, xmlNode ** nodes, size_t count)
+{
+	GPtrArray * array = g_ptr_array_new_full(count, g_object_unref);
+	for(size_t i = 0; i < count; ++i) {
+		g_ptr_array_add(array, js_dom_wrap_node(jdom, nodes[i]));
+	}
+	JSCValue * value = jsc_value_new_array_from_garray(jdom->js, array);
+	g_ptr_array_unref(array);
+	return value;
+}
+
+static JSCValue * query_selector_all(struct js_dom * jdom, xmlNode * scope, const char * selector, size_t max_results)
+{
+	if(NULL == selector) selector = "";
+	GPtrArray * results = g_ptr_array_sized_new(16);
+	int rc = js_dom_query(jdom, scope, selector, results, max_results);
+	
+	JSCValue * value = NULL;
+	if(rc < 0) {
+		jsc_context_throw(jdom->js, "SyntaxError: unsupported selector");
+		value = jsc_value_new_undefined(jdom->js);
+	}else if(max_results == 1) {
+		value = js_dom_wrap_node(jdom, (results->len > 0)?results->pdata[0]:NULL);
+	}else {
+		value = wrap_nodes(jdom, (xmlNode **)results->pdata, results->len);
+	}
+	g_ptr_array_unref(results);
+	return value;
+}
+
+static JSCValue * new_string_or_null(JSCContext * js, const char * str)
+{
+	if(NULL == str) return jsc_value_new_null(js);
+	return jsc_value_new_string(js, str);
+}
+
+/******************************************************
+ * Element class
+ *****************************************************/
+static JSCValue * element_get_tag_name(xmlNode * node, struct js_dom * jdom)
+{
+	char tag_name[SELECTOR_NAME_MAX_LENGTH] = "";
+	size_t i = 0;
+	for(; node->name[i] && i < (sizeof(tag_name) - 1); ++i) tag_name[i] = toupper(node->name[i]);
+	tag_name[i] = '\0';
+	return jsc_value_new_string(jdom->js, tag_name);
+}
+
+static JSCValue * element_get_id(xmlNode * node, struct js_dom * jdom)
+{
+	const char * id = node_get_attr(node, "id");
+	return jsc_value_new_string(jdom->js, id?id:"");
+}
+
+static JSCValue * element_get_class_name(xmlNode * node, struct js_dom * jdom)
+{
+	const char * class_list = node_get_attr(node, "class");
+	return jsc_value_new_string(jdom->js, class_list?class_list:"");
+}
+
+static JSCValue * element_get_text_content(xmlNode * node, struct js_dom * jdom)
+{
+	xmlChar * content = xmlNodeGetContent(node);
+	JSCValue * value = jsc_value_new_string(jdom->js, content?(char *)content:"");
+	if(content) xmlFree(content);
+	return value;
+}
+
+static JSCValue * element_get_outer_html(xmlNode * node, struct js_dom * jdom)
+{
+	xmlBuffer * buf = xmlBufferCreate();
+	assert(buf);
+	htmlNodeDump(buf, node->doc, node);
+	JSCValue * value = jsc_value_new_string(jdom->js, (const char *)xmlBufferContent(buf));
+	xmlBufferFree(buf);
+	return value;
+}
+
+static JSCValue * element_get_parent_node(xmlNode * node, struct js_dom * jdom)
+{
+	return js_dom_wrap_node(jdom, node->parent);
+}
+
+static JSCValue * element_get_children(xmlNode * node, struct js_dom * jdom)
+{
+	GPtrArray * array = g_ptr_array_new_full(8, g_object_unref);
+	for(xmlNode * child = node->children; child; child = child->next) {
+		if(child->type == XML_ELEMENT_NODE) g_ptr_array_add(array, js_dom_wrap_node(jdom, child));
+	}
+	JSCValue * value = jsc_value_new_array_from_garray(jdom->js, array);
+	g_ptr_array_unref(array);
+	return value;
+}
+
+static JSCValue * element_get_attribute(xmlNode * node, const char * name, struct js_dom * jdom)
+{
+	if(NULL == name) return jsc_value_new_null(jdom->js);
+	xmlChar * attr = xmlGetProp(node, BAD_CAST name);
+	JSCValue * value = new_string_or_null(jdom->js, (char *)attr);
+	if(attr) xmlFree(attr);
+	return value;
+}
+
+static JSCValue * element_get_elements_by_tag_name(xmlNode * node, const char * tag_name, struct js_dom * jdom)
+{
+	if(NULL == tag_name || !tag_name[0]) return wrap_nodes(jdom, NULL, 0);
+	return query_selector_all(jdom, node, tag_name, 0);
+}
+
+static JSCValue * element_query_selector(xmlNode * node, const char * selector, struct js_dom * jdom)
+{
+	return query_selector_all(jdom, node, selector, 1);
+}
+
+static JSCValue * element_query_selector_all(xmlNode * node, const char * selector, struct js_dom * jdom)
+{
+	return query_selector_all(jdom, node, selector, 0);
+}
+
+/******************************************************
+ * Document class
+ *****************************************************/
+static void collect_ids(GHashTable * ids, xmlNode * root)
+{
+	for(xmlNode * cur = root; cur; cur = cur->next) {
+		if(cur->type != XML_ELEMENT_NODE) continue;
+		const char * id = node_get_attr(cur, "id");
+		if(id && id[0] && !g_hash_table_contains(ids, id)) {	// keep the first one in document order
+			g_hash_table_insert(ids, (gpointer)id, cur);
+		}
+		collect_ids(ids, cur->children);
+	}
+}
+
+static xmlNode * dom_get_element_by_id(struct js_dom * jdom, const char * id)
+{
+	struct js_dom_private * priv = jdom->priv;
+	if(NULL == priv->ids) {
+		priv->ids = g_hash_table_new(g_str_hash, g_str_equal);
+		collect_ids(priv->ids, jdom->dom->root);
+	}
+	return g_hash_table_lookup(priv->ids, id);
+}
+
+static JSCValue * document_get_document_element(struct js_dom * jdom, struct js_dom * user_data)
+{
+	return js_dom_wrap_node(jdom, jdom->dom->root);
+}
+
+static JSCValue * document_get_head(struct js_dom * jdom, struct js_dom * user_data)
+{
+	return js_dom_wrap_node(jdom, jdom->dom->getElementByTagName(jdom->dom, "head"));
+}
+
+static JSCValue * document_get_body(struct js_dom * jdom, struct js_dom * user_data)
+{
+	return js_dom_wrap_node(jdom, jdom->dom->getElementByTagName(jdom->dom, "body"));
+}
+
+static JSCValue * document_get_title(struct js_dom * jdom, struct js_dom * user_data)
+{
+	xmlNode * title = jdom->dom->getElementByTagName(jdom->dom, "title");
+	if(NULL == title) return jsc_value_new_string(jdom->js, "");
+	return element_get_text_content(title, jdom);
+}
+
+static JSCValue * document_get_element_by_id(struct js_dom * jdom, const char * id, struct js_dom * user_data)
+{
+	if(NULL == id) return jsc_value_new_null(jdom->js);
+	return js_dom_wrap_node(jdom, dom_get_element_by_id(jdom, id));
+}
+
+static JSCValue * document_get_elements_by_tag_name(struct js_dom * jdom, const char * tag_name, struct js_dom * user_data)
+{
+	if(NULL == tag_name || !tag_name[0]) return wrap_nodes(jdom, NULL, 0);
+	if(0 == strcmp(tag_name, "*")) return query_selector_all(jdom, NULL, tag_name, 0);
+	
+	size_t count = 0;
+	xmlNode ** nodes = jdom->dom->getElementsByTagName(jdom->dom, tag_name, &count);
+	return wrap_nodes(jdom, nodes, count);
+}
+
+static JSCValue * document_query_selector(struct js_dom * jdom, const char * selector, struct js_dom * user_data)
+{
+	return query_selector_all(jdom, NULL, selector, 1);
+}
+
+static JSCValue * document_query_selector_all(struct js_dom * jdom, const char * selector, struct js_dom * user_data)
+{
+	return query_selector_all(jdom, NULL, selector, 0);
+}
+
+/******************************************************
+ * js_dom
+ *****************************************************/
+#define add_property(jsc_class, name, getter, jdom) \
+	jsc_class_add_property(jsc_class, name, JSC_TYPE_VALUE, G_CALLBACK(getter), NULL, jdom, NULL)
+#define add_method(jsc_class, name, callback, jdom) \
+	jsc_class_add_method(jsc_class, name, G_CALLBACK(callback), jdom, NULL, JSC_TYPE_VALUE, 1, G_TYPE_STRING)
+
+struct js_dom * js_dom_init(struct js_dom * jdom, JSCContext * js, struct w3c_dom * dom, void * user_data)
+{
+	assert(js && dom);
+	if(NULL == jdom) jdom = calloc(1, sizeof(*jdom));
+	assert(jdom);
+	
+	struct js_dom_private * priv = calloc(1, sizeof(*priv));
+	assert(priv);
+	priv->jdom = jdom;
+	
+	jdom->priv = priv;
+	jdom->user_data = user_data;
+	jdom->js = g_object_ref(js);
+	jdom->dom = dom;
+	
+	JSCClass * element_class = jsc_context_register_class(js, "Element", NULL, NULL, NULL);
+	assert(element_class);
+	add_property(element_class, "tagName", element_get_tag_name, jdom);
+	add_property(element_class, "nodeName", element_get_tag_name, jdom);
+	add_property(element_class, "id", element_get_id, jdom);
+	add_property(element_class, "className", element_get_class_name, jdom);
+	add_property(element_class, "textContent", element_get_text_content, jdom);
+	add_property(element_class, "outerHTML", element_get_outer_html, jdom);
+	add_property(element_class, "parentNode", element_get_parent_node, jdom);
+	add_property(element_class, "children", element_get_children, jdom);
+	add_method(element_class, "getAttribute", element_get_attribute, jdom);
+	add_method(element_class, "getElementsByTagName", element_get_elements_by_tag_name, jdom);
+	add_method(element_class, "querySelector", element_query_selector, jdom);
+	add_method(element_class, "querySelectorAll", element_query_selector_all, jdom);
+	jdom->element_class = element_class;
+	
+	JSCClass * document_class = jsc_context_register_class(js, "HTMLDocument", NULL, NULL, NULL);
+	assert(document_class);
+	add_property(document_class, "documentElement", document_get_document_element, jdom);
+	add_property(document_class, "head", document_get_head, jdom);
+	add_property(document_class, "body", document_get_body, jdom);
+	add_property(document_class, "title", document_get_title, jdom);
+	add_method(document_class, "getElementById", document_get_element_by_id, jdom);
+	add_method(document_class, "getElementsByTagName", document_get_elements_by_tag_name, jdom);
+	add_method(document_class, "querySelector", document_query_selector, jdom);
+	add_method(document_class, "querySelectorAll", document_query_selector_all, jdom);
+	jdom->document_class = document_class;
+	
+	jdom->document = jsc_value_new_object(js, jdom, document_class);
+	assert(jdom->document);
+	return jdom;
+}
+#undef add_property
+#undef add_method
+
+void js_dom_cleanup(struct js_dom * jdom)
+{
+	if(NULL == jdom) return;
+	struct js_dom_private * priv = jdom->priv;
+	if(priv) {
+		for(size_t i = 0; i < priv->count; ++i) {
+			xmlNode * node = priv->wrapped[i];
+			if(node->_private) g_object_unref(node->_private);
+			node->_private = NULL;
+		}
+		free(priv->wrapped);
+		if(priv->ids) g_hash_table_destroy(priv->ids);
+		free(priv);
+		jdom->priv = NULL;
+	}
+	
+	if(jdom->document) g_object_unref(jdom->document);
+	jdom->document = NULL;
+	if(jdom->js) g_object_unref(jdom->js);
+	jdom->js = NULL;
+	return;
+}
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_JS_DOM) && defined(_STAND_ALONE)
+#include <libxml/HTMLparser.h>
+#include <webkit2/webkit2.h>
+#include "utils.h"
+#include "js-utils.h"
+#include "app_timer.h"
+
+/*
+ * benchmark: the same selector workload on the native document vs. a WebKitWebView
+ * usage: js-dom [iterations] [file.html]
+ */
+#define NUM_SYNTHETIC_ITEMS (2000)
+static char * generate_synthetic_html(ssize_t * p_length)
+{
+	size_t size = NUM_SYNTHETIC_ITEMS * 160 + 256;
+	char * html = calloc(size, 1);
+	assert(html);
+	
+	ssize_t cb = 0;
+	cb += snprintf(html + cb, size - cb, "<html><head><title>benchmark</title></head><body><div id=\"main\">\n");
+	for(int i = 0; i < NUM_SYNTHETIC_ITEMS; ++i) {
+		cb += snprintf(html + cb, size - cb, 
+			"<div class=\"item%s\" id=\"item-%d\"><a href=\"/item/%d\">item %d</a><span class=\"price\">%d</span></div>\n",
+			(i % 3)?"":" featured", i, i, i, i);
+	}
+	cb += snprintf(html + cb, size - cb, "</div></body></html>\n");
+	*p_length = cb;
+	return html;
+}
+
+static const char * s_workload_fmt = 
+	"(function(n) {\n"
+	"	var total = 0;\n"
+	"	for(var i = 0; i < n; ++i) {\n"
+	"		total += document.querySelectorAll('div.item a').length;\n"
+	"		total += document.querySelectorAll('#main .featured .price').length;\n"
+	"		total += document.getElementsByTagName('span').length;\n"
+	"		var item = document.getElementById('item-' + (i % 1000));\n"
+	"		if(item) total += item.querySelectorAll('.price').length + item.children.length;\n"
+	"	}\n"
+	"	return total;\n"
+	"})(%d);";
+
+struct webview_context
+{
+	GMainLoop * loop;
+	double result;
+	int err_code;
+};
+
+static void on_webview_load_changed(WebKitWebView * webview, WebKitLoadEvent load_event, struct webview_context * ctx)
+{
+	if(load_event == WEBKIT_LOAD_FINISHED) g_main_loop_quit(ctx->loop);
+}
+
+static void on_webview_js_finished(GObject * object, GAsyncResult * res, struct webview_context * ctx)
+{
+	GError * gerr = NULL;
+	WebKitJavascriptResult * result = webkit_web_view_run_javascript_finish(WEBKIT_WEB_VIEW(object), res, &gerr);
+	if(NULL == result) {
+		fprintf(stderr, "[ERROR]: %s\n", gerr?gerr->message:"run javascript failed");
+		if(gerr) g_error_free(gerr);
+		ctx->err_code = -1;
+	}else {
+		ctx->result = jsc_value_to_double(webkit_javascript_result_get_js_value(result));
+		webkit_javascript_result_unref(result);
+	}
+	g_main_loop_quit(ctx->loop);
+}
+
+int main(int argc, char ** argv)
+{
+	int iterations = 100;
+	if(argc > 1) iterations = atoi(argv[1]);
+	if(iterations <= 0) iterations = 100;
+	
+	char * html = NULL;
+	ssize_t cb_html = 0;
+	if(argc > 2) cb_html = utils_load_file(NULL, argv[2], (unsigned char **)&html, NULL);
+	else html = generate_synthetic_html(&cb_html);
+	assert(html && cb_html > 0);
+	
+	char script[4096] = "";
+	snprintf(script, sizeof(script), s_workload_fmt, iterations);
+	
+	app_timer_t timer[1];
+	
+	// native document
+	app_timer_start(timer);
+	xmlDoc * doc = htmlReadMemory(html, cb_html, "http://localhost/", "utf-8", 
+		HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+	assert(doc);
+	struct w3c_dom dom[1];
+	w3c_dom_init(dom, doc, xmlDocGetRootElement(doc), NULL);
+	
+	JSCContext * js = jsc_context_new();
+	struct js_dom jdom[1];
+	memset(jdom, 0, sizeof(jdom));
+	js_dom_init(jdom, js, dom, NULL);
+	jsc_context_set_value(js, "document", jdom->document);
+	double native_setup_time = app_timer_stop(timer);
+	
+	app_timer_start(timer);
+	JSCValue * ret_val = jsc_context_evaluate(js, script, -1);
+	double native_time = app_timer_stop(timer);
+	
+	char * result = NULL, * exception = NULL;
+	int rc = js_utils_take_result(js, ret_val, &result, &exception);
+	if(rc) fprintf(stderr, "[ERROR]: %s\n", exception);
+	assert(0 == rc);
+	
+	printf("html: %ld bytes, iterations: %d\n", (long)cb_html, iterations);
+	printf("native : setup %8.3f ms, workload %8.3f ms, result=%s, wrappers=%ld\n", 
+		native_setup_time * 1000.0, native_time * 1000.0, result, jdom->num_wrappers);
+	free(result);
+	free(exception);
+	
+	js_dom_cleanup(jdom);
+	g_object_unref(js);
+	w3c_dom_cleanup(dom);
+	xmlFreeDoc(doc);
+	
+	// WebKitWebView
+	if(!gtk_init_check(&argc, &argv)) {
+		printf("webview: skipped (no display)\n");
+		free(html);
+		return 0;
+	}
+	
+	struct webview_context ctx[1];
+	memset(ctx, 0, sizeof(ctx));
+	ctx->loop = g_main_loop_new(NULL, FALSE);
+	
+	app_timer_start(timer);
+	GtkWidget * webview = webkit_web_view_new();
+	g_signal_connect(webview, "load-changed", G_CALLBACK(on_webview_load_changed), ctx);
+	webkit_web_view_load_html(WEBKIT_WEB_VIEW(webview), html, "http://localhost/");
+	g_main_loop_run(ctx->loop);
+	double webview_setup_time = app_timer_stop(timer);
+	
+	app_timer_start(timer);
+	webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(webview), script, NULL, (GAsyncReadyCallback)on_webview_js_finished, ctx);
+	g_main_loop_run(ctx->loop);
+	double webview_time = app_timer_stop(timer);
+	
+	printf("webview: setup %8.3f ms, workload %8.3f ms, result=%.0f%s\n", 
+		webview_setup_time * 1000.0, webview_time * 1000.0, ctx->result, ctx->err_code?" (error)":"");
+	
+	g_main_loop_unref(ctx->loop);
+	free(html);
+	return 0;
+}
+#endif
@@ -0,0 +1,189 @@
+/*
+ * js-loader.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "js-loader.h"
+#include "net-utils.h"
+#include "script_cache.h"
+#include "utils.h"
+#include "auto_buffer.h"
+
+#define AUTO_CLEANUP_(struct_name) __attribute__((cleanup(struct_name##_cleanup))) struct struct_name
+#define JS_LOADER_SCRIPT_CACHE_MAX_AGE (3600)	// seconds, older entries are revalidated by a conditional GET
+
+static struct script_cache * s_script_cache;	// nullable, cache for http(s) scripts
+static struct net_utils_http_cache * s_http_cache;	// nullable, conditional GET cache
+static struct net_utils_http_pool * s_http_pool;	// nullable, keep-alive connections shared by all loads
+static inline int is_http_uri(const char * uri, int * p_is_https)
+{
+	int is_https = (0 == strncasecmp(uri, "https://", sizeof("https://") - 1));
+	if(p_is_https) *p_is_https = is_https;
+	return is_https || (0 == strncasecmp(uri, "http://", sizeof("http://") - 1));
+}
+
+static void mapped_file_free(utils_mmap_file_t * map)
+{
+	utils_mmap_file_release(map);
+	free(map);
+}
+
+static GBytes * load_local_file(const char * path_name)
+{
+	utils_mmap_file_t * map = utils_mmap_file_open(NULL, NULL, path_name, 0, utils_mmap_flag_sequential | utils_mmap_flag_willneed);
+	if(NULL == map) return NULL;
+	if(0 == map->length) {
+		mapped_file_free(map);
+		return NULL;
+	}
+	return g_bytes_new_with_free_func(map->data, map->length, (GDestroyNotify)mapped_file_free, map);
+}
+
+GBytes * js_loader_load(const char * uri, uint32_t * p_cache_flags)
+{
+	assert(uri);
+	int rc = 0;
+	int is_https = 0;
+	
+	if(!is_http_uri(uri, &is_https)) return load_local_file(uri);
+	
+	// fresh entries are served without any network access,
+	// expired ones are a miss here and go through the http cache (conditional GET) below
+	if(s_script_cache) {
+		char * js_code = NULL;
+		ssize_t cb_code = s_script_cache->load(s_script_cache, uri, &js_code, p_cache_flags);
+		if(cb_code >= 0) return g_bytes_new_with_free_func(js_code, cb_code, free, js_code);
+	}
+	
+	AUTO_CLEANUP_(net_utils_http_client) http_client;
+	memset(&http_client, 0, sizeof(http_client));
+	
+	struct net_utils_http_client * client = net_utils_http_client_init_with_pool(&http_client, s_http_pool, NULL);
+	assert(client);
+	
+	rc = client->set_url(client, uri);
+	if(rc) return NULL;
+	
+	client->use_ssl = is_https;
+	client->verify_host = is_https;
+	client->cache = s_http_cache;
+	rc = client->send_request(client, "GET", NULL, 0);
+	if(rc) {
+		fprintf(stderr, "[ERROR]: %s\n", client->last_error);
+	}
+	
+	if(client->in_buf->length == 0) return NULL;
+	
+	if(0 == rc && (client->response_code == 200 || client->cache_hit) && s_script_cache) {	// store or refresh the entry
+		const unsigned char * body = auto_buffer_get_data(client->in_buf);
+		rc = s_script_cache->store(s_script_cache, uri, (const char *)body, client->in_buf->length, 0);
+		if(0 == rc && p_cache_flags) *p_cache_flags = 0;
+	}
+	
+	// take over the response body, no copying
+	size_t cb_code = 0;
+	unsigned char * js_code = auto_buffer_detach(client->in_buf, &cb_code);
+	return g_bytes_new_with_free_func(js_code, cb_code, free, js_code);
+}
+
+int js_loader_check_syntax(JSCContext * js, const char * uri, const char * js_code, ssize_t cb_code, uint32_t cache_flags)
+{
+	if(NULL == s_script_cache || !is_http_uri(uri, NULL)) return 0;
+	if(cache_flags & script_cache_flag_syntax_checked) return 0;
+	if(cache_flags & script_cache_flag_syntax_error) return -1;
+	
+	if(!JSC_IS_CONTEXT(js)) {	// nothing was checked, leave the cache index alone
+		fprintf(stderr, "[ERROR]: %s(%s): invalid JSCContext\n", __FUNCTION__, uri);
+		return -1;
+	}
+	
+	JSCException * exception = NULL;
+	JSCCheckSyntaxResult result = jsc_context_check_syntax(js, js_code, cb_code, JSC_CHECK_SYNTAX_MODE_SCRIPT, uri, 1, &exception);
+	if(result == JSC_CHECK_SYNTAX_RESULT_SUCCESS) {
+		s_script_cache->set_flags(s_script_cache, uri, script_cache_flag_syntax_checked);
+		return 0;
+	}
+	
+	// only a reported exception is a verdict on the script itself
+	if(exception) {
+		fprintf(stderr, "[ERROR]: syntax error (from: %s@%d): %s\n", 
+			uri, jsc_exception_get_line_number(exception), jsc_exception_get_message(exception));
+		g_object_unref(exception);
+		s_script_cache->set_flags(s_script_cache, uri, script_cache_flag_syntax_error);
+	}
+	return -1;
+}
+
+int js_loader_init(void)
+{
+	static struct script_cache script_cache[1];
+	static struct net_utils_http_cache http_cache[1];
+	
+	const char * cache_dir = getenv("JS_SCRIPT_CACHE_DIR");
+	if(NULL == cache_dir) cache_dir = ".script-cache";
+	const char * max_age = getenv("JS_SCRIPT_CACHE_MAX_AGE");
+	long script_max_age = max_age?atol(max_age):JS_LOADER_SCRIPT_CACHE_MAX_AGE;
+	if(script_max_age <= 0) script_max_age = JS_LOADER_SCRIPT_CACHE_MAX_AGE;
+	if(cache_dir[0] && NULL == s_script_cache) s_script_cache = script_cache_init(script_cache, cache_dir, script_max_age);
+	
+	const char * http_cache_dir = getenv("JS_HTTP_CACHE_DIR");
+	if(NULL == http_cache_dir) http_cache_dir = ".http-cache";
+	if(http_cache_dir[0] && NULL == s_http_cache) s_http_cache = net_utils_http_cache_init(http_cache, http_cache_dir);
+	
+	static struct net_utils_http_pool http_pool[1];
+	if(NULL == s_http_pool) s_http_pool = net_utils_http_pool_init(http_pool, 0, 0);
+	return 0;
+}
+
+void js_loader_cleanup(FILE * fp)
+{
+	if(s_script_cache) {
+		if(fp) fprintf(fp, "script cache: hits=%ld, misses=%ld (total: hits=%lu, misses=%lu)\n", 
+			s_script_cache->hits, s_script_cache->misses,
+			(unsigned long)s_script_cache->hdr->hits, (unsigned long)s_script_cache->hdr->misses);
+		script_cache_cleanup(s_script_cache);
+		s_script_cache = NULL;
+	}
+	if(s_http_cache) {
+		if(fp) fprintf(fp, "http cache: hits=%ld, misses=%ld, bytes saved=%lld\n", 
+			s_http_cache->hits, s_http_cache->misses, (long long)s_http_cache->bytes_saved);
+		net_utils_http_cache_cleanup(s_http_cache);
+		s_http_cache = NULL;
+	}
+	if(s_http_pool) {
+		struct net_utils_http_pool_stats stats[1];
+		net_utils_http_pool_get_stats(s_http_pool, stats);
+		if(fp) fprintf(fp, "http pool: requests=%ld, connects=%ld, reused=%ld\n", 
+			stats->num_requests, stats->num_connects, stats->num_reused);
+		net_utils_http_pool_cleanup(s_http_pool);
+		s_http_pool = NULL;
+	}
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <assert.h>
 #include "js-utils.h"
+#include "app_timer.h"
 
 
 void js_utils_dump_value(JSCValue * var)
@@ -41,3 +42,182 @@ void js_utils_dump_value(JSCValue * var)
 		}
 	}
 }
+
+
+static char * dup_and_gfree(char * g_str)
+{
+	if(NULL == g_str) return NULL;
+	char * str = strdup(g_str);
+	g_free(g_str);
+	return str;
+}
+
+int js_utils_take_result(JSCContext * js, JSCValue * ret_val, char ** p_result, char ** p_exception)
+{
+	JSCException * exception = jsc_context_get_exception(js);
+	if(exception) {
+		if(p_exception) *p_exception = dup_and_gfree(jsc_exception_to_string(exception));
+		jsc_context_clear_exception(js);
+		if(ret_val) g_object_unref(ret_val);
+		return -1;
+	}
+	
+	if(ret_val && p_result && !jsc_value_is_undefined(ret_val)) {
+		char * result = jsc_value_to_json(ret_val, 0);
+		if(NULL == result) {	// not serializable, eg. functions or cyclic objects
+			jsc_context_clear_exception(js);
+			result = jsc_value_to_string(ret_val);
+		}
+		*p_result = dup_and_gfree(result);
+	}
+	if(ret_val) g_object_unref(ret_val);
+	return 0;
+}
+
+/******************************************************
+ * js_context_template
+ *****************************************************/
+static JSCValue * template_evaluate(struct js_context_template * tmpl, const char * code, ssize_t cb_code, const char * uri, JSCValue ** p_scope)
+{
+	assert(tmpl && tmpl->js);
+	JSCValue * scope = NULL;
+	JSCValue * ret_val = jsc_context_evaluate_in_object(tmpl->js, code, cb_code, NULL, NULL, uri, 1, &scope);
+	++tmpl->num_instances;
+	
+	if(p_scope) *p_scope = scope;
+	else if(scope) g_object_unref(scope);
+	return ret_val;
+}
+
+struct js_context_template * js_context_template_init(struct js_context_template * tmpl, 
+	JSCContext * js,
+	const struct js_source * libraries, int num_libraries,
+	void * user_data)
+{
+	if(NULL == tmpl) tmpl = calloc(1, sizeof(*tmpl));
+	else memset(tmpl, 0, sizeof(*tmpl));
+	assert(tmpl);
+	
+	if(NULL == js) js = jsc_context_new();
+	else g_object_ref(js);
+	assert(js);
+	
+	tmpl->js = js;
+	tmpl->user_data = user_data;
+	tmpl->evaluate = template_evaluate;
+	
+	app_timer_t timer[1];
+	app_timer_start(timer);
+	for(int i = 0; i < num_libraries; ++i) {
+		const struct js_source * lib = &libraries[i];
+		char * exception = NULL;
+		JSCValue * ret_val = jsc_context_evaluate_with_source_uri(js, lib->code, lib->cb_code, lib->uri, 1);
+		int rc = js_utils_take_result(js, ret_val, NULL, &exception);
+		if(rc) {
+			fprintf(stderr, "[WARNING]: load library '%s' failed: %s\n", lib->uri, exception);
+			free(exception);
+		}
+	}
+	tmpl->load_time = app_timer_stop(timer);
+	return tmpl;
+}
+
+void js_context_template_cleanup(struct js_context_template * tmpl)
+{
+	if(NULL == tmpl) return;
+	if(tmpl->js) {
+		g_object_unref(tmpl->js);
+		tmpl->js = NULL;
+	}
+	return;
+}
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_JS_UTILS) && defined(_STAND_ALONE)
+#include "utils.h"
+
+/*
+ * benchmark: cold context creation (new context + evaluate libraries) vs. template-based instances
+ * usage: js-utils [iterations] [library.js ...]
+ */
+#define NUM_SYNTHETIC_FUNCTIONS (20000)
+static char * generate_synthetic_library(ssize_t * p_length)
+{
+	size_t size = NUM_SYNTHETIC_FUNCTIONS * 128;
+	char * code = calloc(size, 1);
+	assert(code);
+	
+	ssize_t cb = 0;
+	cb += snprintf(code + cb, size - cb, "var lib = {};\n");
+	for(int i = 0; i < NUM_SYNTHETIC_FUNCTIONS; ++i) {
+		cb += snprintf(code + cb, size - cb, "lib.f%d = function(a, b) { return (a * %d + b) | 0; };\n", i, i);
+	}
+	*p_length = cb;
+	return code;
+}
+
+int main(int argc, char ** argv)
+{
+	int iterations = 100;
+	if(argc > 1) iterations = atoi(argv[1]);
+	if(iterations <= 0) iterations = 100;
+	
+	int num_libraries = 0;
+	struct js_source * libraries = calloc(argc + 1, sizeof(*libraries));
+	assert(libraries);
+	for(int i = 2; i < argc; ++i) {
+		char * code = NULL;
+		ssize_t cb_code = utils_load_file(NULL, argv[i], (unsigned char **)&code, NULL);
+		if(cb_code <= 0 || NULL == code) continue;
+		libraries[num_libraries++] = (struct js_source){ .code = code, .cb_code = cb_code, .uri = argv[i] };
+	}
+	if(0 == num_libraries) {
+		ssize_t cb_code = 0;
+		char * code = generate_synthetic_library(&cb_code);
+		libraries[num_libraries++] = (struct js_source){ .code = code, .cb_code = cb_code, .uri = "synthetic-lib.js" };
+	}
+	
+	static const char * user_code = "var x = 1; function add(a, b) { return a + b; }; add(x, 2);";
+	app_timer_t timer[1];
+	
+	// cold: a new context per run
+	app_timer_start(timer);
+	for(int i = 0; i < iterations; ++i) {
+		struct js_context_template tmpl[1];
+		js_context_template_init(tmpl, NULL, libraries, num_libraries, NULL);
+		
+		JSCValue * ret_val = jsc_context_evaluate(tmpl->js, user_code, -1);
+		int rc = js_utils_take_result(tmpl->js, ret_val, NULL, NULL);
+		assert(0 == rc);
+		js_context_template_cleanup(tmpl);
+	}
+	double cold_time = app_timer_stop(timer);
+	
+	// template: libraries are evaluated only once
+	app_timer_start(timer);
+	struct js_context_template tmpl[1];
+	js_context_template_init(tmpl, NULL, libraries, num_libraries, NULL);
+	double template_load_time = app_timer_get_elapsed(timer);
+	for(int i = 0; i < iterations; ++i) {
+		JSCValue * scope = NULL;
+		JSCValue * ret_val = tmpl->evaluate(tmpl, user_code, -1, "user.js", &scope);
+		int rc = js_utils_take_result(tmpl->js, ret_val, NULL, NULL);
+		assert(0 == rc);
+		if(scope) g_object_unref(scope);
+	}
+	double template_time = app_timer_stop(timer);
+	js_context_template_cleanup(tmpl);
+	
+	printf("iterations: %d, libraries: %d\n", iterations, num_libraries);
+	printf("cold    : total %.3f ms, %.3f ms/context\n", cold_time * 1000.0, cold_time * 1000.0 / iterations);
+	printf("template: total %.3f ms (load: %.3f ms), %.3f ms/instance\n", 
+		template_time * 1000.0, template_load_time * 1000.0,
+		(template_time - template_load_time) * 1000.0 / iterations);
+	
+	for(int i = 0; i < num_libraries; ++i) free((void *)libraries[i].code);
+	free(libraries);
+	return 0;
+}
+#endif
@@ -30,6 +30,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "net-utils.h"
 
@@ -63,7 +68,6 @@ static int http_headers_add(struct net_utils_http_headers * headers, const char
 
 static int http_headers_add_line(struct net_utils_http_headers * headers, const char * line, ssize_t cb_line)
 {
-	static const char * delim = ":\r\n";
 	if(NULL == line) return -1;
 	
 	char line_buf[PATH_MAX] = "";
@@ -74,19 +78,39 @@ static int http_headers_add_line(struct net_utils_http_headers * headers, const
 	memcpy(line_buf, line, cb_line);
 	line_buf[cb_line] = '\0';
 	
-	char * tok = NULL;
-	char * value = NULL;
-	char * key = strtok_r(line_buf, delim, &tok);
-	assert(key);
-	value = strtok_r(NULL, delim, &tok);
+	// split at the first ':' only, since the value may contain ':' (eg. 'Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT')
+	char * key = line_buf;
+	char * value = strchr(line_buf, ':');
+	if(value) {
+		*value++ = '\0';
+		while(*value == ' ' || *value == '\t') ++value;
+		
+		char * p_end = value + strlen(value);
+		while(p_end > value && (p_end[-1] == '\r' || p_end[-1] == '\n' || p_end[-1] == ' ')) *--p_end = '\0';
+	}else {
+		char * p_end = key + strlen(key);
+		while(p_end > key && (p_end[-1] == '\r' || p_end[-1] == '\n')) *--p_end = '\0';
+	}
+	if(key[0] == '\0') return -1;
 	
 	return http_headers_add(headers, key, value);
 }
 
+static const char * http_headers_get(struct net_utils_http_headers * headers, const char * key)
+{
+	assert(headers && key);
+	for(size_t i = 0; i < headers->length; ++i) {
+		skey_value_pair_t * pair = headers->list[i];
+		if(pair && 0 == strcasecmp(pair->key, key)) return pair->value;
+	}
+	return NULL;
+}
+
 struct net_utils_http_headers * net_utils_http_headers_init(struct net_utils_http_headers * headers, size_t size)
 {
 	headers->add = http_headers_add;
 	headers->add_line = http_headers_add_line;
+	headers->get = http_headers_get;
 	return headers;
 }
 
@@ -107,6 +131,233 @@ void net_utils_http_headers_cleanup(struct net_utils_http_headers * headers)
 
 
 
+/******************************************************
+ * http cache (conditional GET)
+ *****************************************************/
+struct http_cache_meta
+{
+	char url[PATH_MAX];
+	char etag[256];
+	char last_modified[128];
+	int64_t length;
+};
+
+static uint64_t url_hash(const char * url)	// FNV-1a 64
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(const unsigned char * p = (const unsigned char *)url; *p; ++p) {
+		hash ^= *p;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static void http_cache_get_filename(struct net_utils_http_cache * cache, const char * url, const char * ext, char * filename, size_t size)
+{
+	snprintf(filename, size, "%s/%.16llx.%s", cache->cache_dir, (unsigned long long)url_hash(url), ext);
+}
+
+static char * read_line(char * line, size_t size, FILE * fp)
+{
+	if(NULL == fgets(line, size, fp)) return NULL;
+	line[strcspn(line, "\r\n")] = '\0';
+	return line;
+}
+
+static int http_cache_load_meta(struct net_utils_http_cache * cache, const char * url, struct http_cache_meta * meta)
+{
+	char filename[PATH_MAX + 32] = "";
+	char length[64] = "";
+	http_cache_get_filename(cache, url, "meta", filename, sizeof(filename));
+	
+	FILE * fp = fopen(filename, "r");
+	if(NULL == fp) return -1;
+	
+	memset(meta, 0, sizeof(*meta));
+	int ok = read_line(meta->url, sizeof(meta->url), fp)
+		&& read_line(meta->etag, sizeof(meta->etag), fp)
+		&& read_line(meta->last_modified, sizeof(meta->last_modified), fp)
+		&& read_line(length, sizeof(length), fp);
+	fclose(fp);
+	
+	if(!ok || strcmp(meta->url, url) != 0) return -1;	// corrupted or hash collision
+	meta->length = atoll(length);
+	return 0;
+}
+
+// unique per call (mkstemp), several threads may store the same url at the same time
+static FILE * http_cache_create_tmp_file(const char * filename, char * tmp_filename, size_t size)
+{
+	snprintf(tmp_filename, size, "%s.XXXXXX", filename);
+	int fd = mkstemp(tmp_filename);
+	if(fd < 0) return NULL;
+	fchmod(fd, 0644);
+	
+	FILE * fp = fdopen(fd, "w");
+	if(NULL == fp) {
+		close(fd);
+		unlink(tmp_filename);
+	}
+	return fp;
+}
+
+// remove a stale or broken entry, the next request will be an unconditional GET
+static void http_cache_invalidate(struct net_utils_http_cache * cache, const char * url)
+{
+	char filename[PATH_MAX + 32] = "";
+	http_cache_get_filename(cache, url, "meta", filename, sizeof(filename));
+	unlink(filename);
+	http_cache_get_filename(cache, url, "body", filename, sizeof(filename));
+	unlink(filename);
+}
+
+// the body file must exist and match meta->length before the conditional headers are sent
+static int http_cache_check_body(struct net_utils_http_cache * cache, const char * url, const struct http_cache_meta * meta)
+{
+	char filename[PATH_MAX + 32] = "";
+	http_cache_get_filename(cache, url, "body", filename, sizeof(filename));
+	struct stat st[1];
+	if(stat(filename, st) || !S_ISREG(st->st_mode) || st->st_size != meta->length) return -1;
+	return 0;
+}
+
+static int http_cache_store(struct net_utils_http_cache * cache, const char * url, 
+	const char * etag, const char * last_modified, 
+	const void * body, size_t cb_body)
+{
+	char filename[PATH_MAX + 32] = "";
+	char tmp_filename[PATH_MAX + 64] = "";
+	
+	// step 1. body
+	http_cache_get_filename(cache, url, "body", filename, sizeof(filename));
+	FILE * fp = http_cache_create_tmp_file(filename, tmp_filename, sizeof(tmp_filename));
+	if(NULL == fp) return -1;
+	size_t cb = cb_body?fwrite(body, 1, cb_body, fp):0;
+	fclose(fp);
+	if(cb != cb_body || rename(tmp_filename, filename)) {
+		unlink(tmp_filename);
+		return -1;
+	}
+	
+	// step 2. meta
+	http_cache_get_filename(cache, url, "meta", filename, sizeof(filename));
+	fp = http_cache_create_tmp_file(filename, tmp_filename, sizeof(tmp_filename));
+	if(NULL == fp) return -1;
+	fprintf(fp, "%s\n%s\n%s\n%lld\n", url, etag?etag:"", last_modified?last_modified:"", (long long)cb_body);
+	fclose(fp);
+	if(rename(tmp_filename, filename)) {
+		unlink(tmp_filename);
+		return -1;
+	}
+	++cache->stores;
+	return 0;
+}
+
+static int http_cache_serve_body(struct net_utils_http_cache * cache, const char * url, const struct http_cache_meta * meta, auto_buffer_t * in_buf)
+{
+	char filename[PATH_MAX + 32] = "";
+	http_cache_get_filename(cache, url, "body", filename, sizeof(filename));
+	
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) return -1;
+	
+	int rc = -1;
+	struct stat st[1];
+	memset(st, 0, sizeof(st));
+	if(fstat(fd, st) || st->st_size != meta->length) goto label_final;
+	if(st->st_size == 0) { rc = 0; goto label_final; }
+	
+	// read() straight into in_buf, the consumers expect the body there
+	if(auto_buffer_reserve(in_buf, st->st_size)) goto label_final;
+	unsigned char * body = in_buf->data + in_buf->start_pos + in_buf->length;
+	size_t length = 0;
+	while(length < st->st_size) {
+		ssize_t cb = read(fd, body + length, st->st_size - length);
+		if(cb < 0 && errno == EINTR) continue;
+		if(cb <= 0) break;
+		length += cb;
+	}
+	if(length == st->st_size) {
+		in_buf->length += length;
+		rc = 0;
+	}
+	
+label_final:
+	close(fd);
+	return rc;
+}
+
+static struct curl_slist * http_cache_add_conditional_headers(struct curl_slist * headers_list, const struct http_cache_meta * meta)
+{
+	char line[PATH_MAX] = "";
+	if(meta->etag[0]) {
+		snprintf(line, sizeof(line), "If-None-Match: %s", meta->etag);
+		headers_list = curl_slist_append(headers_list, line);
+	}
+	if(meta->last_modified[0]) {
+		snprintf(line, sizeof(line), "If-Modified-Since: %s", meta->last_modified);
+		headers_list = curl_slist_append(headers_list, line);
+	}
+	return headers_list;
+}
+
+/*
+ * http_cache_update()
+ * @return -1 if a '304 Not Modified' could not be served from the cache (the entry is removed),
+ *     the request should be sent again without the conditional headers
+ */
+static int http_cache_update(struct net_utils_http_cache * cache, struct net_utils_http_client * client, const struct http_cache_meta * meta)
+{
+	if(client->response_code == 304 && meta) {
+		int rc = http_cache_serve_body(cache, client->url, meta, client->in_buf);
+		if(0 == rc) {
+			++cache->hits;
+			cache->bytes_saved += meta->length;
+			client->cache_hit = 1;
+			client->response_code = 200;
+			return 0;
+		}
+		http_cache_invalidate(cache, client->url);
+		return -1;
+	}
+	
+	++cache->misses;
+	if(client->response_code != 200) return 0;
+	
+	auto_buffer_t * in_buf = client->in_buf;
+	cache->bytes_downloaded += in_buf->length;
+	
+	struct net_utils_http_headers * hdrs = client->response_headers;
+	const char * etag = hdrs->get(hdrs, "ETag");
+	const char * last_modified = hdrs->get(hdrs, "Last-Modified");
+	if(NULL == etag && NULL == last_modified) return 0;	// not cacheable
+	
+	http_cache_store(cache, client->url, etag, last_modified, in_buf->data + in_buf->start_pos, in_buf->length);
+	return 0;
+}
+
+struct net_utils_http_cache * net_utils_http_cache_init(struct net_utils_http_cache * cache, const char * cache_dir)
+{
+	assert(cache_dir && cache_dir[0]);
+	if(NULL == cache) cache = calloc(1, sizeof(*cache));
+	else memset(cache, 0, sizeof(*cache));
+	assert(cache);
+	
+	int rc = mkdir(cache_dir, 0755);
+	if(rc && errno != EEXIST) {
+		perror("net_utils_http_cache_init()::mkdir()");
+		return NULL;
+	}
+	strncpy(cache->cache_dir, cache_dir, sizeof(cache->cache_dir) - 1);
+	return cache;
+}
+
+void net_utils_http_cache_cleanup(struct net_utils_http_cache * cache)
+{
+	return;
+}
+
+
 static int set_url(struct net_utils_http_client * client, const char * url)
 {
 	assert(client && client->curl);
@@ -121,13 +372,216 @@ static int set_option(struct net_utils_http_client * client, CURLoption option,
 	return ret;
 }
 
-static int send_request(struct net_utils_http_client * client, const char * method, const void * payload, size_t cb_payload)
+/******************************************************
+ * net_utils_http_pool
+ *****************************************************/
+#define HTTP_POOL_DEFAULT_MAX_IDLE (16)
+#define HTTP_POOL_DEFAULT_MAX_HOST_CONNECTIONS (6)
+#define HTTP_POOL_MAX_HOSTS (64)
+struct http_pool_host
+{
+	char name[256];	// host[:port]
+	int num_active;	// transfers in progress
+};
+
+static void http_pool_lock(CURL * curl, curl_lock_data data, curl_lock_access access, void * user_data)
+{
+	struct net_utils_http_pool * pool = user_data;
+	pthread_mutex_lock(&pool->share_locks[data]);
+}
+
+static void http_pool_unlock(CURL * curl, curl_lock_data data, void * user_data)
+{
+	struct net_utils_http_pool * pool = user_data;
+	pthread_mutex_unlock(&pool->share_locks[data]);
+}
+
+struct net_utils_http_pool * net_utils_http_pool_init(struct net_utils_http_pool * pool, int max_idle, int max_host_connections)
+{
+	if(NULL == pool) pool = calloc(1, sizeof(*pool));
+	else memset(pool, 0, sizeof(*pool));
+	assert(pool);
+	
+	if(max_idle <= 0) max_idle = HTTP_POOL_DEFAULT_MAX_IDLE;
+	if(max_host_connections <= 0) max_host_connections = HTTP_POOL_DEFAULT_MAX_HOST_CONNECTIONS;
+	pool->max_idle = max_idle;
+	pool->max_host_connections = max_host_connections;
+	
+	pool->idle = calloc(max_idle, sizeof(*pool->idle));
+	assert(pool->idle);
+	pool->priv = calloc(HTTP_POOL_MAX_HOSTS, sizeof(struct http_pool_host));
+	assert(pool->priv);
+	
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	for(int i = 0; i < CURL_LOCK_DATA_LAST; ++i) pthread_mutex_init(&pool->share_locks[i], NULL);
+	
+	CURLSH * share = curl_share_init();
+	assert(share);
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, http_pool_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, http_pool_unlock);
+	curl_share_setopt(share, CURLSHOPT_USERDATA, pool);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	
+	// libcurl >= 7.57, older versions keep a connection cache per handle
+	CURLSHcode shret = curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	if(shret != CURLSHE_OK) fprintf(stderr, "[WARNING]: %s(): can't share connections: %s\n", __FUNCTION__, curl_share_strerror(shret));
+	
+	pool->share = share;
+	return pool;
+}
+
+void net_utils_http_pool_cleanup(struct net_utils_http_pool * pool)
+{
+	if(NULL == pool) return;
+	assert(0 == pool->num_borrowed);	// all clients using this pool should be cleaned up first
+	
+	for(int i = 0; i < pool->num_idle; ++i) curl_easy_cleanup(pool->idle[i]);
+	pool->num_idle = 0;
+	free(pool->idle);
+	pool->idle = NULL;
+	
+	if(pool->share) {
+		curl_share_cleanup(pool->share);
+		pool->share = NULL;
+	}
+	free(pool->priv);
+	pool->priv = NULL;
+	
+	for(int i = 0; i < CURL_LOCK_DATA_LAST; ++i) pthread_mutex_destroy(&pool->share_locks[i]);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+void net_utils_http_pool_get_stats(struct net_utils_http_pool * pool, struct net_utils_http_pool_stats * stats)
+{
+	assert(pool && stats);
+	pthread_mutex_lock(&pool->mutex);
+	*stats = *pool->stats;
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static CURL * http_pool_borrow(struct net_utils_http_pool * pool)
+{
+	CURL * curl = NULL;
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->num_idle > 0) {
+		curl = pool->idle[--pool->num_idle];
+		++pool->stats->num_warm;
+	}
+	++pool->stats->num_borrows;
+	++pool->num_borrowed;
+	pthread_mutex_unlock(&pool->mutex);
+	if(curl) return curl;
+	
+	curl = curl_easy_init();
+	assert(curl);
+	CURLcode ret = curl_easy_setopt(curl, CURLOPT_SHARE, pool->share);	// kept by curl_easy_reset()
+	assert(ret == CURLE_OK);
+	return curl;
+}
+
+static void http_pool_give_back(struct net_utils_http_pool * pool, CURL * curl)
+{
+	curl_easy_reset(curl);	// drop the callbacks of the previous owner
+	pthread_mutex_lock(&pool->mutex);
+	--pool->num_borrowed;
+	if(pool->num_idle < pool->max_idle) {
+		pool->idle[pool->num_idle++] = curl;
+		curl = NULL;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	if(curl) curl_easy_cleanup(curl);
+}
+
+/*
+ * http_pool_request_begin()
+ * @param wait: wait for a free slot of the host, otherwise *p_over_limit is set if there is none
+ * @return index of the host in the per-host table, -1 if the table is full
+ */
+static int http_pool_request_begin(struct net_utils_http_pool * pool, const char * url, int wait, int * p_over_limit)
+{
+	char name[256] = "";
+	const char * p = strstr(url, "://");
+	p = p?(p + 3):url;
+	size_t cb = strcspn(p, "/?#");
+	if(cb >= sizeof(name)) cb = sizeof(name) - 1;
+	memcpy(name, p, cb);
+	name[cb] = '\0';
+	
+	struct http_pool_host * hosts = pool->priv;
+	int index = -1;
+	int unused = -1;
+	*p_over_limit = 0;
+	
+	pthread_mutex_lock(&pool->mutex);
+	for(int i = 0; i < HTTP_POOL_MAX_HOSTS; ++i) {
+		if(0 == strcasecmp(hosts[i].name, name)) { index = i; break; }
+		if(unused < 0 && 0 == hosts[i].num_active) unused = i;
+	}
+	if(index < 0 && unused >= 0) {
+		index = unused;
+		strcpy(hosts[index].name, name);
+	}
+	if(index >= 0) {
+		if(wait && hosts[index].num_active >= pool->max_host_connections) {
+			++pool->stats->num_waits;
+			while(hosts[index].num_active >= pool->max_host_connections) pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		if(++hosts[index].num_active > pool->max_host_connections) {
+			*p_over_limit = 1;
+			++pool->stats->num_forbid_reuse;
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return index;
+}
+
+static void http_pool_request_end(struct net_utils_http_pool * pool, int index, CURL * curl, CURLcode ret)
+{
+	long num_connects = 0;
+	if(ret == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+	
+	struct http_pool_host * hosts = pool->priv;
+	pthread_mutex_lock(&pool->mutex);
+	if(index >= 0) {
+		--hosts[index].num_active;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	++pool->stats->num_requests;
+	pool->stats->num_connects += num_connects;
+	if(ret == CURLE_OK && 0 == num_connects) ++pool->stats->num_reused;
+	pthread_mutex_unlock(&pool->mutex);
+}
+#undef HTTP_POOL_DEFAULT_MAX_IDLE
+#undef HTTP_POOL_DEFAULT_MAX_HOST_CONNECTIONS
+#undef HTTP_POOL_MAX_HOSTS
+
+struct http_request_context	// per-request states, valid until finish_request()
+{
+	struct curl_slist * headers_list;
+	int use_cache;
+	int has_meta;
+	struct http_cache_meta meta[1];
+	int host_index;	// pooled clients only, see http_pool_request_begin()
+	int retry;		// the cached body could not be served on '304', send an unconditional GET
+};
+
+/*
+ * prepare_request(): step 0 ~ step 5 of send_request(), 
+ *   setup the curl easy handle, which can then be performed by curl_easy_perform() or a curl_multi handle.
+ * @param blocking: 0 if called from the curl_multi event loop (must not wait for the per-host limit of client->pool)
+ */
+static CURLcode prepare_request(struct net_utils_http_client * client, const char * method, const void * payload, size_t cb_payload, 
+	struct http_request_context * ctx, int blocking)
 {
 	assert(client && client->curl);
-	int rc = -1;
 	CURL * curl = client->curl;
 	CURLcode ret = CURLE_OK;
 	struct curl_slist * headers_list = NULL;
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->host_index = -1;
 	
 	auto_buffer_t * out_buf = client->out_buf;
 	if(NULL == method) method = "GET";
@@ -143,19 +597,33 @@ static int send_request(struct net_utils_http_client * client, const char * meth
 	
 	client->err_code = 0;
 	client->response_code = 0;
+	client->cache_hit = 0;
 	client->in_buf->length = 0;
 	client->in_buf->start_pos = 0;
 	net_utils_http_headers_cleanup(client->response_headers);
+	
+	ctx->use_cache = (client->cache && NULL == client->on_response_data	// the body must be received in in_buf
+		&& 0 == strcasecmp(method, "GET") && 0 == out_buf->length && NULL == payload);
+	ctx->has_meta = ctx->use_cache && (0 == http_cache_load_meta(client->cache, client->url, ctx->meta));
+	if(ctx->has_meta && http_cache_check_body(client->cache, client->url, ctx->meta)) {
+		http_cache_invalidate(client->cache, client->url);
+		ctx->has_meta = 0;
+	}
 
 	// step 1. set url
 	ret = curl_easy_setopt(curl, CURLOPT_URL, client->url);
 	if(ret == CURLE_OK && client->use_ssl) {
 		ret = curl_easy_setopt(curl, CURLOPT_USE_SSL, (long)client->use_ssl);
 	}
+	if(ret == CURLE_OK && client->pool) {	// per-host keep-alive limit
+		int over_limit = 0;
+		ctx->host_index = http_pool_request_begin(client->pool, client->url, blocking, &over_limit);
+		if(over_limit) ret = curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
+	}
 	
 	// step 2. set parse header and respose callbacks
 	if(ret == CURLE_OK) {
-		ret = curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)client->in_buf);
+		ret = curl_easy_setopt(curl, CURLOPT_WRITEDATA, client->on_response_data?client->on_response_data:(void *)client->in_buf);
 		ret = curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, client->on_response);
 	}
 	
@@ -212,24 +680,57 @@ static int send_request(struct net_utils_http_client * client, const char * meth
 		cb = snprintf(line, sizeof(line), "Content-Length: %ld", (long)out_buf->length);
 		headers_list = curl_slist_append(headers_list, line);
 	}
+	if(ctx->has_meta) headers_list = http_cache_add_conditional_headers(headers_list, ctx->meta);
 	if(headers_list) {
 		ret = curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers_list);
 	}
-	if(ret != CURLE_OK) goto label_final;
 	
-	// step 6. send request
-	ret = curl_easy_perform(curl);
+label_final:
+	ctx->headers_list = headers_list;
+	return ret;
+}
+
+/*
+ * finish_request(): 
+ * @param ret	result of prepare_request() and the transfer
+ */
+static int finish_request(struct net_utils_http_client * client, CURLcode ret, struct http_request_context * ctx)
+{
+	int rc = -1;
 	if(ret == CURLE_OK) {
-		ret = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &client->response_code);
+		ret = curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &client->response_code);
 		if(ret == CURLE_OK) rc = 0;
 	}
+	if(0 == rc && ctx->use_cache) {
+		ctx->retry = (0 != http_cache_update(client->cache, client, ctx->has_meta?ctx->meta:NULL));
+	}
+	if(client->pool) http_pool_request_end(client->pool, ctx->host_index, client->curl, ret);
+	
+	if(ctx->headers_list) curl_slist_free_all(ctx->headers_list);
+	ctx->headers_list = NULL;
 	
-label_final:
-	if(headers_list) curl_slist_free_all(headers_list);
 	client->err_code = ret;
 	client->last_error = curl_easy_strerror(ret);
 	return rc;
 }
+
+static int send_request(struct net_utils_http_client * client, const char * method, const void * payload, size_t cb_payload)
+{
+	assert(client && client->curl);
+	struct http_request_context ctx[1];
+	
+	CURLcode ret = prepare_request(client, method, payload, cb_payload, ctx, 1);
+	
+	// step 6. send request
+	if(ret == CURLE_OK) ret = curl_easy_perform(client->curl);
+	int rc = finish_request(client, ret, ctx);
+	if(ctx->retry) {	// the cache entry has been removed, has_meta will be 0
+		ret = prepare_request(client, method, payload, cb_payload, ctx, 1);
+		if(ret == CURLE_OK) ret = curl_easy_perform(client->curl);
+		rc = finish_request(client, ret, ctx);
+	}
+	return rc;
+}
 static void reset(struct net_utils_http_client * client)
 {
 	if(NULL == client) return;
@@ -258,6 +759,7 @@ static void reset(struct net_utils_http_client * client)
 }
 
 // custom callbacks
+#define HTTP_RESPONSE_MAX_RESERVE (64LL << 20)
 static size_t on_parse_header(char * ptr, size_t size, size_t n, void * user_data)
 {
 	assert(user_data);
@@ -293,10 +795,32 @@ static size_t on_parse_header(char * ptr, size_t size, size_t n, void * user_dat
 	
 	
 	int rc = hdrs->add_line(hdrs, ptr, cb);
-	if(0 == rc) return cb;
-	return 0;
+	if(rc) return 0;
+	
+	// receive the body into in_buf without reallocations
+	// Content-Length is untrusted: only a hint, capped, and only for a final response which has a body
+	static const char content_length[] = "Content-Length:";
+	if(NULL == client->on_response_data && cb > (sizeof(content_length) - 1)
+		&& strncasecmp(ptr, content_length, sizeof(content_length) - 1) == 0)
+	{
+		long response_code = 0;
+		char * method = NULL;
+		curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);	// of the response being parsed
+		curl_easy_getinfo(client->curl, CURLINFO_EFFECTIVE_METHOD, &method);
+		
+		long long length = strtoll(ptr + sizeof(content_length) - 1, NULL, 10);
+		if(length > HTTP_RESPONSE_MAX_RESERVE) length = HTTP_RESPONSE_MAX_RESERVE;
+		if(length > 0 && response_code >= 200 && response_code < 300 && response_code != 204
+			&& !(method && 0 == strcasecmp(method, "HEAD")))
+		{
+			auto_buffer_reserve(client->in_buf, length);	// on failure, in_buf just grows as data arrives
+		}
+	}
+	return cb;
 }
 
+#undef HTTP_RESPONSE_MAX_RESERVE
+
 static size_t on_response(char * ptr, size_t size, size_t n, void * user_data)
 {
 	assert(user_data);
@@ -325,15 +849,22 @@ static size_t on_post_data(char * ptr, size_t size, size_t n, void * user_data)
 }
 
 struct net_utils_http_client * net_utils_http_client_init(struct net_utils_http_client * client, void * user_data)
+{
+	return net_utils_http_client_init_with_pool(client, NULL, user_data);
+}
+
+struct net_utils_http_client * net_utils_http_client_init_with_pool(struct net_utils_http_client * client, 
+	struct net_utils_http_pool * pool, void * user_data)
 {
 	if(NULL == client) {
 		client = calloc(1, sizeof(*client));
 		assert(client);
 	}
-	CURL * curl = curl_easy_init();
+	CURL * curl = pool?http_pool_borrow(pool):curl_easy_init();
 	assert(curl);
 	
 	client->curl = curl;
+	client->pool = pool;
 	
 	net_utils_http_headers_init(client->request_headers, 0);
 	net_utils_http_headers_init(client->response_headers, 0);
@@ -369,8 +900,623 @@ void net_utils_http_client_cleanup(struct net_utils_http_client * client)
 	}
 	
 	if(client->curl) {
-		curl_easy_cleanup(client->curl);
+		if(client->pool) http_pool_give_back(client->pool, client->curl);
+		else curl_easy_cleanup(client->curl);
 		client->curl = NULL;
 	}
+	client->pool = NULL;
 	return;
 }
+
+
+/******************************************************
+ * net_utils_http_multi
+ *****************************************************/
+#define HTTP_MULTI_DEFAULT_MAX_IN_FLIGHT (16)
+#define HTTP_MULTI_POLL_TIMEOUT_MS (1000)
+struct http_multi_request
+{
+	struct net_utils_http_client * client;
+	char method[32];
+	net_utils_http_multi_callback on_completed;
+	void * user_data;
+	struct http_request_context ctx[1];
+	int slot;	// index of multi->priv (in-flight requests), -1: pending
+};
+
+static void http_multi_complete(struct net_utils_http_multi * multi, struct http_multi_request * req, int rc, long num_connects)
+{
+	struct http_multi_request ** in_flight = multi->priv;
+	if(req->slot >= 0) in_flight[req->slot] = NULL;
+	
+	if(req->on_completed) req->on_completed(req->client, rc, req->user_data);
+	
+	pthread_mutex_lock(&multi->mutex);
+	struct net_utils_http_multi_stats * stats = multi->stats;
+	++stats->num_completed;
+	if(rc) ++stats->num_failed;
+	else if(num_connects == 0) ++stats->num_reused;
+	stats->num_connects += num_connects;
+	
+	--multi->num_in_flight;
+	pthread_cond_broadcast(&multi->done_cond);
+	pthread_mutex_unlock(&multi->mutex);
+	
+	free(req);
+}
+
+static void http_multi_start_request(struct net_utils_http_multi * multi, struct http_multi_request * req)
+{
+	struct net_utils_http_client * client = req->client;
+	struct http_multi_request ** in_flight = multi->priv;
+	for(int i = 0; i < multi->max_in_flight; ++i) {
+		if(NULL == in_flight[i]) {
+			in_flight[i] = req;
+			req->slot = i;
+			break;
+		}
+	}
+	assert(req->slot >= 0);
+	
+	CURLcode ret = prepare_request(client, req->method, NULL, 0, req->ctx, 0);
+	if(ret == CURLE_OK) ret = curl_easy_setopt(client->curl, CURLOPT_PRIVATE, req);
+	if(ret == CURLE_OK) {
+		CURLMcode mret = curl_multi_add_handle(multi->multi, client->curl);
+		if(mret == CURLM_OK) return;
+		ret = CURLE_FAILED_INIT;
+	}
+	int rc = finish_request(client, ret, req->ctx);
+	http_multi_complete(multi, req, rc, 0);
+}
+
+static void http_multi_read_info(struct net_utils_http_multi * multi)
+{
+	CURLMsg * msg = NULL;
+	int msgs_left = 0;
+	while((msg = curl_multi_info_read(multi->multi, &msgs_left))) {
+		if(msg->msg != CURLMSG_DONE) continue;
+		
+		CURL * curl = msg->easy_handle;
+		CURLcode ret = msg->data.result;
+		struct http_multi_request * req = NULL;
+		long num_connects = 0;
+		
+		curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+		curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &num_connects);
+		curl_multi_remove_handle(multi->multi, curl);
+		assert(req && req->client->curl == curl);
+		
+		int rc = finish_request(req->client, ret, req->ctx);
+		if(req->ctx->retry) {	// send it again as an unconditional GET
+			struct http_multi_request ** in_flight = multi->priv;
+			in_flight[req->slot] = NULL;
+			req->slot = -1;
+			http_multi_start_request(multi, req);
+			continue;
+		}
+		http_multi_complete(multi, req, rc, num_connects);
+	}
+}
+
+static void * http_multi_thread(void * user_data)
+{
+	struct net_utils_http_multi * multi = user_data;
+	assert(multi);
+	
+	int running = 0;
+	pthread_mutex_lock(&multi->mutex);
+	while(!multi->quit) {
+		// step 1. start pending requests (up to max_in_flight)
+		struct http_multi_request * req = NULL;
+		while(multi->num_in_flight < multi->max_in_flight && (req = multi->pending->pop(multi->pending))) {
+			++multi->num_in_flight;
+			if(multi->num_in_flight > multi->stats->max_in_flight) multi->stats->max_in_flight = multi->num_in_flight;
+			
+			pthread_mutex_unlock(&multi->mutex);
+			http_multi_start_request(multi, req);
+			pthread_mutex_lock(&multi->mutex);
+		}
+		if(0 == multi->num_in_flight) {
+			pthread_cond_wait(&multi->cond, &multi->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&multi->mutex);
+		
+		// step 2. drive transfers
+		CURLMcode mret = curl_multi_perform(multi->multi, &running);
+		if(mret != CURLM_OK) fprintf(stderr, "[ERROR]: curl_multi_perform(): %s\n", curl_multi_strerror(mret));
+		http_multi_read_info(multi);
+		
+		// step 3. wait for network events, or new requests (curl_multi_wakeup)
+		if(running > 0) curl_multi_poll(multi->multi, NULL, 0, HTTP_MULTI_POLL_TIMEOUT_MS, NULL);
+		pthread_mutex_lock(&multi->mutex);
+	}
+	pthread_mutex_unlock(&multi->mutex);
+	pthread_exit((void *)(long)0);
+}
+
+static int http_multi_add_request(struct net_utils_http_multi * multi, struct net_utils_http_client * client, 
+	const char * method, const void * payload, size_t cb_payload,
+	net_utils_http_multi_callback on_completed, void * user_data)
+{
+	assert(multi && client && client->curl);
+	if(NULL == method) method = "GET";
+	if(strlen(method) >= sizeof(((struct http_multi_request *)NULL)->method)) return -1;
+	
+	struct http_multi_request * req = calloc(1, sizeof(*req));
+	assert(req);
+	req->client = client;
+	strcpy(req->method, method);
+	req->on_completed = on_completed;
+	req->user_data = user_data;
+	req->slot = -1;
+	
+	if(payload && cb_payload) auto_buffer_push(client->out_buf, payload, cb_payload);
+	
+	pthread_mutex_lock(&multi->mutex);
+	if(multi->quit) {
+		pthread_mutex_unlock(&multi->mutex);
+		free(req);
+		return -1;
+	}
+	multi->pending->push(multi->pending, req);
+	++multi->stats->num_requests;
+	pthread_cond_signal(&multi->cond);
+	pthread_mutex_unlock(&multi->mutex);
+	
+	curl_multi_wakeup(multi->multi);
+	return 0;
+}
+
+static int http_multi_wait_all(struct net_utils_http_multi * multi)
+{
+	assert(multi);
+	pthread_mutex_lock(&multi->mutex);
+	while(multi->pending->count > 0 || multi->num_in_flight > 0) {
+		pthread_cond_wait(&multi->done_cond, &multi->mutex);
+	}
+	pthread_mutex_unlock(&multi->mutex);
+	return 0;
+}
+
+static void http_multi_get_stats(struct net_utils_http_multi * multi, struct net_utils_http_multi_stats * stats)
+{
+	assert(multi && stats);
+	pthread_mutex_lock(&multi->mutex);
+	*stats = *multi->stats;
+	pthread_mutex_unlock(&multi->mutex);
+}
+
+struct net_utils_http_multi * net_utils_http_multi_init(struct net_utils_http_multi * multi, int max_in_flight, void * user_data)
+{
+	if(max_in_flight <= 0) max_in_flight = HTTP_MULTI_DEFAULT_MAX_IN_FLIGHT;
+	if(NULL == multi) multi = calloc(1, sizeof(*multi));
+	else memset(multi, 0, sizeof(*multi));
+	assert(multi);
+	
+	multi->multi = curl_multi_init();
+	assert(multi->multi);
+	
+	struct http_multi_request ** in_flight = calloc(max_in_flight, sizeof(*in_flight));
+	assert(in_flight);
+	multi->priv = in_flight;
+	
+	multi->user_data = user_data;
+	multi->max_in_flight = max_in_flight;
+	
+	multi->add_request = http_multi_add_request;
+	multi->wait_all = http_multi_wait_all;
+	multi->get_stats = http_multi_get_stats;
+	
+	clib_queue_init(multi->pending);
+	pthread_mutex_init(&multi->mutex, NULL);
+	pthread_cond_init(&multi->cond, NULL);
+	pthread_cond_init(&multi->done_cond, NULL);
+	
+	int rc = pthread_create(&multi->th, NULL, http_multi_thread, multi);
+	assert(0 == rc);
+	return multi;
+}
+
+void net_utils_http_multi_cleanup(struct net_utils_http_multi * multi)
+{
+	if(NULL == multi || NULL == multi->multi) return;
+	
+	pthread_mutex_lock(&multi->mutex);
+	multi->quit = 1;
+	pthread_cond_broadcast(&multi->cond);
+	pthread_mutex_unlock(&multi->mutex);
+	curl_multi_wakeup(multi->multi);
+	
+	void * exit_code = NULL;
+	pthread_join(multi->th, &exit_code);
+	
+	// abort all in-flight and pending requests
+	struct http_multi_request ** in_flight = multi->priv;
+	for(int i = 0; i < multi->max_in_flight; ++i) {
+		struct http_multi_request * req = in_flight[i];
+		if(NULL == req) continue;
+		curl_multi_remove_handle(multi->multi, req->client->curl);
+		http_multi_complete(multi, req, finish_request(req->client, CURLE_ABORTED_BY_CALLBACK, req->ctx), 0);
+	}
+	free(in_flight);
+	multi->priv = NULL;
+	
+	struct http_multi_request * req = NULL;
+	while((req = multi->pending->pop(multi->pending))) {
+		++multi->num_in_flight;
+		http_multi_complete(multi, req, -1, 0);
+	}
+	clib_queue_cleanup(multi->pending);
+	
+	curl_multi_cleanup(multi->multi);
+	multi->multi = NULL;
+	
+	pthread_cond_destroy(&multi->cond);
+	pthread_cond_destroy(&multi->done_cond);
+	pthread_mutex_destroy(&multi->mutex);
+	return;
+}
+#undef HTTP_MULTI_DEFAULT_MAX_IN_FLIGHT
+#undef HTTP_MULTI_POLL_TIMEOUT_MS
+
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_NET_UTILS) && defined(_STAND_ALONE)
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * a local stand-in http server (keep-alive, one process per connection): 
+ *   serves a fixed body with an ETag, and replies '304 Not Modified' if the ETag matches If-None-Match
+ */
+#define TEST_BODY_SIZE (64 * 1024)
+static const char * s_etag = "\"v1-test-etag\"";
+
+static void stand_in_server_serve_connection(int fd)
+{
+	static char body[TEST_BODY_SIZE];
+	memset(body, 'a', sizeof(body));
+	
+	char request[8192] = "";
+	ssize_t length = 0;
+	while(1) {
+		char * p_end = strstr(request, "\r\n\r\n");
+		if(NULL == p_end) {
+			if(length >= (sizeof(request) - 1)) break;
+			ssize_t cb = read(fd, request + length, sizeof(request) - 1 - length);
+			if(cb <= 0) break;
+			length += cb;
+			request[length] = '\0';
+			continue;
+		}
+		*p_end = '\0';
+		
+		char header[1024] = "";
+		int not_modified = (NULL != strcasestr(request, s_etag));
+		int cb_header = snprintf(header, sizeof(header), 
+			"HTTP/1.1 %s\r\n"
+			"ETag: %s\r\n"
+			"Last-Modified: Wed, 21 Oct 2015 07:28:00 GMT\r\n"
+			"Content-Length: %d\r\n"
+			"\r\n",
+			not_modified?"304 Not Modified":"200 OK", 
+			s_etag,
+			not_modified?0:(int)sizeof(body));
+		ssize_t cb = write(fd, header, cb_header);
+		int is_head = (0 == strncmp(request, "HEAD ", 5));
+		if(!not_modified && !is_head && cb > 0) cb = write(fd, body, sizeof(body));
+		if(cb <= 0) break;
+		
+		// keep the remaining data (if any) for the next request
+		p_end += 4;
+		length -= (p_end - request);
+		memmove(request, p_end, length);
+		request[length] = '\0';
+	}
+	close(fd);
+}
+
+static pid_t stand_in_server_start(int * p_port)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	assert(sock >= 0);
+	
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0, };
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t cb_addr = sizeof(addr);
+	int rc = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+	assert(0 == rc);
+	rc = listen(sock, 128);
+	assert(0 == rc);
+	rc = getsockname(sock, (struct sockaddr *)&addr, &cb_addr);
+	assert(0 == rc);
+	*p_port = ntohs(addr.sin_port);
+	
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if(0 == pid) {
+		signal(SIGCHLD, SIG_IGN);
+		while(1) {
+			int fd = accept(sock, NULL, NULL);
+			if(fd < 0) break;
+			if(0 == fork()) {
+				close(sock);
+				stand_in_server_serve_connection(fd);
+				_exit(0);
+			}
+			close(fd);
+		}
+		_exit(0);
+	}
+	close(sock);
+	return pid;
+}
+
+static void stand_in_server_stop(pid_t pid)
+{
+	int status = 0;
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+}
+
+static void remove_cache_files(const char * cache_dir, const char * url)
+{
+	struct net_utils_http_cache cache[1] = {{ .cache_dir = "" }};
+	strncpy(cache->cache_dir, cache_dir, sizeof(cache->cache_dir) - 1);
+	char filename[PATH_MAX + 32] = "";
+	http_cache_get_filename(cache, url, "meta", filename, sizeof(filename));
+	unlink(filename);
+	http_cache_get_filename(cache, url, "body", filename, sizeof(filename));
+	unlink(filename);
+	rmdir(cache_dir);
+}
+
+static int test_http_cache(const char * url);
+static int test_http_multi(const char * url);
+static int test_http_pool(const char * url);
+static int test_content_length_hint(const char * url);
+
+int main(int argc, char ** argv)
+{
+	curl_global_init(CURL_GLOBAL_ALL);
+	
+	int port = 0;
+	pid_t pid = stand_in_server_start(&port);
+	
+	char url[100] = "";
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/test.js", port);
+	
+	int rc = test_http_cache(url);
+	assert(0 == rc);
+	
+	rc = test_http_multi(url);
+	assert(0 == rc);
+	
+	rc = test_http_pool(url);
+	assert(0 == rc);
+	
+	rc = test_content_length_hint(url);
+	assert(0 == rc);
+	
+	stand_in_server_stop(pid);
+	curl_global_cleanup();
+	printf("[OK]\n");
+	return 0;
+}
+
+static int test_http_cache(const char * url)
+{
+	#define NUM_REQUESTS (10)
+	char cache_dir[] = "/tmp/http-cache-test-XXXXXX";
+	char * p_dir = mkdtemp(cache_dir);
+	assert(p_dir);
+	
+	struct net_utils_http_cache cache[1];
+	struct net_utils_http_cache * p_cache = net_utils_http_cache_init(cache, cache_dir);
+	assert(p_cache);
+	
+	struct net_utils_http_client * client = net_utils_http_client_init(NULL, NULL);
+	assert(client);
+	client->cache = cache;
+	
+	for(int i = 0; i < NUM_REQUESTS; ++i) {
+		client->set_url(client, url);
+		int rc = client->send_request(client, "GET", NULL, 0);
+		assert(0 == rc);
+		assert(client->response_code == 200);
+		assert(client->in_buf->length == TEST_BODY_SIZE);
+		assert(client->cache_hit == (i > 0));
+		assert(client->in_buf->data[0] == 'a' && client->in_buf->data[TEST_BODY_SIZE - 1] == 'a');
+	}
+	
+	printf("== %s(): requests: %d, hits: %ld, misses: %ld, hit rate: %.1f%%, bytes saved: %lld, bytes downloaded: %lld\n",
+		__FUNCTION__, NUM_REQUESTS, cache->hits, cache->misses, 
+		100.0 * cache->hits / NUM_REQUESTS, 
+		(long long)cache->bytes_saved, (long long)cache->bytes_downloaded);
+	assert(cache->hits == (NUM_REQUESTS - 1) && cache->misses == 1);
+	assert(cache->bytes_saved == (int64_t)(NUM_REQUESTS - 1) * TEST_BODY_SIZE);
+	
+	// a broken body file must not poison the entry:
+	//   detected before sending the conditional headers -> unconditional GET, the entry is stored again
+	char filename[PATH_MAX + 32] = "";
+	http_cache_get_filename(cache, url, "body", filename, sizeof(filename));
+	for(int i = 0; i < 2; ++i) {
+		int rc = truncate(filename, TEST_BODY_SIZE / 2);
+		assert(0 == rc);
+		client->set_url(client, url);
+		rc = client->send_request(client, "GET", NULL, 0);
+		assert(0 == rc && client->response_code == 200 && !client->cache_hit);
+		assert(client->in_buf->length == TEST_BODY_SIZE);
+	}
+	struct http_cache_meta meta[1];
+	int rc = http_cache_load_meta(cache, url, meta);
+	assert(0 == rc);
+	// removed between that check and the '304': the entry is invalidated, send_request() sends the request again
+	unlink(filename);
+	client->cache = NULL;
+	
+	auto_buffer_t * in_buf = client->in_buf;
+	in_buf->length = 0;
+	client->response_code = 304;
+	assert(-1 == http_cache_update(cache, client, meta));
+	assert(0 != http_cache_load_meta(cache, url, meta));	// invalidated
+	client->cache = cache;
+	
+	client->set_url(client, url);
+	rc = client->send_request(client, "GET", NULL, 0);
+	assert(0 == rc && client->response_code == 200 && client->in_buf->length == TEST_BODY_SIZE);
+	client->set_url(client, url);
+	rc = client->send_request(client, "GET", NULL, 0);
+	assert(0 == rc && client->cache_hit && client->in_buf->length == TEST_BODY_SIZE);
+	
+	net_utils_http_client_cleanup(client);
+	free(client);
+	net_utils_http_cache_cleanup(cache);
+	remove_cache_files(cache_dir, url);
+	#undef NUM_REQUESTS
+	return 0;
+}
+
+static void on_multi_request_completed(struct net_utils_http_client * client, int rc, void * user_data)
+{
+	int * p_num_ok = user_data;
+	if(0 == rc && client->response_code == 200 && client->in_buf->length == TEST_BODY_SIZE) {
+		__atomic_add_fetch(p_num_ok, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static int test_http_multi(const char * url)
+{
+	#define NUM_REQUESTS (64)
+	#define MAX_IN_FLIGHT (8)
+	struct net_utils_http_client clients[NUM_REQUESTS];
+	memset(clients, 0, sizeof(clients));
+	
+	struct net_utils_http_multi multi[1];
+	net_utils_http_multi_init(multi, MAX_IN_FLIGHT, NULL);
+	
+	int num_ok = 0;
+	for(int i = 0; i < NUM_REQUESTS; ++i) {
+		struct net_utils_http_client * client = net_utils_http_client_init(&clients[i], NULL);
+		client->set_url(client, url);
+		int rc = multi->add_request(multi, client, "GET", NULL, 0, on_multi_request_completed, &num_ok);
+		assert(0 == rc);
+	}
+	multi->wait_all(multi);
+	
+	struct net_utils_http_multi_stats stats[1];
+	multi->get_stats(multi, stats);
+	printf("== %s(): requests: %ld, completed: %ld, failed: %ld, ok: %d, connects: %ld, reused: %ld, peak in-flight: %d\n",
+		__FUNCTION__, stats->num_requests, stats->num_completed, stats->num_failed, num_ok,
+		stats->num_connects, stats->num_reused, stats->max_in_flight);
+	assert(num_ok == NUM_REQUESTS);
+	assert(stats->num_completed == NUM_REQUESTS && stats->num_failed == 0);
+	assert(stats->max_in_flight <= MAX_IN_FLIGHT);
+	
+	net_utils_http_multi_cleanup(multi);
+	for(int i = 0; i < NUM_REQUESTS; ++i) net_utils_http_client_cleanup(&clients[i]);
+	#undef NUM_REQUESTS
+	#undef MAX_IN_FLIGHT
+	return 0;
+}
+
+static int test_content_length_hint(const char * url)
+{
+	struct net_utils_http_client * client = net_utils_http_client_init(NULL, NULL);
+	assert(client);
+	
+	// HEAD: no body, nothing reserved
+	client->set_url(client, url);
+	int rc = client->send_request(client, "HEAD", NULL, 0);
+	assert(0 == rc && client->response_code == 200);
+	assert(client->in_buf->length == 0 && client->in_buf->size < TEST_BODY_SIZE);
+	
+	// GET: the whole body fits in the reserved buffer
+	client->set_url(client, url);
+	rc = client->send_request(client, "GET", NULL, 0);
+	assert(0 == rc && client->in_buf->length == TEST_BODY_SIZE);
+	assert(client->in_buf->size == TEST_BODY_SIZE);
+	
+	net_utils_http_client_cleanup(client);
+	free(client);
+	return 0;
+}
+
+/*
+ * one short-lived client per request, like js_loader_load()
+ */
+static long fetch_with_new_client(const char * url, struct net_utils_http_pool * pool)
+{
+	struct net_utils_http_client client[1];
+	memset(client, 0, sizeof(client));
+	net_utils_http_client_init_with_pool(client, pool, NULL);
+	client->set_url(client, url);
+	int rc = client->send_request(client, "GET", NULL, 0);
+	assert(0 == rc && client->response_code == 200 && client->in_buf->length == TEST_BODY_SIZE);
+	
+	long num_connects = 0;
+	curl_easy_getinfo(client->curl, CURLINFO_NUM_CONNECTS, &num_connects);
+	net_utils_http_client_cleanup(client);
+	return num_connects;
+}
+
+struct pool_worker_context
+{
+	const char * url;
+	struct net_utils_http_pool * pool;
+	int num_requests;
+};
+static void * pool_worker_thread(void * user_data)
+{
+	struct pool_worker_context * ctx = user_data;
+	for(int i = 0; i < ctx->num_requests; ++i) fetch_with_new_client(ctx->url, ctx->pool);
+	return NULL;
+}
+
+static int test_http_pool(const char * url)
+{
+	#define NUM_REQUESTS (20)
+	#define NUM_THREADS (4)
+	// without a pool: every client opens its own connection
+	long num_connects = 0;
+	for(int i = 0; i < NUM_REQUESTS; ++i) num_connects += fetch_with_new_client(url, NULL);
+	printf("== %s(): no pool: requests: %d, connects: %ld\n", __FUNCTION__, NUM_REQUESTS, num_connects);
+	assert(num_connects == NUM_REQUESTS);
+	
+	// with a pool: the connection (and the warm handle) outlives the clients
+	struct net_utils_http_pool pool[1];
+	net_utils_http_pool_init(pool, 0, 2);
+	for(int i = 0; i < NUM_REQUESTS; ++i) fetch_with_new_client(url, pool);
+	
+	struct net_utils_http_pool_stats stats[1];
+	net_utils_http_pool_get_stats(pool, stats);
+	printf("== %s(): pool: requests: %ld, connects: %ld, reused: %ld, borrows: %ld (warm: %ld)\n", 
+		__FUNCTION__, stats->num_requests, stats->num_connects, stats->num_reused, stats->num_borrows, stats->num_warm);
+	assert(stats->num_connects == 1 && stats->num_reused == NUM_REQUESTS - 1);
+	assert(stats->num_warm == NUM_REQUESTS - 1);
+	
+	// concurrent clients, at most 2 keep-alive connections to the host
+	pthread_t threads[NUM_THREADS];
+	struct pool_worker_context ctx = { .url = url, .pool = pool, .num_requests = NUM_REQUESTS };
+	for(int i = 0; i < NUM_THREADS; ++i) pthread_create(&threads[i], NULL, pool_worker_thread, &ctx);
+	for(int i = 0; i < NUM_THREADS; ++i) pthread_join(threads[i], NULL);
+	
+	net_utils_http_pool_get_stats(pool, stats);
+	printf("== %s(): %d threads: requests: %ld, connects: %ld, reused: %ld, waits (host limit): %ld\n", 
+		__FUNCTION__, NUM_THREADS, stats->num_requests, stats->num_connects, stats->num_reused, stats->num_waits);
+	assert(stats->num_requests == (NUM_THREADS + 1) * NUM_REQUESTS);
+	assert(stats->num_connects <= 2 && stats->num_forbid_reuse == 0);
+	assert(pool->num_borrowed == 0);
+	
+	net_utils_http_pool_cleanup(pool);
+	#undef NUM_REQUESTS
+	#undef NUM_THREADS
+	return 0;
+}
+#endif
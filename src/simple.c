@@ -35,8 +35,14 @@
 
 #include <webkit2/webkit2.h>
 #include "utils.h"
+#include "app_timer.h"
 #include "js-utils.h"
 #include "net-utils.h"
+#include "js-context-pool.h"
+#include "js-loader.h"
+#include "w3c-dom.h"
+#include "js-dom.h"
+#include <libxml/HTMLparser.h>
 
 typedef int (* js_utils_exception_callback)(JSCContext *, JSCException * exception, int exit_app, JSCValue * ret_val);
 static int js_utils_check_result(JSCContext * js, JSCValue * ret_val, int exit_app, js_utils_exception_callback on_exception) 
@@ -55,52 +61,161 @@ static int js_utils_check_result(JSCContext * js, JSCValue * ret_val, int exit_a
 	return 0;
 }
 
-#define AUTO_CLEANUP_(struct_name) __attribute__((cleanup(struct_name##_cleanup))) struct struct_name
-ssize_t load_js_code_from_uri(const char * uri, char ** p_js_code)
+/*
+ * usage: simple --pool <num_workers> [-l <library_uri>]... <script_uri>...
+ * run scripts on a pool of pre-warmed JSCContexts, without GTK/WebView
+ */
+static int run_pooled_scripts(int argc, char ** argv)
 {
-	char * js_code = NULL;
-	ssize_t cb_code = 0;
+	int num_workers = 0;
+	if(argc > 2) num_workers = atoi(argv[2]);
 	
-	assert(uri);
-	int rc = 0;
-	int is_http = 0;
-	int is_https = 0;
+	int num_libraries = 0;
+	struct js_source * libraries = calloc(argc, sizeof(*libraries));
+	GBytes ** library_bytes = calloc(argc, sizeof(*library_bytes));
+	assert(libraries && library_bytes);
 	
-	is_http = (0 == strncasecmp(uri, "http://", sizeof("http://" - 1)));
-	if(!is_http) is_https = (0 == strncasecmp(uri, "https://", sizeof("https://" - 1)));
+	int num_scripts = 0;
+	const char ** scripts = calloc(argc, sizeof(*scripts));
+	assert(scripts);
 	
-	if(is_http || is_https) {
-		AUTO_CLEANUP_(net_utils_http_client) http_client;
-		memset(&http_client, 0, sizeof(http_client));
-		
-		struct net_utils_http_client * client = net_utils_http_client_init(&http_client, NULL);
-		assert(client);
-		
-		rc = client->set_url(client, uri);
-		if(rc) return -1;
+	for(int i = 3; i < argc; ++i) {
+		if(0 == strcmp(argv[i], "-l") && (i + 1) < argc) {
+			struct js_source * lib = &libraries[num_libraries];
+			lib->uri = argv[++i];
+			GBytes * bytes = js_loader_load(lib->uri, NULL);
+			if(NULL == bytes) {
+				fprintf(stderr, "[ERROR]: load library '%s' failed\n", lib->uri);
+				continue;
+			}
+			gsize cb_code = 0;
+			lib->code = g_bytes_get_data(bytes, &cb_code);
+			lib->cb_code = cb_code;
+			library_bytes[num_libraries++] = bytes;
+			continue;
+		}
+		scripts[num_scripts++] = argv[i];
+	}
+	
+	app_timer_t timer[1];
+	app_timer_start(timer);
+	struct js_context_pool * pool = js_context_pool_init(NULL, num_workers, libraries, num_libraries, NULL);
+	assert(pool);
+	fprintf(stderr, "pool started: workers=%d, libraries=%d, time=%.3f ms\n", 
+		pool->num_workers, num_libraries, app_timer_get_elapsed(timer) * 1000.0);
+	
+	for(int i = 0; i < num_libraries; ++i) g_bytes_unref(library_bytes[i]);
+	free(library_bytes);
+	free(libraries);
+	
+	struct js_job ** jobs = calloc(num_scripts + 1, sizeof(*jobs));
+	assert(jobs);
+	for(int i = 0; i < num_scripts; ++i) {
+		GBytes * bytes = js_loader_load(scripts[i], NULL);
+		if(NULL == bytes) {
+			fprintf(stderr, "[ERROR]: load script '%s' failed\n", scripts[i]);
+			continue;
+		}
+		gsize cb_code = 0;
+		const char * js_code = g_bytes_get_data(bytes, &cb_code);
+		jobs[i] = pool->submit(pool, js_code, cb_code, scripts[i], NULL, NULL);
+		g_bytes_unref(bytes);
+	}
+	
+	int rc = 0;
+	for(int i = 0; i < num_scripts; ++i) {
+		struct js_job * job = jobs[i];
+		if(NULL == job) { rc = 1; continue; }
 		
-		client->use_ssl = is_https;
-		client->verify_host = is_https;
-		rc = client->send_request(client, "GET", NULL, 0);
-		if(rc) {
-			fprintf(stderr, "[ERROR]: %s\n", client->last_error);
+		pool->wait(pool, job);
+		if(job->err_code) {
+			fprintf(stderr, "[%s]: worker=%d, Exception: %s\n", job->uri, job->worker_id, job->exception);
+			rc = 1;
+		}else {
+			printf("[%s]: worker=%d, time=%.3f ms, result=%s\n", 
+				job->uri, job->worker_id, job->time_cost * 1000.0, job->result?job->result:"undefined");
 		}
+		js_job_free(job);
+	}
+	free(jobs);
+	free(scripts);
+	
+	js_context_pool_dump_stats(pool, stderr);
+	js_context_pool_cleanup(pool);
+	free(pool);
+	return rc;
+}
+
+/*
+ * usage: simple [--html <html_uri>] [script_uri]...
+ * expose the (server-side parsed) html document as 'document' and run scripts against it.
+ * js must be a standalone context (jsc_context_new()): the 'document' of a WebView page is unforgeable
+ * and lives in the web process. bin/headless is the full runtime (console, timers, window).
+ */
+static int run_document_scripts(JSCContext * js, const char * html_uri, const char ** scripts, int num_scripts)
+{
+	int rc = 0;
+	if(!JSC_IS_CONTEXT(js)) {
+		fprintf(stderr, "[ERROR]: %s(): invalid JSCContext\n", __FUNCTION__);
+		return -1;
+	}
+	const char * html = "<html><head></head><body></body></html>";
+	gsize cb_html = strlen(html);
+	GBytes * html_bytes = NULL;
+	if(html_uri) {
+		html_bytes = js_loader_load(html_uri, NULL);
+		if(NULL == html_bytes) {
+			fprintf(stderr, "[ERROR]: load html '%s' failed\n", html_uri);
+			return -1;
+		}
+		html = g_bytes_get_data(html_bytes, &cb_html);
+	}
+	
+	xmlDoc * doc = htmlReadMemory(html, cb_html, html_uri, NULL, 
+		HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING | HTML_PARSE_NONET);
+	if(html_bytes) g_bytes_unref(html_bytes);
+	if(NULL == doc) return -1;
+	
+	struct w3c_dom dom[1];
+	w3c_dom_init(dom, doc, xmlDocGetRootElement(doc), NULL);
+	
+	struct js_dom jdom[1];
+	memset(jdom, 0, sizeof(jdom));
+	js_dom_init(jdom, js, dom, NULL);
+	JSCValue * global = jsc_context_get_global_object(js);
+	jsc_value_object_set_property(global, "document", jdom->document);
+	
+	for(int i = 0; i < num_scripts; ++i) {
+		GBytes * bytes = js_loader_load(scripts[i], NULL);
+		if(NULL == bytes) {
+			fprintf(stderr, "[ERROR]: load script '%s' failed\n", scripts[i]);
+			rc = -1;
+			continue;
+		}
+		gsize cb_code = 0;
+		const char * js_code = g_bytes_get_data(bytes, &cb_code);
 		
-		auto_buffer_t * in_buf = client->in_buf;
-		cb_code = in_buf->length;
-		if(cb_code > 0) {
-			js_code = calloc(cb_code + 1, 1);
-			assert(js_code);
-			memcpy(js_code, in_buf->data + in_buf->start_pos, in_buf->length);
-			js_code[cb_code] = '\0';
+		char * result = NULL, * exception = NULL;
+		JSCValue * ret_val = jsc_context_evaluate_with_source_uri(js, js_code, cb_code, scripts[i], 1);
+		if(js_utils_take_result(js, ret_val, &result, &exception)) {
+			fprintf(stderr, "[ERROR]: %s: %s\n", scripts[i], exception);
+			rc = -1;
+		}else {
+			printf("%s: %s\n", scripts[i], result?result:"undefined");
 		}
-		*p_js_code = js_code;
-		return cb_code;
+		free(result);
+		free(exception);
+		g_bytes_unref(bytes);
 	}
 	
-	cb_code =  utils_load_file(NULL, uri, (unsigned char **)&js_code, NULL);
-	*p_js_code = js_code;
-	return cb_code;
+	JSCValue * undefined = jsc_value_new_undefined(js);
+	jsc_value_object_set_property(global, "document", undefined);
+	g_object_unref(undefined);
+	g_object_unref(global);
+	js_dom_cleanup(jdom);
+	w3c_dom_cleanup(dom);
+	xmlFreeDoc(doc);
+	return rc;
 }
 
 int main(int argc, char **argv)
@@ -108,45 +223,75 @@ int main(int argc, char **argv)
 	int rc = 0;
 	curl_global_init(CURL_GLOBAL_ALL);
 	
+	js_loader_init();
+	
+	if(argc > 1 && 0 == strcmp(argv[1], "--pool")) {
+		rc = run_pooled_scripts(argc, argv);
+		goto label_final;
+	}
+	
+	const char * html_uri = NULL;
+	const char ** scripts = (const char **)&argv[1];
+	int num_scripts = argc - 1;
+	if(argc > 2 && 0 == strcmp(argv[1], "--html")) {
+		html_uri = argv[2];
+		scripts += 2;
+		num_scripts -= 2;
+	}
+	
+	app_timer_t timer[1];
+	app_timer_start(timer);
 	gtk_init(&argc, &argv);
 	GtkWidget * webview = webkit_web_view_new();
+	fprintf(stderr, "[INFO]: startup (gtk + webview): %.3f ms\n", app_timer_stop(timer) * 1000.0);
 	
 	
-	JSCContext * js = jsc_value_get_context(JSC_VALUE(webview));
+	// a WebKitWebView is not a JSCValue, and its page scripts run in the web process:
+	// the scripts are evaluated in a standalone context of the UI process.
+	JSCContext * js = jsc_context_new();
+	assert(js);
 	
 	//~ const char * jquery_uri = "https://code.jquery.com/jquery-3.6.0.js";
 	const char * jquery_uri = "jslib/jquery-3.6.0.js";
 	const char * bootstrap_js_min_uri = "https://maxcdn.bootstrapcdn.com/bootstrap/3.3.7/js/bootstrap.min.js";
-	char * js_code = NULL;
-	ssize_t cb_code = 0;
+	GBytes * bytes = NULL;
+	const char * js_code = NULL;
+	gsize cb_code = 0;
 	
 	//~ JSCVirtualMachine * jsvm = jsc_virtual_machine_new();
 	//~ JSCContext * js = jsc_context_new_with_virtual_machine(jsvm);
 	JSCValue * ret_val = NULL;
 	
-	struct XMLDomClass {
-		void * root;
-	} document_object;
-	JSCClass * dom_class = jsc_context_register_class(js, "XMLDomClass", NULL, NULL, NULL);
-	JSCValue * document = jsc_value_new_object(js, &document_object, dom_class);
-	rc = js_utils_check_result(js, document, 0, NULL);
-	
-	
-	cb_code = load_js_code_from_uri(jquery_uri, &js_code);
-	assert(js_code && cb_code > 0);
+	bytes = js_loader_load(jquery_uri, NULL);
+	assert(bytes);
+	js_code = g_bytes_get_data(bytes, &cb_code);
 	ret_val = jsc_context_evaluate_with_source_uri(js, js_code, cb_code, jquery_uri, 1);
 	rc = js_utils_check_result(js, ret_val, 0, NULL);
 	assert(0 == rc);
 	
-	free(js_code); js_code = NULL;
-	cb_code = load_js_code_from_uri(bootstrap_js_min_uri, &js_code);
-	assert(js_code && cb_code > 0);
+	g_bytes_unref(bytes); bytes = NULL;
+	uint32_t cache_flags = 0;
+	bytes = js_loader_load(bootstrap_js_min_uri, &cache_flags);
+	assert(bytes);
+	js_code = g_bytes_get_data(bytes, &cb_code);
+	rc = js_loader_check_syntax(js, bootstrap_js_min_uri, js_code, cb_code, cache_flags);
+	assert(0 == rc);
 	
 	ret_val = jsc_context_evaluate_with_source_uri(js, js_code, cb_code, bootstrap_js_min_uri, 1);
 	rc = js_utils_check_result(js, ret_val, 0, NULL);
 	assert(0 == rc);
+	g_bytes_unref(bytes); bytes = NULL;
+	
+	// bind the server-side document after the libraries have been initialized, 
+	// it only supports the query APIs, not the full DOM that jQuery probes at load time.
+	rc = run_document_scripts(js, html_uri, scripts, num_scripts);
 	
+	g_object_unref(js);
+	g_object_unref(g_object_ref_sink(webview));
+	
+label_final:
+	js_loader_cleanup(stderr);
 	curl_global_cleanup();
-	return 0;
+	return rc;
 }
 
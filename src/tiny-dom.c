@@ -35,44 +35,9 @@
 #include "net-utils.h"
 #include <libxml/tree.h>
 #include <libxml/parser.h>
+#include <libxml/HTMLparser.h>
 
-#include "avl_tree.h"
-
-struct w3c_dom
-{
-	xmlDoc * doc;
-	xmlNode * root;
-	
-	void * priv;
-	void * user_data;
-	avl_tree_t elements[1];
-	
-	xmlNode * (*getElementByTagName)(struct w3c_dom * document, const char * tagName);
-};
-struct w3c_dom * w3c_dom_init(struct w3c_dom * dom, xmlDoc * doc, xmlNode * root, void * user_data);
-void w3c_dom_cleanup(struct w3c_dom * dom);
-
-static int node_name_compare(const void * _a, const void * _b) 
-{
-	const xmlNode * a = _a;
-	const xmlNode * b = _b;
-	
-	assert(a->type == XML_ELEMENT_NODE);
-	assert(b->type == XML_ELEMENT_NODE);
-	assert(a->name && b->name);
-	return strcasecmp((char *)a->name, (char *)b->name);
-}
-
-xmlNode * w3c_dom_get_element_by_tag_name(struct w3c_dom * document, const char * tagName)
-{
-	xmlNode pattern[1] = {{
-		.type = XML_ELEMENT_NODE,
-		.name = (void *)tagName,
-	}};
-	xmlNode ** p_node = avl_tree_find(document->elements, pattern, node_name_compare);
-	if(p_node) return *p_node;
-	return NULL;
-}
+#include "w3c-dom.h"
 
 
 void dump_nodes(xmlNode * node, int recursive);
@@ -109,29 +74,107 @@ void dump_nodes(xmlNode * node, int recursive)
 	return;
 }
 
-int main(int argc, char **argv)
+/*
+ * streaming mode: 
+ *   feed each chunk received by on_response() into a libxml2 push parser,
+ *   the DOM is built while the bytes arrive, and the response body is never buffered.
+ */
+struct html_stream_parser
 {
-	const char * url = "http://localhost/libxml2/index.html";
-	if(argc > 1) url = argv[1];
+	htmlParserCtxtPtr ctxt;
+	size_t bytes_received;
+	int err_code;
+};
+
+static size_t on_html_stream_response(char * ptr, size_t size, size_t n, void * user_data)
+{
+	struct html_stream_parser * parser = user_data;
+	assert(parser && parser->ctxt);
 	
-	struct net_utils_http_client * http = net_utils_http_client_init(NULL, NULL);
-	assert(http);
+	size_t cb = size * n;
+	if(cb == 0) return 0;
+	
+	parser->bytes_received += cb;
+	int rc = htmlParseChunk(parser->ctxt, ptr, cb, 0);
+	if(rc) parser->err_code = rc;	// recoverable errors only, keep parsing
+	return cb;
+}
+
+static xmlDoc * load_html_stream(struct net_utils_http_client * http, const char * url, size_t * p_length)
+{
+	struct html_stream_parser parser[1];
+	memset(parser, 0, sizeof(parser));
+	
+	parser->ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, url, XML_CHAR_ENCODING_NONE);
+	assert(parser->ctxt);
+	htmlCtxtUseOptions(parser->ctxt, HTML_PARSE_RECOVER | HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING);
 	
+	// the client is shared with load_html_buffered(), restore its callback afterwards
+	size_t (* saved_on_response)(char *, size_t, size_t, void *) = http->on_response;
+	void * saved_on_response_data = http->on_response_data;
+	http->on_response = on_html_stream_response;
+	http->on_response_data = parser;
+	
+	int rc = http->set_url(http, url);
+	rc = http->send_request(http, "GET", NULL, 0);
+	
+	http->on_response = saved_on_response;
+	http->on_response_data = saved_on_response_data;
+	htmlParseChunk(parser->ctxt, NULL, 0, 1);	// terminate
+	
+	xmlDoc * doc = parser->ctxt->myDoc;
+	parser->ctxt->myDoc = NULL;
+	htmlFreeParserCtxt(parser->ctxt);
+	
+	if(rc || parser->bytes_received == 0) {
+		if(doc) xmlFreeDoc(doc);
+		return NULL;
+	}
+	if(p_length) *p_length = parser->bytes_received;
+	return doc;
+}
+
+static xmlDoc * load_html_buffered(struct net_utils_http_client * http, const char * url, size_t * p_length)
+{
 	int rc = 0;
 	rc = http->set_url(http, url);
 	rc = http->send_request(http, "GET", NULL, 0);
-	assert(0 == rc);
+	if(rc) return NULL;
 	
 	const char * html = (char *)http->in_buf->data;
 	ssize_t cb_html = http->in_buf->length;
-	assert(html && cb_html > 0);
+	if(NULL == html || cb_html <= 0) return NULL;
 	
 	//~ printf("=================\n");
 	//~ printf("%s\n", html);
 	//~ printf("=================\n");
 	
-	xmlDoc * doc = xmlReadMemory(html, cb_html, url, NULL, XML_PARSE_RECOVER);
+	if(p_length) *p_length = cb_html;
+	return xmlReadMemory(html, cb_html, url, NULL, XML_PARSE_RECOVER);
+}
+
+/*
+ * usage: tiny-dom [url] [--buffered] [--threads N]
+ *   --threads: number of threads to build the element index, 0: number of CPUs
+ */
+int main(int argc, char **argv)
+{
+	const char * url = "http://localhost/libxml2/index.html";
+	int buffered = 0;
+	int num_threads = 1;
+	for(int i = 1; i < argc; ++i) {
+		if(0 == strcmp(argv[i], "--buffered")) buffered = 1;
+		else if(0 == strcmp(argv[i], "--threads") && (i + 1) < argc) num_threads = atoi(argv[++i]);
+		else url = argv[i];
+	}
+	
+	struct net_utils_http_client * http = net_utils_http_client_init(NULL, NULL);
+	assert(http);
+	
+	size_t cb_html = 0;
+	xmlDoc * doc = buffered?load_html_buffered(http, url, &cb_html):load_html_stream(http, url, &cb_html);
 	assert(doc);
+	fprintf(stderr, "[INFO]: %s mode, %ld bytes\n", buffered?"buffered":"streaming", (long)cb_html);
 	
 	xmlNode * root = xmlDocGetRootElement(doc);
 	assert(root);
@@ -139,7 +182,7 @@ int main(int argc, char **argv)
 #ifdef TEST_XMLNODE_ONLY
 	dump_nodes(root);
 #else
-	struct w3c_dom * document = w3c_dom_init(NULL, doc, root, NULL);
+	struct w3c_dom * document = w3c_dom_init_parallel(NULL, doc, root, num_threads, 0, NULL);
 	
 	printf("find ...\n");
 	
@@ -156,6 +199,13 @@ int main(int argc, char **argv)
 	dump_nodes(title, 0);
 	dump_nodes(body, 0);
 	dump_nodes(style, 0);
+	
+	size_t num_links = 0, num_scripts = 0;
+	document->getElementsByTagName(document, "a", &num_links);
+	document->getElementsByTagName(document, "script", &num_scripts);
+	printf("elements: %ld, tags: %ld, <a>: %ld, <script>: %ld\n", 
+		(long)document->tags->num_elements, (long)document->tags->count, 
+		(long)num_links, (long)num_scripts);
 
 	w3c_dom_cleanup(document);
 	free(document);
@@ -169,46 +219,3 @@ int main(int argc, char **argv)
 	return 0;
 }
 
-
-#include <pthread.h>
-static pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int dom_tree_travse_for_elements(xmlNode * root, struct w3c_dom * dom)
-{
-	xmlNode * cur = NULL;
-	avl_tree_t * elements = dom->elements;
-	for(cur = root; cur; cur = cur->next) {
-		if(cur->type == XML_ELEMENT_NODE) {
-			pthread_mutex_lock(&s_mutex);
-			avl_tree_add(elements, cur, node_name_compare);
-			pthread_mutex_unlock(&s_mutex);
-		//	printf("add <%s>\n", cur->name);
-		}
-		dom_tree_travse_for_elements(cur->children, dom);
-	}
-	return 0;
-}
-
-struct w3c_dom * w3c_dom_init(struct w3c_dom * dom, xmlDoc * doc, xmlNode * root, void * user_data)
-{
-	if(NULL == dom) dom = calloc(1, sizeof(*dom));
-	assert(dom);
-	
-	dom->getElementByTagName =w3c_dom_get_element_by_tag_name;
-	avl_tree_init(dom->elements, dom);
-	
-	dom->user_data = user_data;
-	dom->doc = doc;
-	dom->root = root;
-	
-	if(doc && root) { // parse dom and build an avl tree for elements searching
-		dom_tree_travse_for_elements(dom->root, dom);
-	}
-	
-	return dom;
-}
-
-void w3c_dom_cleanup(struct w3c_dom * dom)
-{
-	avl_tree_cleanup(dom->elements);
-	return;
-}
@@ -0,0 +1,571 @@
+/*
+ * w3c-dom.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "w3c-dom.h"
+
+/******************************************************
+ * w3c_dom_tag_index
+ *****************************************************/
+#define TAG_INDEX_DEFAULT_SIZE (64)
+#define TAG_NAME_MAX_LENGTH (256)
+#define TAG_LIST_ALLOC_SIZE (16)
+
+/* case-folded FNV-1a, writes the lower-case name to lower_name (if not null) */
+static inline uint32_t tag_name_hash(const char * name, char * lower_name, size_t size)
+{
+	uint32_t hash = 0x811c9dc5;
+	size_t i = 0;
+	for(; name[i]; ++i) {
+		unsigned char c = tolower((unsigned char)name[i]);
+		if(lower_name && i < size) lower_name[i] = c;
+		hash ^= c;
+		hash *= 0x01000193;
+	}
+	if(lower_name && i < size) lower_name[i] = '\0';
+	return hash;
+}
+
+static struct w3c_dom_tag_list * find_bucket(struct w3c_dom_tag_list * buckets, size_t size, const char * lower_name, uint32_t hash)
+{
+	size_t mask = size - 1;
+	size_t pos = hash & mask;
+	while(1) {
+		struct w3c_dom_tag_list * list = &buckets[pos];
+		if(NULL == list->name) return list;
+		if(list->hash == hash && 0 == strcmp(list->name, lower_name)) return list;
+		pos = (pos + 1) & mask;
+	}
+	return NULL;
+}
+
+static int tag_index_resize(struct w3c_dom_tag_index * index, size_t new_size)
+{
+	struct w3c_dom_tag_list * buckets = calloc(new_size, sizeof(*buckets));
+	assert(buckets);
+	
+	for(size_t i = 0; i < index->size; ++i) {
+		struct w3c_dom_tag_list * list = &index->buckets[i];
+		if(NULL == list->name) continue;
+		*find_bucket(buckets, new_size, list->name, list->hash) = *list;
+	}
+	free(index->buckets);
+	index->buckets = buckets;
+	index->size = new_size;
+	index->last_name = NULL;
+	index->last_list = NULL;
+	return 0;
+}
+
+struct w3c_dom_tag_index * w3c_dom_tag_index_init(struct w3c_dom_tag_index * index, size_t size)
+{
+	if(NULL == index) index = calloc(1, sizeof(*index));
+	else memset(index, 0, sizeof(*index));
+	assert(index);
+	
+	if(size < TAG_INDEX_DEFAULT_SIZE) size = TAG_INDEX_DEFAULT_SIZE;
+	size_t buckets = 1;
+	while(buckets < size) buckets <<= 1;
+	
+	tag_index_resize(index, buckets);
+	return index;
+}
+
+void w3c_dom_tag_index_cleanup(struct w3c_dom_tag_index * index)
+{
+	if(NULL == index) return;
+	for(size_t i = 0; i < index->size; ++i) {
+		struct w3c_dom_tag_list * list = &index->buckets[i];
+		free(list->name);
+		free(list->nodes);
+	}
+	free(index->buckets);
+	memset(index, 0, sizeof(*index));
+}
+
+static struct w3c_dom_tag_list * tag_index_get_list_by_key(struct w3c_dom_tag_index * index, const char * lower_name, uint32_t hash)
+{
+	struct w3c_dom_tag_list * list = find_bucket(index->buckets, index->size, lower_name, hash);
+	if(NULL == list->name) {
+		if((index->count + 1) * 2 > index->size) {	// keep load factor <= 0.5
+			tag_index_resize(index, index->size * 2);
+			list = find_bucket(index->buckets, index->size, lower_name, hash);
+		}
+		list->name = strdup(lower_name);
+		list->hash = hash;
+		++index->count;
+	}
+	return list;
+}
+
+static struct w3c_dom_tag_list * tag_index_get_list(struct w3c_dom_tag_index * index, const xmlChar * name)
+{
+	if(name == index->last_name) return index->last_list;
+	
+	char lower_name[TAG_NAME_MAX_LENGTH] = "";
+	uint32_t hash = tag_name_hash((const char *)name, lower_name, sizeof(lower_name));
+	if(lower_name[sizeof(lower_name) - 1] != '\0') return NULL;	// too long
+	
+	struct w3c_dom_tag_list * list = tag_index_get_list_by_key(index, lower_name, hash);
+	index->last_name = name;
+	index->last_list = list;
+	return list;
+}
+
+static int tag_list_append(struct w3c_dom_tag_list * list, xmlNode ** nodes, size_t count)
+{
+	size_t new_size = list->count + count;
+	if(new_size > list->size) {
+		if(new_size < list->size * 2) new_size = list->size * 2;
+		if(new_size < TAG_LIST_ALLOC_SIZE) new_size = TAG_LIST_ALLOC_SIZE;
+		
+		xmlNode ** p_nodes = realloc(list->nodes, sizeof(*p_nodes) * new_size);
+		assert(p_nodes);
+		list->nodes = p_nodes;
+		list->size = new_size;
+	}
+	memcpy(list->nodes + list->count, nodes, sizeof(*nodes) * count);
+	list->count += count;
+	return 0;
+}
+
+int w3c_dom_tag_index_add(struct w3c_dom_tag_index * index, xmlNode * node)
+{
+	assert(index && node && node->name);
+	struct w3c_dom_tag_list * list = tag_index_get_list(index, node->name);
+	if(NULL == list) return -1;
+	
+	++index->num_elements;
+	return tag_list_append(list, &node, 1);
+}
+
+struct w3c_dom_tag_list * w3c_dom_tag_index_find(const struct w3c_dom_tag_index * index, const char * name)
+{
+	assert(index && name);
+	if(0 == index->count) return NULL;
+	
+	char lower_name[TAG_NAME_MAX_LENGTH] = "";
+	uint32_t hash = tag_name_hash(name, lower_name, sizeof(lower_name));
+	if(lower_name[sizeof(lower_name) - 1] != '\0') return NULL;
+	
+	struct w3c_dom_tag_list * list = find_bucket(index->buckets, index->size, lower_name, hash);
+	if(NULL == list->name) return NULL;
+	return list;
+}
+
+/*
+ * append all elements of @src to @index (in the order of src), src is emptied.
+ */
+static int tag_index_merge(struct w3c_dom_tag_index * index, struct w3c_dom_tag_index * src)
+{
+	for(size_t i = 0; i < src->size; ++i) {
+		struct w3c_dom_tag_list * src_list = &src->buckets[i];
+		if(NULL == src_list->name || 0 == src_list->count) continue;
+		
+		struct w3c_dom_tag_list * list = tag_index_get_list_by_key(index, src_list->name, src_list->hash);
+		if(0 == list->count) { // take over the array, no copying
+			free(list->nodes);
+			list->nodes = src_list->nodes;
+			list->size = src_list->size;
+			list->count = src_list->count;
+			src_list->nodes = NULL;
+			src_list->size = 0;
+		}else {
+			tag_list_append(list, src_list->nodes, src_list->count);
+		}
+		src_list->count = 0;
+	}
+	index->num_elements += src->num_elements;
+	src->num_elements = 0;
+	index->last_name = NULL;
+	index->last_list = NULL;
+	return 0;
+}
+
+/******************************************************
+ * w3c_dom
+ *****************************************************/
+static xmlNode * w3c_dom_get_element_by_tag_name(struct w3c_dom * document, const char * tagName)
+{
+	struct w3c_dom_tag_list * list = w3c_dom_tag_index_find(document->tags, tagName);
+	if(list && list->count > 0) return list->nodes[0];
+	return NULL;
+}
+
+static xmlNode ** w3c_dom_get_elements_by_tag_name(struct w3c_dom * document, const char * tagName, size_t * p_count)
+{
+	struct w3c_dom_tag_list * list = w3c_dom_tag_index_find(document->tags, tagName);
+	if(NULL == list || 0 == list->count) {
+		if(p_count) *p_count = 0;
+		return NULL;
+	}
+	if(p_count) *p_count = list->count;
+	return list->nodes;
+}
+
+static int dom_tree_travse_for_elements(xmlNode * root, struct w3c_dom_tag_index * index)
+{
+	xmlNode * cur = NULL;
+	for(cur = root; cur; cur = cur->next) {
+		if(cur->type == XML_ELEMENT_NODE) {
+			w3c_dom_tag_index_add(index, cur);
+		}
+		dom_tree_travse_for_elements(cur->children, index);
+	}
+	return 0;
+}
+
+/*
+ * parallel index builder:
+ *   the tree is cut at @split_depth into a pre-ordered list of segments:
+ *     - nodes above split_depth (indexed by the calling thread during the merge)
+ *     - whole subtrees rooted at split_depth (indexed by the workers, each one into its own index)
+ *   workers only touch their own segment's index, so no locking is needed per node;
+ *   the merge walks the segments in order, which keeps every tag list in document order.
+ */
+struct index_segment
+{
+	xmlNode * node;
+	int is_subtree;
+	struct w3c_dom_tag_index * index;
+};
+
+struct index_builder
+{
+	struct index_segment * segments;
+	size_t count;
+	size_t size;
+	size_t next;	// next segment to process, updated atomically
+};
+
+static void index_builder_push(struct index_builder * builder, xmlNode * node, int is_subtree)
+{
+	if(builder->count >= builder->size) {
+		size_t new_size = builder->size?(builder->size * 2):256;
+		struct index_segment * segments = realloc(builder->segments, sizeof(*segments) * new_size);
+		assert(segments);
+		builder->segments = segments;
+		builder->size = new_size;
+	}
+	builder->segments[builder->count++] = (struct index_segment){ .node = node, .is_subtree = is_subtree, };
+}
+
+static void index_builder_split(struct index_builder * builder, xmlNode * root, int depth, int split_depth)
+{
+	for(xmlNode * cur = root; cur; cur = cur->next) {
+		if(depth >= split_depth) {
+			if(cur->type == XML_ELEMENT_NODE || cur->children) index_builder_push(builder, cur, 1);
+			continue;
+		}
+		if(cur->type == XML_ELEMENT_NODE) index_builder_push(builder, cur, 0);
+		index_builder_split(builder, cur->children, depth + 1, split_depth);
+	}
+}
+
+static void * index_worker_thread(void * user_data)
+{
+	struct index_builder * builder = user_data;
+	while(1) {
+		size_t i = __atomic_fetch_add(&builder->next, 1, __ATOMIC_RELAXED);
+		if(i >= builder->count) break;
+		
+		struct index_segment * segment = &builder->segments[i];
+		if(!segment->is_subtree) continue;
+		
+		struct w3c_dom_tag_index * index = w3c_dom_tag_index_init(NULL, 0);
+		if(segment->node->type == XML_ELEMENT_NODE) w3c_dom_tag_index_add(index, segment->node);
+		dom_tree_travse_for_elements(segment->node->children, index);
+		segment->index = index;
+	}
+	return NULL;
+}
+
+static int w3c_dom_build_index_parallel(struct w3c_dom * dom, int num_threads, int split_depth)
+{
+	struct index_builder builder[1];
+	memset(builder, 0, sizeof(builder));
+	index_builder_split(builder, dom->root, 0, split_depth);
+	
+	if(num_threads > (int)builder->count) num_threads = builder->count;
+	if(num_threads < 1) num_threads = 1;
+	
+	// the calling thread works as one of the workers
+	pthread_t * threads = calloc(num_threads, sizeof(*threads));
+	assert(threads);
+	for(int i = 1; i < num_threads; ++i) {
+		int rc = pthread_create(&threads[i], NULL, index_worker_thread, builder);
+		assert(0 == rc);
+	}
+	index_worker_thread(builder);
+	for(int i = 1; i < num_threads; ++i) {
+		void * exit_code = NULL;
+		pthread_join(threads[i], &exit_code);
+	}
+	free(threads);
+	
+	// merge in document order
+	for(size_t i = 0; i < builder->count; ++i) {
+		struct index_segment * segment = &builder->segments[i];
+		if(!segment->is_subtree) {
+			w3c_dom_tag_index_add(dom->tags, segment->node);
+			continue;
+		}
+		if(segment->index) {
+			tag_index_merge(dom->tags, segment->index);
+			w3c_dom_tag_index_cleanup(segment->index);
+			free(segment->index);
+		}
+	}
+	free(builder->segments);
+	return 0;
+}
+
+struct w3c_dom * w3c_dom_init_parallel(struct w3c_dom * dom, xmlDoc * doc, xmlNode * root, 
+	int num_threads, int split_depth, 
+	void * user_data)
+{
+	if(num_threads <= 0) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if(num_threads <= 0) num_threads = 1;
+	}
+	if(split_depth <= 0) split_depth = W3C_DOM_DEFAULT_SPLIT_DEPTH;
+	
+	if(NULL == dom) dom = calloc(1, sizeof(*dom));
+	assert(dom);
+	
+	dom->getElementByTagName = w3c_dom_get_element_by_tag_name;
+	dom->getElementsByTagName = w3c_dom_get_elements_by_tag_name;
+	w3c_dom_tag_index_init(dom->tags, 0);
+	
+	dom->user_data = user_data;
+	dom->doc = doc;
+	dom->root = root;
+	
+	if(doc && root) { // parse dom and build a hash index for elements searching
+		if(num_threads == 1) dom_tree_travse_for_elements(dom->root, dom->tags);
+		else w3c_dom_build_index_parallel(dom, num_threads, split_depth);
+	}
+	
+	return dom;
+}
+
+struct w3c_dom * w3c_dom_init(struct w3c_dom * dom, xmlDoc * doc, xmlNode * root, void * user_data)
+{
+	return w3c_dom_init_parallel(dom, doc, root, 1, 0, user_data);
+}
+
+void w3c_dom_cleanup(struct w3c_dom * dom)
+{
+	if(NULL == dom) return;
+	w3c_dom_tag_index_cleanup(dom->tags);
+	return;
+}
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_W3C_DOM) && defined(_STAND_ALONE)
+#include "avl_tree.h"
+#include "app_timer.h"
+
+/*
+ * benchmark: 
+ *   1. build and lookup cost of the tag index vs. the (legacy) single-node AVL index
+ *   2. parallel index build, scaling from 1 to max_threads
+ * usage: w3c-dom [num_elements] [max_threads] [split_depth]
+ */
+static const char * s_tag_names[] = {
+	"div", "p", "span", "a", "li", "ul", "td", "tr", "table", "img",
+	"h1", "h2", "h3", "section", "article", "header", "footer", "nav", "form", "input",
+	"button", "label", "select", "option", "textarea", "pre", "code", "em", "strong", "small",
+};
+#define NUM_TAG_NAMES (sizeof(s_tag_names) / sizeof(s_tag_names[0]))
+
+static long generate_children(xmlNode * parent, int depth, long * p_remaining, long * p_seq)
+{
+	#define GENERATE_FANOUT (10)
+	#define GENERATE_MAX_DEPTH (8)
+	long count = 0;
+	for(int i = 0; i < GENERATE_FANOUT && *p_remaining > 0; ++i) {
+		long seq = (*p_seq)++;
+		--*p_remaining;
+		xmlNode * node = xmlNewChild(parent, NULL, BAD_CAST s_tag_names[seq % NUM_TAG_NAMES], NULL);
+		++count;
+		if(depth < GENERATE_MAX_DEPTH && (seq % 3) != 2) count += generate_children(node, depth + 1, p_remaining, p_seq);
+	}
+	return count;
+}
+
+static xmlDoc * generate_document(long num_elements)
+{
+	xmlDoc * doc = xmlNewDoc(BAD_CAST "1.0");
+	xmlNode * root = xmlNewNode(NULL, BAD_CAST "html");
+	xmlDocSetRootElement(doc, root);
+	xmlNode * body = xmlNewChild(root, NULL, BAD_CAST "body", NULL);
+	
+	long seq = 0;
+	while(num_elements > 0) { // a series of sections (roughly balanced subtrees) under <body>
+		xmlNode * section = xmlNewChild(body, NULL, BAD_CAST "section", NULL);
+		--num_elements;
+		generate_children(section, 2, &num_elements, &seq);
+	}
+	return doc;
+}
+
+static int node_name_compare(const void * _a, const void * _b) 
+{
+	const xmlNode * a = _a;
+	const xmlNode * b = _b;
+	return strcasecmp((char *)a->name, (char *)b->name);
+}
+
+static void avl_index_build(xmlNode * root, avl_tree_t * elements)
+{
+	for(xmlNode * cur = root; cur; cur = cur->next) {
+		if(cur->type == XML_ELEMENT_NODE) avl_tree_add(elements, cur, node_name_compare);
+		avl_index_build(cur->children, elements);
+	}
+}
+
+static size_t verify_document_order(struct w3c_dom * dom, xmlNode * root, size_t * cursors)
+{
+	size_t count = 0;
+	for(xmlNode * cur = root; cur; cur = cur->next) {
+		if(cur->type == XML_ELEMENT_NODE) {
+			struct w3c_dom_tag_list * list = w3c_dom_tag_index_find(dom->tags, (char *)cur->name);
+			assert(list);
+			size_t * cursor = &cursors[list - dom->tags->buckets];
+			assert(*cursor < list->count && list->nodes[*cursor] == cur);
+			++*cursor;
+			++count;
+		}
+		count += verify_document_order(dom, cur->children, cursors);
+	}
+	return count;
+}
+
+int main(int argc, char ** argv)
+{
+	long num_elements = 1000000;
+	if(argc > 1) num_elements = atol(argv[1]);
+	if(num_elements <= 0) num_elements = 1000000;
+	int max_threads = (argc > 2)?atoi(argv[2]):0;
+	if(max_threads <= 0) max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(max_threads <= 0) max_threads = 1;
+	int split_depth = (argc > 3)?atoi(argv[3]):W3C_DOM_DEFAULT_SPLIT_DEPTH;
+	
+	#define NUM_LOOKUPS (1000000)
+	app_timer_t timer[1];
+	xmlDoc * doc = generate_document(num_elements);
+	xmlNode * root = xmlDocGetRootElement(doc);
+	
+	// avl index (legacy): only the first element of each tag name is kept
+	avl_tree_t elements[1];
+	memset(elements, 0, sizeof(elements));
+	avl_tree_init(elements, NULL);
+	
+	app_timer_start(timer);
+	avl_index_build(root, elements);
+	double avl_build_time = app_timer_stop(timer);
+	
+	app_timer_start(timer);
+	for(long i = 0; i < NUM_LOOKUPS; ++i) {
+		xmlNode pattern[1] = {{ .type = XML_ELEMENT_NODE, .name = BAD_CAST s_tag_names[i % NUM_TAG_NAMES], }};
+		void * p_node = avl_tree_find(elements, pattern, node_name_compare);
+		assert(p_node);
+	}
+	double avl_lookup_time = app_timer_stop(timer);
+	avl_tree_cleanup(elements);
+	
+	// hash index
+	app_timer_start(timer);
+	struct w3c_dom dom[1];
+	memset(dom, 0, sizeof(dom));
+	w3c_dom_init(dom, doc, root, NULL);
+	double hash_build_time = app_timer_stop(timer);
+	
+	app_timer_start(timer);
+	for(long i = 0; i < NUM_LOOKUPS; ++i) {
+		size_t count = 0;
+		xmlNode ** nodes = dom->getElementsByTagName(dom, s_tag_names[i % NUM_TAG_NAMES], &count);
+		assert(nodes && count > 0);
+	}
+	double hash_lookup_time = app_timer_stop(timer);
+	
+	// verify: all elements indexed in document order, case-insensitive lookup
+	size_t * cursors = calloc(dom->tags->size, sizeof(*cursors));
+	assert(cursors);
+	size_t total = verify_document_order(dom, root, cursors);
+	assert(total == dom->tags->num_elements);
+	free(cursors);
+	assert(dom->getElementByTagName(dom, "DIV") == dom->getElementByTagName(dom, "div"));
+	
+	printf("elements: %ld, lookups: %d\n", num_elements, NUM_LOOKUPS);
+	printf("avl  index: build %.3f ms, lookup %.1f ns/op (first element only)\n", avl_build_time * 1000.0, avl_lookup_time * 1e9 / NUM_LOOKUPS);
+	printf("hash index: build %.3f ms, lookup %.1f ns/op (all elements)\n", hash_build_time * 1000.0, hash_lookup_time * 1e9 / NUM_LOOKUPS);
+	
+	
+	// parallel build
+	printf("parallel build (split_depth=%d):\n", split_depth);
+	double base_time = 0;
+	for(int num_threads = 1; num_threads <= max_threads; ++num_threads) {
+		struct w3c_dom parallel_dom[1];
+		memset(parallel_dom, 0, sizeof(parallel_dom));
+		
+		app_timer_start(timer);
+		w3c_dom_init_parallel(parallel_dom, doc, root, num_threads, split_depth, NULL);
+		double build_time = app_timer_stop(timer);
+		if(num_threads == 1) base_time = build_time;
+		
+		// must be identical to the single-threaded index
+		assert(parallel_dom->tags->num_elements == dom->tags->num_elements);
+		assert(parallel_dom->tags->count == dom->tags->count);
+		for(size_t i = 0; i < dom->tags->size; ++i) {
+			struct w3c_dom_tag_list * list = &dom->tags->buckets[i];
+			if(NULL == list->name) continue;
+			struct w3c_dom_tag_list * plist = w3c_dom_tag_index_find(parallel_dom->tags, list->name);
+			assert(plist && plist->count == list->count);
+			assert(0 == memcmp(plist->nodes, list->nodes, sizeof(*list->nodes) * list->count));
+		}
+		
+		printf("  threads: %2d, build %8.3f ms, speedup %.2fx\n", num_threads, build_time * 1000.0, base_time / build_time);
+		w3c_dom_cleanup(parallel_dom);
+	}
+	
+	w3c_dom_cleanup(dom);
+	xmlFreeDoc(doc);
+	return 0;
+}
+#endif
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "auto_buffer.h"
 #include "utils.h"
@@ -38,6 +39,225 @@
 
 
 #define AUTO_BUFFER_ALLOC_SIZE (4096)
+
+/***************************
+ * thread-local pool
+**************************/
+#define AUTO_BUFFER_POOL_NUM_CLASSES (9)	// 4 KB .. 1 MB
+#define AUTO_BUFFER_POOL_TRIM_INTERVAL (256)
+#define AUTO_BUFFER_POOL_DEFAULT_LIMIT (16 << 20)
+
+struct auto_buffer_pool_class
+{
+	void * free_list;	// the first bytes of a cached block point to the next one
+	long num_free;
+	long num_used;		// allocated from this class by the thread and not returned yet
+	long high_water;	// max num_used since the last trim
+};
+
+struct auto_buffer_pool
+{
+	struct auto_buffer_pool_class classes[AUTO_BUFFER_POOL_NUM_CLASSES];
+	size_t max_cached_bytes;
+	long returns_since_trim;
+	struct auto_buffer_pool_stats stats;
+};
+
+static pthread_once_t s_pool_once_key = PTHREAD_ONCE_INIT;
+static pthread_key_t s_pool_key;
+
+static void pool_release_all(struct auto_buffer_pool * pool)
+{
+	for(int i = 0; i < AUTO_BUFFER_POOL_NUM_CLASSES; ++i) {
+		struct auto_buffer_pool_class * class = &pool->classes[i];
+		while(class->free_list) {
+			void * block = class->free_list;
+			class->free_list = *(void **)block;
+			free(block);
+		}
+		class->num_free = 0;
+	}
+	pool->stats.cached_bytes = 0;
+}
+
+static void on_thread_exit(void * user_data)
+{
+	struct auto_buffer_pool * pool = user_data;
+	if(NULL == pool) return;
+	pool_release_all(pool);
+	free(pool);
+}
+
+static void create_pool_key(void)
+{
+	int rc = pthread_key_create(&s_pool_key, on_thread_exit);
+	assert(0 == rc);
+}
+
+static struct auto_buffer_pool * get_pool(void)
+{
+	pthread_once(&s_pool_once_key, create_pool_key);
+	struct auto_buffer_pool * pool = pthread_getspecific(s_pool_key);
+	if(NULL == pool) {
+		pool = calloc(1, sizeof(*pool));
+		assert(pool);
+		pool->max_cached_bytes = AUTO_BUFFER_POOL_DEFAULT_LIMIT;
+		int rc = pthread_setspecific(s_pool_key, pool);
+		assert(0 == rc);
+	}
+	return pool;
+}
+
+// largest class that fits in size, -1 if none
+static inline int class_floor(size_t size)
+{
+	if(size < AUTO_BUFFER_ALLOC_SIZE) return -1;
+	int index = 0;
+	while(index < (AUTO_BUFFER_POOL_NUM_CLASSES - 1) && (size >> 1) >= ((size_t)AUTO_BUFFER_ALLOC_SIZE << index)) ++index;
+	if(size >= ((size_t)AUTO_BUFFER_ALLOC_SIZE << AUTO_BUFFER_POOL_NUM_CLASSES)) return -1;	// too large to cache
+	return index;
+}
+
+// smallest class that can hold size, -1 if none
+static inline int class_ceil(size_t size)
+{
+	int index = 0;
+	while(index < AUTO_BUFFER_POOL_NUM_CLASSES && ((size_t)AUTO_BUFFER_ALLOC_SIZE << index) < size) ++index;
+	return (index < AUTO_BUFFER_POOL_NUM_CLASSES)?index:-1;
+}
+
+static inline void class_add_used(struct auto_buffer_pool_class * class, long count)
+{
+	class->num_used += count;
+	if(class->num_used < 0) class->num_used = 0;	// allocated by another thread
+	if(class->num_used > class->high_water) class->high_water = class->num_used;
+}
+
+// keep no more cached blocks than the high-water mark of the last period needs
+static void pool_trim(struct auto_buffer_pool * pool)
+{
+	for(int i = 0; i < AUTO_BUFFER_POOL_NUM_CLASSES; ++i) {
+		struct auto_buffer_pool_class * class = &pool->classes[i];
+		long keep = class->high_water - class->num_used;
+		while(class->num_free > 0 && class->num_free > keep) {
+			void * block = class->free_list;
+			class->free_list = *(void **)block;
+			free(block);
+			--class->num_free;
+			++pool->stats.num_trimmed;
+			pool->stats.cached_bytes -= ((size_t)AUTO_BUFFER_ALLOC_SIZE << i);
+		}
+		class->high_water = class->num_used;
+	}
+	pool->returns_since_trim = 0;
+}
+
+// @param p_size: [in] requested size, [out] usable size of the block
+static void * pool_alloc(size_t * p_size)
+{
+	struct auto_buffer_pool * pool = get_pool();
+	int index = (pool->max_cached_bytes > 0)?class_ceil(*p_size):-1;
+	if(index < 0) return malloc(*p_size);
+	
+	struct auto_buffer_pool_class * class = &pool->classes[index];
+	size_t size = (size_t)AUTO_BUFFER_ALLOC_SIZE << index;
+	void * block = class->free_list;
+	if(block) {
+		class->free_list = *(void **)block;
+		--class->num_free;
+		++pool->stats.num_hits;
+		pool->stats.cached_bytes -= size;
+	}else {
+		block = malloc(size);
+		if(NULL == block) return NULL;
+		++pool->stats.num_misses;
+	}
+	class_add_used(class, 1);
+	*p_size = size;
+	return block;
+}
+
+// a pooled block changed its size (realloc) or left the buffer (detach, new_size == 0)
+static void pool_resized(size_t old_size, size_t new_size)
+{
+	struct auto_buffer_pool * pool = get_pool();
+	int old_index = class_floor(old_size);
+	int new_index = class_floor(new_size);
+	if(old_index == new_index) return;
+	if(old_index >= 0) class_add_used(&pool->classes[old_index], -1);
+	if(new_index >= 0) class_add_used(&pool->classes[new_index], 1);
+}
+
+static void pool_free(void * block, size_t size)
+{
+	struct auto_buffer_pool * pool = get_pool();
+	int index = class_floor(size);
+	if(index < 0) {
+		free(block);
+		return;
+	}
+	
+	struct auto_buffer_pool_class * class = &pool->classes[index];
+	class_add_used(class, -1);
+	size = (size_t)AUTO_BUFFER_ALLOC_SIZE << index;
+	if((pool->stats.cached_bytes + size) > pool->max_cached_bytes) {
+		free(block);
+		++pool->stats.num_releases;
+		return;
+	}
+	
+	*(void **)block = class->free_list;
+	class->free_list = block;
+	++class->num_free;
+	++pool->stats.num_returns;
+	pool->stats.cached_bytes += size;
+	if(pool->stats.cached_bytes > pool->stats.peak_cached_bytes) pool->stats.peak_cached_bytes = pool->stats.cached_bytes;
+	
+	if(++pool->returns_since_trim >= AUTO_BUFFER_POOL_TRIM_INTERVAL) pool_trim(pool);
+}
+
+// grow into a cached block if there is one (only the pending data is copied), otherwise realloc()
+static void * pool_realloc(auto_buffer_t * buf, size_t * p_size)
+{
+	struct auto_buffer_pool * pool = get_pool();
+	int index = (pool->max_cached_bytes > 0)?class_ceil(*p_size):-1;
+	if(index >= 0 && pool->classes[index].free_list) {
+		void * block = pool_alloc(p_size);
+		if(buf->length > 0) memcpy(block, buf->data + buf->start_pos, buf->length);
+		pool_free(buf->data, buf->size);
+		buf->start_pos = 0;
+		return block;
+	}
+	
+	void * data = realloc(buf->data, *p_size);
+	if(NULL == data) return NULL;
+	++pool->stats.num_misses;
+	pool_resized(buf->size, *p_size);
+	return data;
+}
+
+void auto_buffer_pool_get_stats(struct auto_buffer_pool_stats * stats)
+{
+	assert(stats);
+	*stats = get_pool()->stats;
+}
+
+void auto_buffer_pool_trim(void)
+{
+	pool_trim(get_pool());
+}
+
+void auto_buffer_pool_set_limit(size_t max_cached_bytes)
+{
+	struct auto_buffer_pool * pool = get_pool();
+	pool->max_cached_bytes = max_cached_bytes;
+	if(0 == max_cached_bytes) pool_release_all(pool);
+	else if(pool->stats.cached_bytes > max_cached_bytes) pool_trim(pool);
+}
+
+/***************************
+ * auto_buffer
+**************************/
 auto_buffer_t * auto_buffer_init(auto_buffer_t * buf, size_t size)
 {
 	if(NULL == buf) buf = calloc(1, sizeof(*buf));
@@ -54,13 +274,15 @@ int auto_buffer_resize(auto_buffer_t * buf, size_t size)
 	assert(buf);
 	int rc = 0;
 	if(size == -1 || size == 0) size = AUTO_BUFFER_ALLOC_SIZE;
+	else if(size > ((size_t)-1 - AUTO_BUFFER_ALLOC_SIZE)) return (errno = ENOMEM);
 	else size = (size + AUTO_BUFFER_ALLOC_SIZE - 1) / AUTO_BUFFER_ALLOC_SIZE * AUTO_BUFFER_ALLOC_SIZE;
 	
 	if(size <= buf->size) return 0;
-	void * data = realloc(buf->data, size);
-	assert(data);
-	if(NULL == data) {
-		rc = errno;
+	void * data = NULL;
+	if(NULL == buf->data) data = pool_alloc(&size);
+	else data = pool_realloc(buf, &size);
+	if(NULL == data) {	// the buffer is unchanged
+		rc = errno = ENOMEM;
 		return rc;
 	}
 	buf->data = data;
@@ -73,11 +295,58 @@ void auto_buffer_cleanup(auto_buffer_t * buf)
 {
 	debug_printf("%s(%p): data=%p", __FUNCTION__, buf, buf?buf->data:NULL);
 	if(NULL == buf) return;
-	if(buf->data) free(buf->data);
+	if(buf->data) pool_free(buf->data, buf->size);
 	memset(buf, 0, sizeof(*buf));
 	return;
 }
 
+static int auto_buffer_grow(auto_buffer_t * buf, size_t minimal_size)
+{
+	size_t size = buf->size?buf->size:AUTO_BUFFER_ALLOC_SIZE;
+	if(size <= ((size_t)-1) / 2) size *= 2;
+	if(size < minimal_size) size = minimal_size;
+	return auto_buffer_resize(buf, size);
+}
+
+int auto_buffer_reserve(auto_buffer_t * buf, size_t additional)
+{
+	assert(buf);
+	size_t minimal_size = buf->length + additional;
+	if(minimal_size < additional) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+	if((buf->start_pos + minimal_size) <= buf->size) return 0;
+	
+	auto_buffer_compact(buf);
+	return auto_buffer_resize(buf, minimal_size);
+}
+
+void auto_buffer_compact(auto_buffer_t * buf)
+{
+	assert(buf);
+	if(buf->start_pos == 0) return;
+	if(buf->length > 0) memmove(buf->data, buf->data + buf->start_pos, buf->length);
+	buf->start_pos = 0;
+}
+
+int auto_buffer_shrink(auto_buffer_t * buf)
+{
+	assert(buf);
+	auto_buffer_compact(buf);
+	
+	size_t size = (buf->length + AUTO_BUFFER_ALLOC_SIZE - 1) / AUTO_BUFFER_ALLOC_SIZE * AUTO_BUFFER_ALLOC_SIZE;
+	if(size == 0) size = AUTO_BUFFER_ALLOC_SIZE;
+	if(size >= buf->size) return 0;
+	
+	void * data = realloc(buf->data, size);
+	if(NULL == data) return -1;	// the old block is still valid
+	pool_resized(buf->size, size);
+	buf->data = data;
+	buf->size = size;
+	return 0;
+}
+
 int auto_buffer_push(auto_buffer_t * buf, const void * data, size_t length)
 {
 	assert(buf);
@@ -89,8 +358,17 @@ int auto_buffer_push(auto_buffer_t * buf, const void * data, size_t length)
 		return -1;
 	}
 	
-	int rc = auto_buffer_resize(buf, minimal_buf_size);
-	if(rc) return rc;
+	if(minimal_buf_size > buf->size) {
+		// reuse the consumed space if the copy is not larger than what it frees
+		if(buf->start_pos >= buf->length) {
+			auto_buffer_compact(buf);
+			minimal_buf_size = buf->length + length;
+		}
+		if(minimal_buf_size > buf->size) {
+			int rc = auto_buffer_grow(buf, minimal_buf_size);
+			if(rc) return rc;
+		}
+	}
 	
 	memcpy(buf->data + buf->start_pos + buf->length, data, length);
 	buf->length += length;
@@ -126,10 +404,52 @@ const unsigned char * auto_buffer_get_data(auto_buffer_t * buf)
 	if(NULL == buf->data) return NULL;
 	return (buf->data + buf->start_pos);
 }
+
+unsigned char * auto_buffer_detach(auto_buffer_t * buf, size_t * p_length)
+{
+	assert(buf);
+	unsigned char * data = buf->data;
+	size_t length = buf->length;
+	if(p_length) *p_length = 0;
+	if(NULL == data) return NULL;
+	pool_resized(buf->size, 0);	// owned by the caller from now on
+	
+	if(buf->start_pos > 0 && length > 0) memmove(data, data + buf->start_pos, length);
+	if(length >= buf->size) { // no room for the terminating nul
+		data = realloc(data, length + 1);
+		assert(data);
+	}
+	data[length] = '\0';
+	
+	memset(buf, 0, sizeof(*buf));
+	if(p_length) *p_length = length;
+	return data;
+}
 #undef AUTO_BUFFER_ALLOC_SIZE
+#undef AUTO_BUFFER_POOL_NUM_CLASSES
+#undef AUTO_BUFFER_POOL_TRIM_INTERVAL
+#undef AUTO_BUFFER_POOL_DEFAULT_LIMIT
 
 
 #if defined(_TEST_AUTO_BUFFER) && defined(_STAND_ALONE)
+#include "app_timer.h"
+static void bench_append(size_t max_size);
+static void * thread_use_buffers(void * user_data)
+{
+	auto_buffer_t buf[1];
+	for(int i = 0; i < 100; ++i) {
+		auto_buffer_init(buf, (i % 8) * 8192);
+		auto_buffer_cleanup(buf);
+	}
+	struct auto_buffer_pool_stats stats[1];
+	auto_buffer_pool_get_stats(stats);
+	assert(stats->cached_bytes > 0 && stats->num_hits > 0);
+	return NULL;
+}
+
+/*
+ * usage: auto_buffer [max_size_mb]   (default: 1024, i.e. 1 KB .. 1 GB)
+ */
 int main(int argc, char ** argv) 
 {
 	auto_buffer_t buf[1], *p_buf;
@@ -157,6 +477,142 @@ int main(int argc, char ** argv)
 	assert(buf->length == BUF_SIZE && buf->start_pos == BUF_SIZE);
 	auto_buffer_cleanup(buf);
 	
+	// test 4. detach: no copying if start_pos == 0
+	auto_buffer_init(buf, 0);
+	auto_buffer_push(buf, "hello", 5);
+	unsigned char * origin = buf->data;
+	size_t length = 0;
+	p_data = auto_buffer_detach(buf, &length);
+	assert(p_data == origin && length == 5 && 0 == strcmp((char *)p_data, "hello"));
+	assert(NULL == buf->data && 0 == buf->length);
+	free(p_data);
+	
+	auto_buffer_push(buf, "hello world", 11);	// an empty buffer can be reused after detach
+	p_data = NULL;
+	auto_buffer_pop(buf, &p_data, 6);
+	free(p_data);
+	p_data = auto_buffer_detach(buf, &length);
+	assert(length == 5 && 0 == strcmp((char *)p_data, "world"));
+	free(p_data);
+	auto_buffer_cleanup(buf);
+	
+	// test 5. reserve / compact / shrink
+	auto_buffer_init(buf, 0);
+	auto_buffer_push(buf, padding_data, sizeof(padding_data));
+	p_data = data;
+	auto_buffer_pop(buf, &p_data, 512);
+	assert(0 == auto_buffer_reserve(buf, 1 << 20));
+	assert(buf->start_pos == 0 && buf->length == 512 && buf->size >= (512 + (1 << 20)));
+	unsigned char * reserved = buf->data;
+	for(int i = 0; i < 1024; ++i) auto_buffer_push(buf, padding_data, sizeof(padding_data));
+	assert(buf->data == reserved);	// no reallocation
+	assert(0 == auto_buffer_shrink(buf) && buf->size == (512 + (1 << 20) + 4095) / 4096 * 4096);
+	auto_buffer_cleanup(buf);
+	
+	// test 5b. an impossible size is an error, not an abort
+	auto_buffer_init(buf, 0);
+	auto_buffer_push(buf, "hello", 5);
+	assert(ENOMEM == auto_buffer_reserve(buf, (size_t)1 << 62));
+	assert(ENOMEM == auto_buffer_resize(buf, (size_t)-2));
+	assert(buf->length == 5 && 0 == memcmp(auto_buffer_get_data(buf), "hello", 5));
+	auto_buffer_cleanup(buf);
+	
+	// test 6. pop / push cycles reuse the consumed space
+	static const unsigned char chunk[3000];
+	auto_buffer_init(buf, 0);
+	for(int i = 0; i < 1000; ++i) {
+		auto_buffer_push(buf, chunk, sizeof(chunk));
+		p_data = data;
+		auto_buffer_pop(buf, &p_data, 1000);
+	}
+	assert(buf->length == 2000 * 1000 && buf->size < 4 * 2000 * 1000);
+	auto_buffer_cleanup(buf);
+#undef BUF_SIZE
+	
+	// test 7. pool: steady state request processing does no malloc()
+	struct auto_buffer_pool_stats stats[2];
+	auto_buffer_t bufs[3];
+	for(int round = 0; round < 1000; ++round) {
+		if(round == 10) auto_buffer_pool_get_stats(&stats[0]);	// warm
+		auto_buffer_init(&bufs[0], 0);
+		auto_buffer_init(&bufs[1], 0);
+		auto_buffer_init(&bufs[2], 64 * 1024);
+		for(int i = 0; i < 20; ++i) auto_buffer_push(&bufs[1], data, sizeof(data));	// grows to 32 KB
+		for(int i = 0; i < 3; ++i) auto_buffer_cleanup(&bufs[i]);
+	}
+	auto_buffer_pool_get_stats(&stats[1]);
+	assert(stats[1].num_misses == stats[0].num_misses);
+	assert(stats[1].num_hits - stats[0].num_hits == 990 * 6);	// 3 inits + 3 growths
+	
+	// test 8. trimming to the high-water mark
+	auto_buffer_t many[64];
+	for(int i = 0; i < 64; ++i) auto_buffer_init(&many[i], 0);
+	for(int i = 0; i < 64; ++i) auto_buffer_cleanup(&many[i]);
+	auto_buffer_pool_trim();	// high water: 64 buffers of 4 KB
+	auto_buffer_pool_get_stats(&stats[0]);
+	assert(stats[0].cached_bytes >= 64 * 4096);
+	auto_buffer_pool_trim();	// none used since the last trim
+	auto_buffer_pool_get_stats(&stats[1]);
+	assert(stats[1].cached_bytes == 0 && stats[1].num_trimmed > stats[0].num_trimmed);
+	printf("pool stats: hits=%ld, misses=%ld, returns=%ld, releases=%ld, trimmed=%ld, peak=%zu bytes\n",
+		stats[1].num_hits, stats[1].num_misses, stats[1].num_returns, stats[1].num_releases, 
+		stats[1].num_trimmed, stats[1].peak_cached_bytes);
+	
+	// test 9. a thread's pool is released when it exits (checked by -fsanitize=leak)
+	pthread_t th;
+	int rc = pthread_create(&th, NULL, thread_use_buffers, NULL);
+	assert(0 == rc);
+	pthread_join(th, NULL);
+	
+	size_t max_size = (size_t)1 << 30;
+	if(argc > 1) max_size = (size_t)atol(argv[1]) << 20;
+	bench_append(max_size);
 	return 0;
 }
+
+// the previous policy: grow to the exact size (4 KB granularity) on every push
+static int legacy_push(auto_buffer_t * buf, const void * data, size_t length)
+{
+	size_t size = (buf->length + length + 4095) / 4096 * 4096;
+	if(size > buf->size) {
+		void * p = realloc(buf->data, size);
+		if(NULL == p) return -1;
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->length, data, length);
+	buf->length += length;
+	return 0;
+}
+
+static void bench_append(size_t max_size)
+{
+	static unsigned char chunk[16384];	// typical curl write callback size
+	printf("==== %s(): 16 KB appends ====\n", __FUNCTION__);
+	printf("%12s %12s %10s %12s %10s\n", "total", "doubling(s)", "MB/s", "legacy(s)", "MB/s");
+	
+	for(size_t total = 1024; total <= max_size; total *= 4) {
+		double t[2] = { 0 };
+		for(int policy = 0; policy < 2; ++policy) {
+			if(policy == 1 && total > ((size_t)256 << 20)) break;	// too slow
+			auto_buffer_t buf[1];
+			memset(buf, 0, sizeof(buf));
+			app_timer_t timer[1];
+			app_timer_start(timer);
+			for(size_t length = 0; length < total; ) {
+				size_t cb = total - length;
+				if(cb > sizeof(chunk)) cb = sizeof(chunk);
+				int rc = policy?legacy_push(buf, chunk, cb):auto_buffer_push(buf, chunk, cb);
+				if(rc) { fprintf(stderr, "out of memory at %zu bytes\n", length); break; }
+				length += cb;
+			}
+			t[policy] = app_timer_stop(timer);
+			if(policy) free(buf->data);	// legacy_push() uses plain realloc()
+			else auto_buffer_cleanup(buf);	// the data may come from the pool
+		}
+		double mb = (double)total / (1 << 20);
+		printf("%12zu %12.6f %10.1f %12.6f %10.1f\n", total, 
+			t[0], t[0]>0?mb/t[0]:0, t[1], t[1]>0?mb/t[1]:0);
+	}
+}
 #endif
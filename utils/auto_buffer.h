@@ -15,13 +15,61 @@ typedef struct auto_buffer
 }auto_buffer_t;
 
 auto_buffer_t * auto_buffer_init(auto_buffer_t * buf, size_t size);
-int auto_buffer_resize(auto_buffer_t * buf, size_t size);
+int auto_buffer_resize(auto_buffer_t * buf, size_t size);	// exact size (rounded up to 4 KB), never shrinks, ENOMEM on failure
 void auto_buffer_cleanup(auto_buffer_t * buf);
 
+/*
+ * auto_buffer_reserve()
+ * @brief make sure that at least @additional bytes can be pushed without another reallocation,
+ *     e.g. with the Content-Length of an http response. Data is slid back to offset 0 if that is enough.
+ */
+int auto_buffer_reserve(auto_buffer_t * buf, size_t additional);
+
+// move the data to offset 0 (start_pos = 0)
+void auto_buffer_compact(auto_buffer_t * buf);
+
+// compact and release the unused capacity (rounded up to 4 KB)
+int auto_buffer_shrink(auto_buffer_t * buf);
+
+/*
+ * auto_buffer_push()
+ * @brief append data, the capacity grows geometrically (at least doubled) so that appending n bytes is amortized O(n).
+ *     The consumed space before start_pos (see auto_buffer_pop()) is reclaimed first if it's not smaller than the pending data.
+ */
 int auto_buffer_push(auto_buffer_t * buf, const void * data, size_t length);
 size_t auto_buffer_pop(auto_buffer_t * buf, unsigned char ** p_buf, size_t buf_size);
 const unsigned char * auto_buffer_get_data(auto_buffer_t * buf);
 
+/*
+ * auto_buffer pool
+ * @brief per-thread cache of freed buffer storage, in power-of-2 size classes (4 KB .. 1 MB).
+ *     auto_buffer_init() / auto_buffer_resize() draw from it (a growing buffer moves into a cached block
+ *     of the next class when there is one), auto_buffer_cleanup() returns to it,
+ *     so creating and destroying buffers per request does no malloc() once the pool is warm.
+ *     Every 256 returns (or on auto_buffer_pool_trim()) each class is trimmed to the high-water mark
+ *     of buffers in use since the previous trim. Larger buffers are always freed.
+ */
+struct auto_buffer_pool_stats
+{
+	long num_hits;			// allocations served from the pool
+	long num_misses;		// allocations that needed malloc() / realloc()
+	long num_returns;		// buffers cached by auto_buffer_cleanup()
+	long num_releases;		// buffers freed by auto_buffer_cleanup() (too large or over the limit)
+	long num_trimmed;		// cached buffers freed by trimming
+	size_t cached_bytes;
+	size_t peak_cached_bytes;
+};
+void auto_buffer_pool_get_stats(struct auto_buffer_pool_stats * stats);	// of the calling thread
+void auto_buffer_pool_trim(void);
+void auto_buffer_pool_set_limit(size_t max_cached_bytes);	// calling thread only, default 16 MB, 0: disable the pool
+
+/*
+ * auto_buffer_detach()
+ * @brief take over the data without copying (moved to offset 0 and nul-terminated), the buffer is reset to empty.
+ * @return data (should be freed by free()), NULL if the buffer has no data
+ */
+unsigned char * auto_buffer_detach(auto_buffer_t * buf, size_t * p_length);
+
 #ifdef __cplusplus
 }
 #endif
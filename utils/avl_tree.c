@@ -41,24 +41,120 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <search.h>
 #include "avl_tree.h"
-#include "clib-stack.h"
 
 struct avl_node {
 	const void * key;
 	struct avl_node * a[2];	// children: [0]==left, [1]==right
 	int h;
+	int size;	// number of nodes in the subtree, only maintained with avl_tree_flag_rank
 };
 
 
 
+/*************************************
+ * node arena
+ ************************************/
+struct avl_node_chunk
+{
+	struct avl_node_chunk * next;
+	size_t length;	// number of nodes that have been handed out from this chunk
+	struct avl_node nodes[];
+};
+
+struct avl_node_arena * avl_node_arena_init(struct avl_node_arena * arena, size_t nodes_per_chunk)
+{
+	if(NULL == arena) arena = calloc(1, sizeof(*arena));
+	else memset(arena, 0, sizeof(*arena));
+	assert(arena);
+	
+	if(0 == nodes_per_chunk) nodes_per_chunk = AVL_NODE_ARENA_DEFAULT_CHUNK_SIZE;
+	arena->nodes_per_chunk = nodes_per_chunk;
+	return arena;
+}
+
+void avl_node_arena_reset(struct avl_node_arena * arena)
+{
+	// the chunks are reused in list order, only the used ones have to be rewound
+	for(struct avl_node_chunk * chunk = arena->chunks; chunk && chunk->length; chunk = chunk->next) {
+		chunk->length = 0;
+	}
+	arena->current = arena->chunks;
+	arena->free_list = NULL;
+	arena->num_used = 0;
+}
+
+void avl_node_arena_cleanup(struct avl_node_arena * arena)
+{
+	if(NULL == arena) return;
+	struct avl_node_chunk * chunk = arena->chunks;
+	while(chunk) {
+		struct avl_node_chunk * next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	memset(arena, 0, sizeof(*arena));
+}
+
+static struct avl_node * avl_node_arena_alloc(struct avl_node_arena * arena)
+{
+	struct avl_node * node = arena->free_list;
+	if(node) {
+		arena->free_list = node->a[0];
+		++arena->num_used;
+		return node;
+	}
+	
+	struct avl_node_chunk * chunk = arena->current;
+	if(chunk && chunk->length == arena->nodes_per_chunk) {
+		chunk = chunk->next;	// a chunk kept by avl_node_arena_reset()
+		if(chunk) arena->current = chunk;
+	}
+	if(NULL == chunk) {
+		chunk = malloc(sizeof(*chunk) + sizeof(*chunk->nodes) * arena->nodes_per_chunk);
+		assert(chunk);
+		chunk->length = 0;
+		chunk->next = NULL;
+		
+		// append, so that reset() can reuse the chunks in order
+		if(arena->current) arena->current->next = chunk;
+		else arena->chunks = chunk;
+		arena->current = chunk;
+		++arena->num_chunks;
+	}
+	++arena->num_used;
+	return &chunk->nodes[chunk->length++];
+}
+
+static void avl_node_arena_free(struct avl_node_arena * arena, struct avl_node * node)
+{
+	node->a[0] = arena->free_list;
+	arena->free_list = node;
+	--arena->num_used;
+}
+
+static inline struct avl_node * node_new(struct avl_tree * tree)
+{
+	if(tree->arena) return avl_node_arena_alloc(tree->arena);
+	return malloc(sizeof(struct avl_node));
+}
+
+static inline void node_free(struct avl_tree * tree, struct avl_node * node)
+{
+	if(tree->arena) avl_node_arena_free(tree->arena, node);
+	else free(node);
+}
+
 /*************************************
  * AVL_tree
  ************************************/
 
 static inline int height_of(struct avl_node * node) { return node ? node->h : 0; }
+static inline int size_of(const struct avl_node * node) { return node ? node->size : 0; }
+static inline void update_size(struct avl_node * node) { node->size = size_of(node->a[0]) + size_of(node->a[1]) + 1; }
 static int avl_rot(struct avl_node **p, struct avl_node *x, int dir /* deeper side */)
 {
 	struct avl_node * y = x->a[dir];
@@ -82,6 +178,9 @@ static int avl_rot(struct avl_node **p, struct avl_node *x, int dir /* deeper si
 		x->h = hz;
 		y->h = hz;
 		z->h = hz+1;
+		update_size(x);
+		update_size(y);
+		update_size(z);
 	} else {
 		/*
 		 *   x               y
@@ -94,6 +193,8 @@ static int avl_rot(struct avl_node **p, struct avl_node *x, int dir /* deeper si
 		y->a[!dir] = x;
 		x->h = hz+1;
 		y->h = hz+2;
+		update_size(x);
+		update_size(y);
 		z = y;
 	}
 	*p = z;
@@ -114,33 +215,393 @@ static int avl_tree_balance(struct avl_node **p)
 	return avl_rot(p, n, h0<h1);
 }
 
+/*************************************
+ * concurrent mode
+ *   writers: serialized by a mutex, never modify a published node.
+ *            The path from the root to the change is copied, rebalanced, 
+ *            then the new root is published with a single atomic store.
+ *   readers: lock-free, announce the epoch they started in.
+ *            Replaced nodes are freed once no reader can still see them.
+ ************************************/
+#define AVL_TREE_MAX_READERS (256)
+
+struct reader_slot
+{
+	long epoch;	// 0: quiescent
+	char padding[64 - sizeof(long)];
+};
+
+struct retired_item
+{
+	long epoch;
+	int is_data;	// 1: a deleted key, to be passed to on_free_data
+	void * ptr;
+};
+
+struct avl_tree_concurrent
+{
+	pthread_mutex_t writer_mutex;
+	long epoch __attribute__((aligned(64)));
+	struct reader_slot slots[AVL_TREE_MAX_READERS] __attribute__((aligned(64)));
+	
+	struct retired_item * retired;
+	size_t num_retired;
+	size_t max_retired;
+	
+	// nodes replaced during the current write
+	struct avl_node ** garbage;
+	size_t num_garbage;
+	size_t max_garbage;
+	
+	// nodes created during the current write: not published yet, can be modified in place
+	struct avl_node * fresh[AVL_TREE_MAX_HEIGHT * 2];
+	int num_fresh;
+};
+
+/* reader ids: one slot index per thread, released by a pthread key destructor when the thread exits.  */
+static int s_num_reader_ids;	// high-water mark
+static char s_reader_id_used[AVL_TREE_MAX_READERS];
+static __thread int s_reader_id = -1;
+static pthread_key_t s_reader_key;
+static pthread_once_t s_reader_key_once = PTHREAD_ONCE_INIT;
+
+static void release_reader_id(void * value)
+{
+	int id = (int)(long)value - 1;
+	__atomic_store_n(&s_reader_id_used[id], 0, __ATOMIC_RELEASE);
+}
+
+static void create_reader_key(void)
+{
+	int rc = pthread_key_create(&s_reader_key, release_reader_id);
+	assert(0 == rc);
+}
+
+static inline struct avl_node * load_root(struct avl_tree * tree)
+{
+	return __atomic_load_n(&tree->root, __ATOMIC_ACQUIRE);
+}
+
+static inline int get_reader_id(void)
+{
+	if(s_reader_id >= 0) return s_reader_id;
+	
+	pthread_once(&s_reader_key_once, create_reader_key);
+	for(int id = 0; id < AVL_TREE_MAX_READERS; ++id) {
+		char expected = 0;
+		if(__atomic_compare_exchange_n(&s_reader_id_used[id], &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			s_reader_id = id;
+			break;
+		}
+	}
+	assert(s_reader_id >= 0);	// too many concurrent reader threads
+	
+	int num_ids = __atomic_load_n(&s_num_reader_ids, __ATOMIC_RELAXED);
+	while(num_ids <= s_reader_id 
+		&& !__atomic_compare_exchange_n(&s_num_reader_ids, &num_ids, s_reader_id + 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	pthread_setspecific(s_reader_key, (void *)(long)(s_reader_id + 1));
+	return s_reader_id;
+}
+
+void avl_tree_read_lock(avl_tree_t * tree)
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	if(NULL == state) return;
+	struct reader_slot * slot = &state->slots[get_reader_id()];
+	assert(0 == slot->epoch);	// not re-entrant
+	__atomic_store_n(&slot->epoch, __atomic_load_n(&state->epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);	// announce the epoch before loading the root
+}
+
+void avl_tree_read_unlock(avl_tree_t * tree)
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	if(NULL == state) return;
+	__atomic_store_n(&state->slots[get_reader_id()].epoch, 0, __ATOMIC_RELEASE);
+}
+
+static void retire(struct avl_tree_concurrent * state, void * ptr, int is_data, long epoch)
+{
+	if(state->num_retired == state->max_retired) {
+		state->max_retired = state->max_retired?(state->max_retired * 2):256;
+		state->retired = realloc(state->retired, sizeof(*state->retired) * state->max_retired);
+		assert(state->retired);
+	}
+	state->retired[state->num_retired++] = (struct retired_item){ .epoch = epoch, .is_data = is_data, .ptr = ptr };
+}
+
+static void reclaim(struct avl_tree * tree, int force)
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	long min_epoch = __atomic_load_n(&state->epoch, __ATOMIC_RELAXED) + 1;
+	int num_ids = __atomic_load_n(&s_num_reader_ids, __ATOMIC_RELAXED);
+	if(num_ids > AVL_TREE_MAX_READERS) num_ids = AVL_TREE_MAX_READERS;
+	if(!force) {
+		for(int i = 0; i < num_ids; ++i) {
+			long epoch = __atomic_load_n(&state->slots[i].epoch, __ATOMIC_SEQ_CST);
+			if(epoch && epoch < min_epoch) min_epoch = epoch;
+		}
+	}
+	
+	// items retired in an epoch older than every active reader are unreachable
+	size_t length = 0;
+	for(size_t i = 0; i < state->num_retired; ++i) {
+		struct retired_item * item = &state->retired[i];
+		if(item->epoch >= min_epoch) {
+			state->retired[length++] = *item;
+			continue;
+		}
+		if(item->is_data) {
+			if(tree->on_free_data) tree->on_free_data(item->ptr);
+		}else {
+			node_free(tree, item->ptr);
+		}
+	}
+	state->num_retired = length;
+}
+
+static void add_garbage(struct avl_tree_concurrent * state, struct avl_node * n)
+{
+	if(state->num_garbage == state->max_garbage) {
+		state->max_garbage = state->max_garbage?(state->max_garbage * 2):64;
+		state->garbage = realloc(state->garbage, sizeof(*state->garbage) * state->max_garbage);
+		assert(state->garbage);
+	}
+	state->garbage[state->num_garbage++] = n;
+}
+
+static struct avl_node * cow_clone(struct avl_tree * tree, struct avl_node * n)
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	for(int i = 0; i < state->num_fresh; ++i) if(state->fresh[i] == n) return n;
+	
+	struct avl_node * copy = node_new(tree);
+	assert(copy);
+	*copy = *n;
+	add_garbage(state, n);
+	
+	assert(state->num_fresh < (int)(sizeof(state->fresh) / sizeof(state->fresh[0])));
+	state->fresh[state->num_fresh++] = copy;
+	return copy;
+}
+
+/* same as avl_tree_balance(), but the child (and grandchild) that rotate are copied first.  */
+static int cow_balance(struct avl_tree * tree, struct avl_node **p)
+{
+	struct avl_node *n = *p;
+	int h0 = height_of(n->a[0]);
+	int h1 = height_of(n->a[1]);
+	if (h0 - h1 + 1u < 3u) {
+		int old = n->h;
+		n->h = h0<h1 ? h1+1 : h0+1;
+		return n->h - old;
+	}
+	int dir = h0<h1;
+	struct avl_node * y = cow_clone(tree, n->a[dir]);
+	n->a[dir] = y;
+	if (height_of(y->a[!dir]) > height_of(y->a[dir])) y->a[!dir] = cow_clone(tree, y->a[!dir]);
+	return avl_rot(p, n, dir);
+}
+
+/* rebuild the path bottom-up: nodes[0] is the root, nodes[j]->a[dirs[j]] is replaced by child.  */
+static struct avl_node * cow_rebuild_path(struct avl_tree * tree, 
+	struct avl_node ** nodes, const int * dirs, int depth, struct avl_node * child, 
+	int size_delta, const struct avl_node * replace, const void * replace_key)
+{
+	for(int j = depth - 1; j >= 0; --j) {
+		struct avl_node * copy = cow_clone(tree, nodes[j]);
+		copy->a[dirs[j]] = child;
+		copy->size += size_delta;
+		if(nodes[j] == replace) copy->key = replace_key;
+		cow_balance(tree, &copy);
+		child = copy;
+	}
+	return child;
+}
+
+static void cow_publish(struct avl_tree * tree, struct avl_node * root, const void * deleted_key)
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	__atomic_store_n(&tree->root, root, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	// readers that announced this epoch (or an older one) may still see the replaced nodes
+	long epoch = __atomic_load_n(&state->epoch, __ATOMIC_RELAXED);
+	for(size_t i = 0; i < state->num_garbage; ++i) retire(state, state->garbage[i], 0, epoch);
+	state->num_garbage = 0;
+	state->num_fresh = 0;
+	if(deleted_key) retire(state, (void *)deleted_key, 1, epoch);
+	__atomic_store_n(&state->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+	
+	reclaim(tree, 0);
+}
+
+static void * concurrent_add(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *))
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	struct avl_node * nodes[AVL_TREE_MAX_HEIGHT];
+	int dirs[AVL_TREE_MAX_HEIGHT];
+	int depth = 0;
+	
+	pthread_mutex_lock(&state->writer_mutex);
+	struct avl_node * n = tree->root;
+	while(n) {
+		int c = cmp(key, n->key);
+		if(0 == c) {
+			pthread_mutex_unlock(&state->writer_mutex);
+			return n;
+		}
+		nodes[depth] = n;
+		dirs[depth++] = (c > 0);
+		n = n->a[c > 0];
+	}
+	
+	struct avl_node * r = node_new(tree);
+	assert(r);
+	r->key = key;
+	r->a[0] = r->a[1] = NULL;
+	r->h = 1;
+	r->size = 1;
+	state->fresh[state->num_fresh++] = r;
+	
+	struct avl_node * root = cow_rebuild_path(tree, nodes, dirs, depth, r, 1, NULL, NULL);
+	++tree->count;
+	cow_publish(tree, root, NULL);
+	pthread_mutex_unlock(&state->writer_mutex);
+	return r;
+}
+
+static void * concurrent_del(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *))
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	struct avl_node * nodes[AVL_TREE_MAX_HEIGHT];
+	int dirs[AVL_TREE_MAX_HEIGHT];
+	int depth = 0;
+	
+	pthread_mutex_lock(&state->writer_mutex);
+	struct avl_node * n = tree->root;
+	while(n) {
+		int c = cmp(key, n->key);
+		if(0 == c) break;
+		nodes[depth] = n;
+		dirs[depth++] = (c > 0);
+		n = n->a[c > 0];
+	}
+	if(NULL == n) {
+		pthread_mutex_unlock(&state->writer_mutex);
+		return NULL;
+	}
+	
+	/* unlink the node itself, or its predecessor which then takes its place (key)  */
+	struct avl_node * deleted = n;
+	struct avl_node * child = NULL;
+	if(n->a[0]) {
+		nodes[depth] = n;
+		dirs[depth++] = 0;
+		n = n->a[0];
+		while(n->a[1]) {
+			nodes[depth] = n;
+			dirs[depth++] = 1;
+			n = n->a[1];
+		}
+		child = n->a[0];
+	}else {
+		child = n->a[1];
+	}
+	const void * deleted_key = deleted->key;
+	struct avl_node * root = cow_rebuild_path(tree, nodes, dirs, depth, child, -1, deleted, n->key);
+	add_garbage(state, n);	// the unlinked node
+	--tree->count;
+	cow_publish(tree, root, (tree->on_free_data)?deleted_key:NULL);
+	pthread_mutex_unlock(&state->writer_mutex);
+	return &tree->root;	// an arbitrary non-null pointer, like tdelete() on the root
+}
+
+static void concurrent_state_free(struct avl_tree * tree)
+{
+	struct avl_tree_concurrent * state = tree->concurrent;
+	assert(0 == state->num_retired);
+	free(state->retired);
+	free(state->garbage);
+	pthread_mutex_destroy(&state->writer_mutex);
+	free(state);
+	tree->concurrent = NULL;
+	tree->flags &= ~avl_tree_flag_concurrent;
+}
+
+avl_tree_t * avl_tree_init_concurrent(avl_tree_t * tree, void * user_data, struct avl_node_arena * arena)
+{
+	tree = avl_tree_init_with_arena(tree, user_data, arena);
+	struct avl_tree_concurrent * state = NULL;
+	int rc = posix_memalign((void **)&state, 64, sizeof(*state));
+	assert(0 == rc && state);
+	memset(state, 0, sizeof(*state));
+	
+	pthread_mutex_init(&state->writer_mutex, NULL);
+	state->epoch = 1;
+	tree->concurrent = state;
+	tree->flags |= avl_tree_flag_concurrent;
+	return tree;
+}
+
 avl_tree_t * avl_tree_init(avl_tree_t * tree, void * user_data)
+{
+	return avl_tree_init_with_arena(tree, user_data, NULL);
+}
+
+avl_tree_t * avl_tree_init_with_arena(avl_tree_t * tree, void * user_data, struct avl_node_arena * arena)
 {
 	if(NULL == tree) tree = calloc(1, sizeof(*tree));
 	assert(tree);
 	
 	tree->user_data = user_data;
+	tree->arena = arena;
 	return tree;
 }
 
+void avl_tree_enable_rank(avl_tree_t * tree)
+{
+	assert(tree);
+	assert(0 == tree->count && NULL == tree->root);
+	tree->flags |= avl_tree_flag_rank;
+}
+
+static void destroy_arena_nodes(struct avl_node_arena * arena, struct avl_node * r, void (*on_free_data)(void *))
+{
+	if (r == 0) return;
+	
+	destroy_arena_nodes(arena, r->a[0], on_free_data);
+	destroy_arena_nodes(arena, r->a[1], on_free_data);
+	
+	if (on_free_data) on_free_data((void *)r->key);
+	avl_node_arena_free(arena, r);
+}
+
 void avl_tree_cleanup(avl_tree_t * tree)
 {
-	avl_tree_destroy(tree->root, tree->on_free_data);
+	if(tree->concurrent) reclaim(tree, 1);	// there must be no readers anymore
+	
+	struct avl_node_arena * arena = tree->arena;
+	if(NULL == arena) {
+		avl_tree_destroy(tree->root, tree->on_free_data);
+	}else if(NULL == tree->on_free_data && arena->num_used == tree->count) {
+		avl_node_arena_reset(arena);	// no other tree is using the arena
+	}else {
+		destroy_arena_nodes(arena, tree->root, tree->on_free_data);
+	}
 	tree->count = 0;
 	tree->root = NULL;
 	
-	if(tree->stack) {
-		clib_stack_cleanup(tree->stack);
-		free(tree->stack);
-		tree->stack = NULL;
-	}
+	free(tree->iter);
+	tree->iter = NULL;
+	
+	if(tree->concurrent) concurrent_state_free(tree);
 }
 
-/* AVL tree height < 1.44*log2(nodes+2)-0.3, MAXH is a safe upper bound.  */
-#define AVL_TREE_MAX_HEIGHT (sizeof(void*)*8*3/2)
 void * avl_tree_add(struct avl_tree * tree, const void *key, int (*cmp)(const void *, const void *))
 {
 	assert(tree);
+	if(tree->concurrent) return concurrent_add(tree, key, cmp);
 	struct avl_node **rootp = &tree->root;
 	struct avl_node *n = *rootp;
 	
@@ -159,16 +620,20 @@ void * avl_tree_add(struct avl_tree * tree, const void *key, int (*cmp)(const vo
 		n = n->a[c>0];
 	}
 	
-	r = malloc(sizeof *r);
+	r = node_new(tree);
 	if (!r) return NULL;
 	
 	r->key = key;
 	r->a[0] = r->a[1] = 0;
 	r->h = 1;
+	r->size = 1;
 	
 	/* insert new node, rebalance ancestors.  */
 	*a[--i] = r;
 	++tree->count;
+	if(tree->flags & avl_tree_flag_rank) {
+		for(int k = 0; k < i; ++k) ++(*a[k])->size;
+	}
 	while (i && avl_tree_balance(a[--i]));
 	
 	// printf("add node %p, value=%d\n", r, *(int *)r->key); 
@@ -178,6 +643,7 @@ void * avl_tree_add(struct avl_tree * tree, const void *key, int (*cmp)(const vo
 void * avl_tree_del(struct avl_tree * tree, const void *restrict key, int (*cmp)(const void *, const void *))
 {
 	assert(tree);
+	if(tree->concurrent) return concurrent_del(tree, key, cmp);
 	struct avl_node ** rootp = &tree->root;
 	
 	struct avl_node **a[AVL_TREE_MAX_HEIGHT+1];
@@ -213,19 +679,20 @@ void * avl_tree_del(struct avl_tree * tree, const void *restrict key, int (*cmp)
 		child = n->a[1];
 	}
 	/* freed node has at most one child, move it up and rebalance.  */
-	free(n);
+	node_free(tree, n);
 	*a[--i] = child;
 	--tree->count;
+	if(tree->flags & avl_tree_flag_rank) {
+		for(int k = 1; k < i; ++k) --(*a[k])->size;
+	}
 	while (--i && avl_tree_balance(a[i]));
 	return parent;
 }
 
-#undef AVL_TREE_MAX_HEIGHT
-
 void *avl_tree_find(struct avl_tree * tree, const void *key, int (*cmp)(const void *, const void *))
 {
 	assert(tree);
-	struct avl_node * n = tree->root;
+	struct avl_node * n = load_root(tree);
 	
 	while(n) {
 		int rc = cmp(key, n->key);
@@ -235,6 +702,71 @@ void *avl_tree_find(struct avl_tree * tree, const void *key, int (*cmp)(const vo
 	return n;
 }
 
+struct avl_node * avl_tree_lower_bound(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *))
+{
+	struct avl_node * n = load_root(tree);
+	struct avl_node * result = NULL;
+	while(n) {
+		if(cmp(key, n->key) <= 0) {	// n->key >= key
+			result = n;
+			n = n->a[0];
+		}else {
+			n = n->a[1];
+		}
+	}
+	return result;
+}
+
+struct avl_node * avl_tree_upper_bound(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *))
+{
+	struct avl_node * n = load_root(tree);
+	struct avl_node * result = NULL;
+	while(n) {
+		if(cmp(key, n->key) < 0) {	// n->key > key
+			result = n;
+			n = n->a[0];
+		}else {
+			n = n->a[1];
+		}
+	}
+	return result;
+}
+
+ssize_t avl_tree_rank(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *))
+{
+	assert(tree->flags & avl_tree_flag_rank);
+	struct avl_node * n = load_root(tree);
+	ssize_t rank = 0;
+	while(n) {
+		if(cmp(key, n->key) <= 0) {
+			n = n->a[0];
+		}else {
+			rank += size_of(n->a[0]) + 1;
+			n = n->a[1];
+		}
+	}
+	return rank;
+}
+
+struct avl_node * avl_tree_select(struct avl_tree * tree, ssize_t index)
+{
+	assert(tree->flags & avl_tree_flag_rank);
+	// bound-check against the loaded root, tree->count may be changed by a concurrent writer
+	struct avl_node * n = load_root(tree);
+	if(index < 0 || index >= size_of(n)) return NULL;
+	while(n) {
+		ssize_t left_size = size_of(n->a[0]);
+		if(index == left_size) break;
+		if(index < left_size) {
+			n = n->a[0];
+		}else {
+			index -= left_size + 1;
+			n = n->a[1];
+		}
+	}
+	return n;
+}
+
 void avl_tree_destroy(struct avl_node *root, void (*on_free_data)(void *))
 {
 	struct avl_node *r = root;
@@ -267,151 +799,103 @@ void  avl_tree_traverse(struct avl_tree * tree,
 	void * user_data
 )
 {
-	walk(tree->root, on_traverse, 0, user_data);
+	walk(load_root(tree), on_traverse, 0, user_data);
 	return;
 }
 
 
-struct avl_tree_iter {
-	struct avl_node * n;
-	struct avl_tree_iter * parent;
-	VISIT which;
-};
-
-static struct avl_tree_iter * avl_tree_iter_new(struct avl_node * n, struct avl_tree_iter * parent)
+static inline void iter_push_spine(avl_tree_iter_t * iter, struct avl_node * n)
 {
-	struct avl_tree_iter * iter = calloc(1, sizeof(*iter));
-	assert(iter);
-	iter->n = n;
-	iter->parent = parent;
-	iter->which = preorder;
-	return iter;
+	const int dir = iter->reverse;	// 0: follow the left children, 1: the right ones
+	while(n) {
+		assert(iter->top < (int)AVL_TREE_MAX_HEIGHT);
+		iter->stack[iter->top++] = n;
+		n = n->a[dir];
+	}
 }
 
-static void avl_tree_iter_free(struct avl_tree_iter * iter)
+avl_tree_iter_t * avl_tree_iter_init(avl_tree_iter_t * iter, struct avl_tree * tree, int reverse)
 {
-	free(iter);
-	return;
+	if(NULL == iter) iter = malloc(sizeof(*iter));
+	assert(iter);
+	
+	iter->tree = tree;
+	iter->reverse = (reverse != 0);
+	iter->top = 0;
+	iter->last_key = NULL;
+	iter->cmp = NULL;
+	iter_push_spine(iter, load_root(tree));
+	return iter;
 }
 
-static inline struct avl_node * get_next_iter(clib_stack_t * stack)
+avl_tree_iter_t * avl_tree_iter_init_range(avl_tree_iter_t * iter, struct avl_tree * tree, 
+	const void * first_key, const void * last_key, 
+	int (*cmp)(const void *, const void *))
 {
-	// printf("=== %s()...\n", __FUNCTION__);
-	assert(stack);
-	
-	if(NULL == stack->top) return NULL;
-	
-	struct avl_tree_iter * current = NULL;
-	struct avl_node * r = NULL;
-	while(stack->top)
-	{
-		current = clib_node_get_data(stack->top);
-		if(NULL == current) return NULL;
-		struct avl_tree_iter * child = NULL;
-		
-		r = current->n;
-		if(NULL == r) {
-			current = stack->pop(stack);
-			avl_tree_iter_free(current);
-			continue;
-		}
-		//~ printf("\tcurrent: %p, which=%d, r=%p(%d), a[0]=(%d), a[1]=(%d), r->h=%d\n", 
-			//~ current, current->which, 
-			//~ r, *(int *)r->key,
-			//~ r->a[0]?*(int *)r->a[0]->key:-1,
-			//~ r->a[1]?*(int *)r->a[1]->key:-1,
-			//~ r->h);
-		
-		if(r->h == 1) {
-			current->which = leaf;
-		}
-		
-		switch(current->which)
-		{
-		case leaf: 
-			current = stack->pop(stack);
-			if(current->parent) {
-				++current->parent->which;
-			}
-			avl_tree_iter_free(current);
-			//~ printf("\t-- leaf: push back parent: %p\n", parent);
-			//~ if(parent) {
-				//~ parent->which++;
-				//~ stack->push(stack, parent);
-			//~ }
-			return r;
+	if(NULL == first_key) iter = avl_tree_iter_init(iter, tree, 0);
+	else {
+		if(NULL == iter) iter = malloc(sizeof(*iter));
+		assert(iter);
+		iter->tree = tree;
+		iter->reverse = 0;
+		iter->top = 0;
 		
-		case preorder:
-			if(r->a[0]) {
-				child = avl_tree_iter_new(r->a[0], current);
-				stack->push(stack, child);
-				continue;
+		// keep the ancestors that are >= first_key: exactly the pending nodes of an in-order walk starting at lower_bound
+		struct avl_node * n = load_root(tree);
+		while(n) {
+			if(cmp(first_key, n->key) <= 0) {
+				assert(iter->top < (int)AVL_TREE_MAX_HEIGHT);
+				iter->stack[iter->top++] = n;
+				n = n->a[0];
+			}else {
+				n = n->a[1];
 			}
-			++current->which;
-		case postorder:
-			if(r->a[1]){
-				child = avl_tree_iter_new(r->a[1], current);
-				stack->push(stack, child);
-				return r;
-			}
-			++current->which;
-			current= stack->pop(stack);
-			if(current->parent) {
-				++current->parent->which;
-			}
-			avl_tree_iter_free(current);
-			return r;
-		case endorder:
-			current= stack->pop(stack);
-			if(current->parent) {
-				++current->parent->which;
-			}
-			avl_tree_iter_free(current);
-			break;
-		default:
-			assert(current->which >= preorder);
-			assert(current->which <= leaf);
 		}
 	}
-	return NULL;
+	iter->last_key = last_key;
+	iter->cmp = cmp;
+	return iter;
 }
 
-struct avl_node * avl_tree_iter_begin(struct avl_tree * tree)
+struct avl_node * avl_tree_iter_get_next(avl_tree_iter_t * iter)
 {
-	if(NULL == tree->root) return NULL;
-	
-	clib_stack_t * stack = tree->stack;
-	if(NULL == stack) {
-		stack = clib_stack_init(NULL);
-		assert(stack);
-		
-		tree->stack = stack;
+	if(iter->top <= 0) return NULL;
+	struct avl_node * n = iter->stack[iter->top - 1];
+	if(iter->last_key && iter->cmp(n->key, iter->last_key) >= 0) {	// out of range
+		iter->top = 0;
+		return NULL;
 	}
-	assert(stack);
-	clib_stack_cleanup(stack);
-	
-	struct avl_tree_iter * current = avl_tree_iter_new(tree->root, NULL);
-	assert(current);
-	
-	stack->push(stack, current);
-	return get_next_iter(stack);
+	--iter->top;
+	iter_push_spine(iter, n->a[!iter->reverse]);
+	return n;
 }
 
-struct avl_node * avl_tree_iter_next(struct avl_tree * tree)
+struct avl_node * avl_tree_iter_begin(struct avl_tree * tree)
 {
-	clib_stack_t * stack = tree->stack;
-	if(NULL == stack) return avl_tree_iter_begin(tree);
-	
-	return get_next_iter(stack);
+	tree->iter = avl_tree_iter_init(tree->iter, tree, 0);
+	return avl_tree_iter_get_next(tree->iter);
 }
 
+struct avl_node * avl_tree_iter_next(struct avl_tree * tree)
+{
+	if(NULL == tree->iter) return avl_tree_iter_begin(tree);
+	return avl_tree_iter_get_next(tree->iter);
+}
 
-#undef AVL_TREE_MAX_HEIGHT
 
 /******************************************************
  * TEST Module
  *****************************************************/
 #if defined(_TEST_AVL_TREE) && defined(_STAND_ALONE)
+#include <limits.h>
+#include <unistd.h>
+#include "app_timer.h"
+static int bench_iterator(long num_nodes);
+static int bench_arena(long num_nodes, int rounds);
+static int test_bounds_and_rank(long num_nodes);
+static int test_concurrent(long num_nodes);
+static int check_sizes(const struct avl_node * n);
+static int bench_concurrent(long num_keys, int max_readers, long ops_per_reader);
 
 struct sort_context
 {
@@ -474,18 +958,451 @@ int main(int argc, char **argv)
 	int i = 0;
 	while(node)
 	{
-		printf("node %d(%p): value=%d\n", i++, node, *(int *)node->key);
+		printf("node %d(%p): value=%d\n", i, node, *(int *)node->key);
+		assert(sorted[i] == *(int *)node->key);
+		++i;
 		node = avl_tree_iter_next(tree); 
 		
-		clib_stack_t * stack = tree->stack;
-		assert(stack);
-		printf("-------- stack.count: %d, top=%p\n", (int)stack->count, stack->top);
+		printf("-------- iter.top: %d\n", tree->iter->top);
 		
 		if(i > 10) break;
 	}
+	assert(i == N);
+	
+	// two external iterators at once, in opposite directions
+	avl_tree_iter_t forward[1], backward[1];
+	avl_tree_iter_init(forward, tree, 0);
+	avl_tree_iter_init(backward, tree, 1);
+	for(i = 0; i < N; ++i) {
+		struct avl_node * first = avl_tree_iter_get_next(forward);
+		struct avl_node * last = avl_tree_iter_get_next(backward);
+		assert(first && last);
+		assert(sorted[i] == *(int *)first->key);
+		assert(sorted[N - 1 - i] == *(int *)last->key);
+	}
+	assert(NULL == avl_tree_iter_get_next(forward) && NULL == avl_tree_iter_get_next(backward));
 	
 	avl_tree_cleanup(tree);
+
+	// arena: deleted nodes are recycled, cleanup rewinds the arena
+	struct avl_node_arena arena[1];
+	avl_node_arena_init(arena, 4);
+	avl_tree_init_with_arena(tree, NULL, arena);
+	for(i = 0; i < N; ++i) avl_tree_add(tree, &a[i], on_compare);
+	assert(arena->num_used == N && arena->num_chunks == (N + 3) / 4);
+	for(i = 0; i < N; i += 2) avl_tree_del(tree, &a[i], on_compare);
+	assert(arena->num_used == N / 2);
+	for(i = 0; i < N; i += 2) avl_tree_add(tree, &a[i], on_compare);
+	assert(arena->num_used == N && arena->num_chunks == (N + 3) / 4);
+	avl_tree_iter_init(forward, tree, 0);
+	for(i = 0; i < N; ++i) assert(sorted[i] == *(int *)avl_tree_iter_get_next(forward)->key);
+	avl_tree_cleanup(tree);
+	assert(0 == arena->num_used && NULL == arena->free_list);
+	avl_node_arena_cleanup(arena);
 #undef N
+	
+	long num_nodes = 1000000;
+	int rounds = 5;
+	if(argc > 1) num_nodes = atol(argv[1]);
+	if(argc > 2) rounds = atoi(argv[2]);
+	test_bounds_and_rank(10000);
+	test_concurrent(10000);
+	bench_iterator(num_nodes);
+	bench_arena(num_nodes, rounds);
+	bench_concurrent(100000, 8, 1000000);
+	return 0;
+}
+
+static void check_order(avl_tree_t * tree)
+{
+	avl_tree_iter_t iter[1];
+	avl_tree_iter_init(iter, tree, 0);
+	struct avl_node * node = NULL, * prev = NULL;
+	ssize_t count = 0;
+	while((node = avl_tree_iter_get_next(iter))) {
+		if(prev) assert(*(int *)prev->key < *(int *)node->key);
+		prev = node;
+		++count;
+	}
+	assert(count == tree->count);
+}
+
+/*
+ * concurrent mode: same content as a plain tree after random adds / dels,
+ * then readers check the stable keys while a writer churns the others.
+ */
+struct concurrent_test_context
+{
+	avl_tree_t * tree;
+	int * values;
+	long num_nodes;
+	int quit;
+	long num_reads;
+};
+
+static void * concurrent_reader(void * user_data)
+{
+	struct concurrent_test_context * ctx = user_data;
+	unsigned int seed = (unsigned int)(long)pthread_self();
+	while(!__atomic_load_n(&ctx->quit, __ATOMIC_RELAXED)) {
+		int key = (rand_r(&seed) % ctx->num_nodes) * 2;	// even keys are never deleted
+		avl_tree_read_lock(ctx->tree);
+		struct avl_node * node = avl_tree_find(ctx->tree, &key, on_compare);
+		assert(node && *(int *)node->key == key);
+		avl_tree_read_unlock(ctx->tree);
+		__atomic_add_fetch(&ctx->num_reads, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int test_concurrent(long num_nodes)
+{
+	printf("\n== TEST %s(%ld) ==\n", __FUNCTION__, num_nodes);
+	int * values = malloc(sizeof(*values) * num_nodes * 2);
+	assert(values);
+	for(long i = 0; i < num_nodes * 2; ++i) values[i] = (int)i;
+	
+	avl_tree_t plain[1], tree[1];
+	memset(plain, 0, sizeof(plain));
+	memset(tree, 0, sizeof(tree));
+	avl_tree_init(plain, NULL);
+	avl_tree_init_concurrent(tree, NULL, NULL);
+	avl_tree_enable_rank(plain);
+	avl_tree_enable_rank(tree);
+	
+	srand(3);
+	for(long i = 0; i < num_nodes * 4; ++i) {
+		int * key = &values[rand() % (num_nodes * 2)];
+		if(rand() % 3) {
+			void * p = avl_tree_add(plain, key, on_compare);
+			void * q = avl_tree_add(tree, key, on_compare);
+			assert(avl_node_get_data(p) == avl_node_get_data(q));
+		}else {
+			assert((NULL == avl_tree_del(plain, key, on_compare)) == (NULL == avl_tree_del(tree, key, on_compare)));
+		}
+	}
+	assert(plain->count == tree->count);
+	assert(check_sizes(tree->root) == tree->count);
+	check_order(tree);
+	for(ssize_t i = 0; i < tree->count; ++i) {
+		assert(avl_tree_select(plain, i)->key == avl_tree_select(tree, i)->key);
+	}
+	avl_tree_cleanup(plain);
+	avl_tree_cleanup(tree);
+	
+	// stress
+	struct avl_node_arena arena[1];
+	avl_node_arena_init(arena, 0);
+	avl_tree_init_concurrent(tree, NULL, arena);
+	for(long i = 0; i < num_nodes; ++i) avl_tree_add(tree, &values[i * 2], on_compare);
+	
+	struct concurrent_test_context ctx = { .tree = tree, .values = values, .num_nodes = num_nodes };
+	pthread_t readers[4];
+	for(int i = 0; i < 4; ++i) pthread_create(&readers[i], NULL, concurrent_reader, &ctx);
+	for(long round = 0; round < 10; ++round) {
+		for(long i = 0; i < num_nodes; ++i) avl_tree_add(tree, &values[i * 2 + 1], on_compare);
+		for(long i = 0; i < num_nodes; ++i) assert(avl_tree_del(tree, &values[i * 2 + 1], on_compare));
+	}
+	__atomic_store_n(&ctx.quit, 1, __ATOMIC_RELAXED);
+	for(int i = 0; i < 4; ++i) pthread_join(readers[i], NULL);
+	
+	assert(tree->count == num_nodes);
+	check_order(tree);
+	avl_tree_cleanup(tree);
+	assert(0 == arena->num_used);
+	avl_node_arena_cleanup(arena);
+	free(values);
+	printf("stress: %ld reads during 10 rounds of add / del\n", ctx.num_reads);
+	return 0;
+}
+
+/*
+ * read-mostly contention: num_readers threads look up random keys while one writer updates at ~1% of the read rate
+ */
+enum { lock_mode_concurrent, lock_mode_mutex, lock_mode_rwlock };
+struct bench_context
+{
+	avl_tree_t * tree;
+	int * values;
+	long num_keys;
+	long ops_per_reader;
+	int mode;
+	pthread_mutex_t mutex;
+	pthread_rwlock_t rwlock;
+	int quit;
+};
+
+static void * bench_reader(void * user_data)
+{
+	struct bench_context * ctx = user_data;
+	unsigned int seed = (unsigned int)(long)pthread_self();
+	long hits = 0;
+	for(long i = 0; i < ctx->ops_per_reader; ++i) {
+		int key = (rand_r(&seed) % ctx->num_keys) * 2;
+		switch(ctx->mode) {
+		case lock_mode_concurrent: 
+			avl_tree_read_lock(ctx->tree);
+			hits += (NULL != avl_tree_find(ctx->tree, &key, on_compare));
+			avl_tree_read_unlock(ctx->tree);
+			break;
+		case lock_mode_mutex:
+			pthread_mutex_lock(&ctx->mutex);
+			hits += (NULL != avl_tree_find(ctx->tree, &key, on_compare));
+			pthread_mutex_unlock(&ctx->mutex);
+			break;
+		default:
+			pthread_rwlock_rdlock(&ctx->rwlock);
+			hits += (NULL != avl_tree_find(ctx->tree, &key, on_compare));
+			pthread_rwlock_unlock(&ctx->rwlock);
+			break;
+		}
+	}
+	assert(hits == ctx->ops_per_reader);
+	return NULL;
+}
+
+static void * bench_writer(void * user_data)
+{
+	struct bench_context * ctx = user_data;
+	long i = 0;
+	while(!__atomic_load_n(&ctx->quit, __ATOMIC_RELAXED)) {
+		int * key = &ctx->values[(i++ % ctx->num_keys) * 2 + 1];	// odd keys only
+		for(int del = 0; del < 2; ++del) {
+			if(ctx->mode == lock_mode_mutex) pthread_mutex_lock(&ctx->mutex);
+			else if(ctx->mode == lock_mode_rwlock) pthread_rwlock_wrlock(&ctx->rwlock);
+			
+			if(del) avl_tree_del(ctx->tree, key, on_compare);
+			else avl_tree_add(ctx->tree, key, on_compare);
+			
+			if(ctx->mode == lock_mode_mutex) pthread_mutex_unlock(&ctx->mutex);
+			else if(ctx->mode == lock_mode_rwlock) pthread_rwlock_unlock(&ctx->rwlock);
+		}
+		usleep(100);
+	}
+	return NULL;
+}
+
+static int bench_concurrent(long num_keys, int max_readers, long ops_per_reader)
+{
+	printf("\n== benchmark: read-mostly, %ld keys, %ld lookups per reader, 1 writer ==\n", num_keys, ops_per_reader);
+	printf("%-8s %16s %16s %16s\n", "readers", "concurrent(Mops)", "mutex(Mops)", "rwlock(Mops)");
+	
+	int * values = malloc(sizeof(*values) * num_keys * 2);
+	assert(values);
+	for(long i = 0; i < num_keys * 2; ++i) values[i] = (int)i;
+	
+	for(int num_readers = 1; num_readers <= max_readers; num_readers *= 2) {
+		double mops[3] = { 0 };
+		for(int mode = 0; mode < 3; ++mode) {
+			avl_tree_t tree[1];
+			memset(tree, 0, sizeof(tree));
+			if(mode == lock_mode_concurrent) avl_tree_init_concurrent(tree, NULL, NULL);
+			else avl_tree_init(tree, NULL);
+			for(long i = 0; i < num_keys; ++i) avl_tree_add(tree, &values[i * 2], on_compare);
+			
+			struct bench_context ctx = { 
+				.tree = tree, .values = values, .num_keys = num_keys, 
+				.ops_per_reader = ops_per_reader, .mode = mode, 
+			};
+			pthread_mutex_init(&ctx.mutex, NULL);
+			pthread_rwlock_init(&ctx.rwlock, NULL);
+			
+			pthread_t writer, readers[num_readers];
+			app_timer_t timer[1];
+			pthread_create(&writer, NULL, bench_writer, &ctx);
+			app_timer_start(timer);
+			for(int i = 0; i < num_readers; ++i) pthread_create(&readers[i], NULL, bench_reader, &ctx);
+			for(int i = 0; i < num_readers; ++i) pthread_join(readers[i], NULL);
+			double time_cost = app_timer_stop(timer);
+			__atomic_store_n(&ctx.quit, 1, __ATOMIC_RELAXED);
+			pthread_join(writer, NULL);
+			
+			mops[mode] = (double)ops_per_reader * num_readers / time_cost / 1000000.0;
+			pthread_rwlock_destroy(&ctx.rwlock);
+			pthread_mutex_destroy(&ctx.mutex);
+			avl_tree_cleanup(tree);
+		}
+		printf("%-8d %16.2f %16.2f %16.2f\n", num_readers, mops[0], mops[1], mops[2]);
+	}
+	free(values);
+	return 0;
+}
+
+static int check_sizes(const struct avl_node * n)
+{
+	if(NULL == n) return 0;
+	int size = check_sizes(n->a[0]) + check_sizes(n->a[1]) + 1;
+	assert(size == n->size);
+	return size;
+}
+
+static int test_bounds_and_rank(long num_nodes)
+{
+	printf("\n== TEST %s(%ld) ==\n", __FUNCTION__, num_nodes);
+	// even values [0, 2 * num_nodes), inserted in random order, then every 4th one deleted
+	int * values = malloc(sizeof(*values) * num_nodes);
+	assert(values);
+	for(long i = 0; i < num_nodes; ++i) values[i] = (int)(i * 2);
+	srand(1);
+	for(long i = num_nodes - 1; i > 0; --i) {
+		long j = rand() % (i + 1);
+		int tmp = values[i]; values[i] = values[j]; values[j] = tmp;
+	}
+	
+	avl_tree_t tree[1];
+	memset(tree, 0, sizeof(tree));
+	avl_tree_init(tree, NULL);
+	avl_tree_enable_rank(tree);
+	for(long i = 0; i < num_nodes; ++i) avl_tree_add(tree, &values[i], on_compare);
+	for(long i = 0; i < num_nodes; ++i) {
+		if(values[i] % 8 == 0) avl_tree_del(tree, &values[i], on_compare);
+	}
+	assert(check_sizes(tree->root) == tree->count);
+	
+	// the expected content, sorted
+	long count = 0;
+	int * expected = malloc(sizeof(*expected) * num_nodes);
+	assert(expected);
+	for(int v = 0; v < num_nodes * 2; v += 2) if(v % 8) expected[count++] = v;
+	assert(count == tree->count);
+	
+	for(long i = 0; i < count; ++i) {
+		assert(expected[i] == *(int *)avl_tree_select(tree, i)->key);
+		assert(i == avl_tree_rank(tree, &expected[i], on_compare));
+	}
+	assert(NULL == avl_tree_select(tree, count));
+	
+	long k = 0;
+	for(int key = -1; key <= num_nodes * 2; ++key) {
+		while(k < count && expected[k] < key) ++k;	// expected[k]: lower bound
+		struct avl_node * lower = avl_tree_lower_bound(tree, &key, on_compare);
+		struct avl_node * upper = avl_tree_upper_bound(tree, &key, on_compare);
+		long u = (k < count && expected[k] == key)?(k + 1):k;
+		assert((k < count)?(lower && expected[k] == *(int *)lower->key):(NULL == lower));
+		assert((u < count)?(upper && expected[u] == *(int *)upper->key):(NULL == upper));
+		assert(k == avl_tree_rank(tree, &key, on_compare));
+	}
+	
+	// range [first, last)
+	int first = (int)num_nodes / 3, last = (int)num_nodes;
+	avl_tree_iter_t iter[1];
+	avl_tree_iter_init_range(iter, tree, &first, &last, on_compare);
+	long num_in_range = 0;
+	k = avl_tree_rank(tree, &first, on_compare);
+	struct avl_node * node = NULL;
+	while((node = avl_tree_iter_get_next(iter))) {
+		assert(expected[k++] == *(int *)node->key);
+		++num_in_range;
+	}
+	assert(num_in_range == avl_tree_rank(tree, &last, on_compare) - avl_tree_rank(tree, &first, on_compare));
+	printf("count=%ld, range [%d, %d): %ld nodes\n", count, first, last, num_in_range);
+	
+	avl_tree_cleanup(tree);
+	free(expected);
+	free(values);
+	return 0;
+}
+
+/*
+ * build and tear down a tree of num_nodes, with malloc'ed nodes and with an arena
+ */
+static int bench_arena(long num_nodes, int rounds)
+{
+	int * values = malloc(sizeof(*values) * num_nodes);
+	assert(values);
+	srand(12345);
+	for(long i = 0; i < num_nodes; ++i) values[i] = rand();
+	
+	printf("\n== benchmark: build / cleanup %ld nodes x %d rounds ==\n", num_nodes, rounds);
+	printf("%-10s %12s %12s\n", "allocator", "build(ms)", "cleanup(ms)");
+	
+	struct avl_node_arena arena[1];
+	avl_node_arena_init(arena, 0);
+	for(int use_arena = 0; use_arena < 2; ++use_arena) {
+		double build_cost = 0, cleanup_cost = 0;
+		for(int r = 0; r < rounds; ++r) {
+			app_timer_t timer[1];
+			avl_tree_t tree[1];
+			memset(tree, 0, sizeof(tree));
+			avl_tree_init_with_arena(tree, NULL, use_arena?arena:NULL);
+			
+			app_timer_start(timer);
+			for(long i = 0; i < num_nodes; ++i) avl_tree_add(tree, &values[i], on_compare);
+			build_cost += app_timer_stop(timer);
+			
+			app_timer_start(timer);
+			avl_tree_cleanup(tree);
+			cleanup_cost += app_timer_stop(timer);
+		}
+		printf("%-10s %12.3f %12.3f\n", use_arena?"arena":"malloc", build_cost * 1000.0 / rounds, cleanup_cost * 1000.0 / rounds);
+	}
+	avl_node_arena_cleanup(arena);
+	free(values);
+	return 0;
+}
+
+/*
+ * iterate over num_nodes random ints: twalk() callbacks vs. the inline-stack iterator
+ */
+static void sum_callback(const struct avl_node * nodep, const VISIT which, const int depth, void * user_data)
+{
+	if(which == postorder || which == leaf) *(long *)user_data += *(int *)nodep->key;
+}
+
+static int bench_iterator(long num_nodes)
+{
+	int * values = malloc(sizeof(*values) * num_nodes);
+	assert(values);
+	srand(12345);
+	for(long i = 0; i < num_nodes; ++i) values[i] = rand();
+	
+	avl_tree_t tree[1];
+	memset(tree, 0, sizeof(tree));
+	avl_tree_init(tree, NULL);
+	for(long i = 0; i < num_nodes; ++i) avl_tree_add(tree, &values[i], on_compare);
+	printf("\n== benchmark: iterate over %ld nodes ==\n", (long)tree->count);
+	
+	app_timer_t timer[1];
+	long sum[3] = { 0 };
+	double time_cost[3] = { 0 };
+	
+	app_timer_start(timer);
+	avl_tree_traverse(tree, sum_callback, &sum[0]);
+	time_cost[0] = app_timer_stop(timer);
+	
+	avl_tree_iter_t iter[1];
+	for(int reverse = 0; reverse < 2; ++reverse) {
+		int prev = reverse?INT_MAX:INT_MIN;
+		app_timer_start(timer);
+		avl_tree_iter_init(iter, tree, reverse);
+		struct avl_node * node = NULL;
+		while((node = avl_tree_iter_get_next(iter))) {
+			int value = *(int *)node->key;
+			assert(reverse?(value <= prev):(value >= prev));
+			prev = value;
+			sum[1 + reverse] += value;
+		}
+		time_cost[1 + reverse] = app_timer_stop(timer);
+	}
+	assert(sum[0] == sum[1] && sum[0] == sum[2]);
+	
+	printf("%-16s %12s %14s\n", "method", "time(ms)", "ns/node");
+	static const char * methods[3] = { "traverse", "iter", "iter(reverse)" };
+	for(int i = 0; i < 3; ++i) {
+		printf("%-16s %12.3f %14.2f\n", methods[i], time_cost[i] * 1000.0, time_cost[i] * 1e9 / tree->count);
+	}
+	
+	// range scan over ~1% of the keys, in the middle
+	int first = RAND_MAX / 2, last = first + RAND_MAX / 100;
+	long num_in_range = 0;
+	app_timer_start(timer);
+	avl_tree_iter_init_range(iter, tree, &first, &last, on_compare);
+	while(avl_tree_iter_get_next(iter)) ++num_in_range;
+	double range_cost = app_timer_stop(timer);
+	printf("%-16s %12.3f %14.2f (%ld nodes)\n", "range(1%)", range_cost * 1000.0, range_cost * 1e9 / (num_in_range?num_in_range:1), num_in_range);
+	
+	avl_tree_cleanup(tree);
+	free(values);
 	return 0;
 }
 #endif
@@ -22,26 +22,121 @@ struct avl_node;
 #define avl_node_get_data(node) *(void **)(node)
 typedef void (* avl_tree_traverse_callback_fn)(const struct avl_node * nodep, const VISIT which, const int depth, void * user_data);
 
+/*
+ * struct avl_node_arena
+ * @brief bump-allocates avl_nodes from large chunks, deleted nodes go to a freelist.
+ *   Can be shared by several trees of the same thread. 
+ *   avl_tree_cleanup() of the only tree using an arena just rewinds it instead of freeing node by node.
+ */
+#define AVL_NODE_ARENA_DEFAULT_CHUNK_SIZE (4096)
+struct avl_node_chunk;
+struct avl_node_arena
+{
+	size_t nodes_per_chunk;
+	struct avl_node_chunk * chunks;
+	struct avl_node_chunk * current;	// the chunk being bump-allocated
+	struct avl_node * free_list;
+	
+	long num_chunks;
+	long num_used;	// nodes currently in use
+};
+struct avl_node_arena * avl_node_arena_init(struct avl_node_arena * arena, size_t nodes_per_chunk);
+void avl_node_arena_reset(struct avl_node_arena * arena);	// release all nodes, keep the chunks
+void avl_node_arena_cleanup(struct avl_node_arena * arena);
+
+enum avl_tree_flags
+{
+	avl_tree_flag_rank = 1,	// maintain subtree sizes for avl_tree_rank() / avl_tree_select(), see avl_tree_enable_rank()
+	avl_tree_flag_concurrent = 2,	// set by avl_tree_init_concurrent()
+};
+
 typedef struct avl_tree
 {
 	struct avl_node * root;
 	void * user_data;
 	ssize_t count;
+	int flags;
 	void (* on_free_data)(void * data);
+	struct avl_node_arena * arena;	// nullable, not owned. NULL: malloc() / free() every node
 	
-	// priv
-	void * stack;
+	// priv: the iterator used by avl_tree_iter_begin() / avl_tree_iter_next()
+	struct avl_tree_iter * iter;
+	struct avl_tree_concurrent * concurrent;
 }avl_tree_t;
 
 avl_tree_t * avl_tree_init(avl_tree_t * tree, void * user_data);
+avl_tree_t * avl_tree_init_with_arena(avl_tree_t * tree, void * user_data, struct avl_node_arena * arena);
+// set avl_tree_flag_rank, the tree must be empty (existing nodes have no subtree sizes)
+void avl_tree_enable_rank(avl_tree_t * tree);
+
+/*
+ * concurrent mode
+ *   avl_tree_add() / avl_tree_del() can be called from any thread, they are serialized by an internal mutex.
+ *   Published nodes are never modified: a write copies the path to the change and swaps the root atomically.
+ *   Readers take no lock: wrap every find / bound / iteration (and the use of the returned nodes) 
+ *   in avl_tree_read_lock() / avl_tree_read_unlock(), which only announce the reader's epoch.
+ *   Replaced nodes (and keys deleted while on_free_data is set) are released once no reader can see them,
+ *   so the node returned by avl_tree_add() is only guaranteed to stay valid inside a read-side section.
+ *   The per-tree iterator of avl_tree_iter_begin() / next() is not thread-safe, use avl_tree_iter_t.
+ *   avl_tree_cleanup() ends the concurrent mode, no reader may be active.
+ */
+avl_tree_t * avl_tree_init_concurrent(avl_tree_t * tree, void * user_data, struct avl_node_arena * arena);
+void avl_tree_read_lock(avl_tree_t * tree);	// not re-entrant, up to 256 live reader threads per process
+void avl_tree_read_unlock(avl_tree_t * tree);
 void avl_tree_cleanup(avl_tree_t * tree);
 
 void * avl_tree_add(struct avl_tree * tree, const void *key, int (*cmp)(const void *, const void *));	// tsearch, 
 void * avl_tree_del(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *));	// tdelete
 void * avl_tree_find(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *));	// tfind
 void avl_tree_traverse(struct avl_tree * tree, avl_tree_traverse_callback_fn on_traverse, void * user_data);					// twalk
-void avl_tree_destroy(struct avl_node *root, void (*on_free_data)(void *));	// tdestroy
 
+// the first node whose key is >= key (lower_bound) / > key (upper_bound), NULL if none
+struct avl_node * avl_tree_lower_bound(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *));
+struct avl_node * avl_tree_upper_bound(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *));
+// requires avl_tree_flag_rank, O(log n). rank: number of keys < key; select: the node at the 0-based in-order index
+ssize_t avl_tree_rank(struct avl_tree * tree, const void * key, int (*cmp)(const void *, const void *));
+struct avl_node * avl_tree_select(struct avl_tree * tree, ssize_t index);
+
+void avl_tree_destroy(struct avl_node *root, void (*on_free_data)(void *));	// tdestroy, only for trees without an arena
+
+/*
+ * avl_tree_iter_t: external in-order iterator
+ *   the path to the current node is kept in a fixed-size inline stack, no allocation at all.
+ *   Several iterators can walk the same tree at once, but any add / del invalidates them.
+ * 
+ *   avl_tree_iter_t iter[1];
+ *   avl_tree_iter_init(iter, tree, 0);
+ *   for(struct avl_node * node = avl_tree_iter_get_next(iter); node; node = avl_tree_iter_get_next(iter)) { ... }
+ */
+/* AVL tree height < 1.44*log2(nodes+2)-0.3, MAXH is a safe upper bound.  */
+#define AVL_TREE_MAX_HEIGHT (sizeof(void*)*8*3/2)
+typedef struct avl_tree_iter
+{
+	struct avl_tree * tree;
+	int reverse;	// 1: descending order
+	int top;
+	struct avl_node * stack[AVL_TREE_MAX_HEIGHT];
+	
+	// range
+	const void * last_key;	// nullable
+	int (*cmp)(const void *, const void *);
+}avl_tree_iter_t;
+avl_tree_iter_t * avl_tree_iter_init(avl_tree_iter_t * iter, struct avl_tree * tree, int reverse);
+/*
+ * avl_tree_iter_init_range()
+ * @brief ascending iteration over [first_key, last_key), O(log n) to position.
+ *     NULL first_key: from the smallest key, NULL last_key: up to the largest one.
+ *     e.g. keys with the prefix "X-": first_key = "X-", last_key = "X." 
+ */
+avl_tree_iter_t * avl_tree_iter_init_range(avl_tree_iter_t * iter, struct avl_tree * tree, 
+	const void * first_key, const void * last_key, 
+	int (*cmp)(const void *, const void *));
+struct avl_node * avl_tree_iter_get_next(avl_tree_iter_t * iter);
+
+/*
+ * avl_tree_iter_begin() / avl_tree_iter_next()
+ * @brief iterate with the tree's own iterator, one iteration at a time per tree.
+ */
 struct avl_node * avl_tree_iter_begin(struct avl_tree * tree);
 struct avl_node * avl_tree_iter_next(struct avl_tree * tree);
 
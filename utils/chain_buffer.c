@@ -0,0 +1,406 @@
+/*
+ * chain_buffer.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "chain_buffer.h"
+
+/*************************************
+ * chain_buffer_pool
+ ************************************/
+struct chain_buffer_pool * chain_buffer_pool_init(struct chain_buffer_pool * pool, size_t chunk_size, size_t max_free)
+{
+	if(NULL == pool) pool = calloc(1, sizeof(*pool));
+	else memset(pool, 0, sizeof(*pool));
+	assert(pool);
+
+	if(0 == chunk_size) chunk_size = CHAIN_BUFFER_DEFAULT_CHUNK_SIZE;
+	pool->chunk_size = chunk_size;
+	pool->max_free = max_free;
+	pthread_mutex_init(&pool->mutex, NULL);
+	return pool;
+}
+
+void chain_buffer_pool_cleanup(struct chain_buffer_pool * pool)
+{
+	if(NULL == pool) return;
+	struct chain_buffer_chunk * chunk = pool->free_list;
+	while(chunk) {
+		struct chain_buffer_chunk * next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	pool->free_list = NULL;
+	pool->num_free = 0;
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+static struct chain_buffer_pool s_default_pool[1] = {{
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.chunk_size = CHAIN_BUFFER_DEFAULT_CHUNK_SIZE,
+	.max_free = 1024,
+}};
+struct chain_buffer_pool * chain_buffer_pool_get_default(void)
+{
+	return s_default_pool;
+}
+
+static struct chain_buffer_chunk * chunk_new(struct chain_buffer_pool * pool)
+{
+	pthread_mutex_lock(&pool->mutex);
+	struct chain_buffer_chunk * chunk = pool->free_list;
+	if(chunk) {
+		pool->free_list = chunk->next;
+		--pool->num_free;
+		++pool->num_reuses;
+	}else ++pool->num_allocs;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if(NULL == chunk) {
+		chunk = malloc(sizeof(*chunk) + pool->chunk_size);
+		assert(chunk);
+		chunk->size = pool->chunk_size;
+	}
+	chunk->next = NULL;
+	chunk->start_pos = 0;
+	chunk->length = 0;
+	return chunk;
+}
+
+static void chunk_free(struct chain_buffer_pool * pool, struct chain_buffer_chunk * chunk)
+{
+	if(chunk->size == pool->chunk_size) {	// not a flattened block
+		pthread_mutex_lock(&pool->mutex);
+		if(pool->num_free < pool->max_free) {
+			chunk->next = pool->free_list;
+			pool->free_list = chunk;
+			++pool->num_free;
+			chunk = NULL;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	free(chunk);
+}
+
+/*************************************
+ * chain_buffer
+ ************************************/
+chain_buffer_t * chain_buffer_init(chain_buffer_t * buf, struct chain_buffer_pool * pool)
+{
+	if(NULL == buf) buf = calloc(1, sizeof(*buf));
+	else memset(buf, 0, sizeof(*buf));
+	assert(buf);
+
+	if(NULL == pool) pool = s_default_pool;
+	buf->pool = pool;
+	return buf;
+}
+
+void chain_buffer_cleanup(chain_buffer_t * buf)
+{
+	if(NULL == buf) return;
+	struct chain_buffer_chunk * chunk = buf->head;
+	while(chunk) {
+		struct chain_buffer_chunk * next = chunk->next;
+		chunk_free(buf->pool, chunk);
+		chunk = next;
+	}
+	buf->head = buf->tail = NULL;
+	buf->length = 0;
+	buf->num_chunks = 0;
+}
+
+int chain_buffer_push(chain_buffer_t * buf, const void * data, size_t length)
+{
+	assert(buf && buf->pool);
+	if(NULL == data || length == 0) return 0;
+	if((buf->length + length) < length) {
+		errno = EOVERFLOW;
+		return -1;
+	}
+
+	const unsigned char * p = data;
+	struct chain_buffer_chunk * tail = buf->tail;
+	while(length > 0) {
+		size_t available = tail?(tail->size - tail->start_pos - tail->length):0;
+		if(0 == available) {
+			struct chain_buffer_chunk * chunk = chunk_new(buf->pool);
+			if(tail) tail->next = chunk;
+			else buf->head = chunk;
+			buf->tail = tail = chunk;
+			++buf->num_chunks;
+			available = chunk->size;
+		}
+
+		size_t cb = (length < available)?length:available;
+		memcpy(tail->data + tail->start_pos + tail->length, p, cb);
+		tail->length += cb;
+		buf->length += cb;
+		p += cb;
+		length -= cb;
+	}
+	return 0;
+}
+
+static size_t chain_buffer_read(chain_buffer_t * buf, unsigned char * dst, size_t size)
+{
+	size_t total = 0;
+	struct chain_buffer_chunk * chunk;
+	while(size > 0 && (chunk = buf->head)) {
+		size_t cb = (size < chunk->length)?size:chunk->length;
+		if(dst) {
+			memcpy(dst, chunk->data + chunk->start_pos, cb);
+			dst += cb;
+		}
+		chunk->start_pos += cb;
+		chunk->length -= cb;
+		buf->length -= cb;
+		size -= cb;
+		total += cb;
+
+		if(chunk->length == 0) {
+			buf->head = chunk->next;
+			if(NULL == buf->head) buf->tail = NULL;
+			--buf->num_chunks;
+			chunk_free(buf->pool, chunk);
+		}
+	}
+	return total;
+}
+
+size_t chain_buffer_pop(chain_buffer_t * buf, void * data, size_t size)
+{
+	assert(buf && data);
+	return chain_buffer_read(buf, data, size);
+}
+
+size_t chain_buffer_consume(chain_buffer_t * buf, size_t length)
+{
+	assert(buf);
+	return chain_buffer_read(buf, NULL, length);
+}
+
+int chain_buffer_get_iovec(const chain_buffer_t * buf, struct iovec * iov, int max_iov)
+{
+	assert(buf && iov);
+	int count = 0;
+	for(struct chain_buffer_chunk * chunk = buf->head; chunk && count < max_iov; chunk = chunk->next) {
+		if(chunk->length == 0) continue;
+		iov[count].iov_base = chunk->data + chunk->start_pos;
+		iov[count].iov_len = chunk->length;
+		++count;
+	}
+	return count;
+}
+
+ssize_t chain_buffer_writev(chain_buffer_t * buf, int fd)
+{
+	assert(buf);
+	struct iovec iov[64];
+	ssize_t total = 0;
+	while(buf->length > 0) {
+		int count = chain_buffer_get_iovec(buf, iov, sizeof(iov) / sizeof(iov[0]));
+		ssize_t cb = writev(fd, iov, count);
+		if(cb < 0) {
+			if(errno == EINTR) continue;
+			if(total > 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+			return -1;
+		}
+		chain_buffer_consume(buf, cb);
+		total += cb;
+		if(cb == 0) break;
+	}
+	return total;
+}
+
+const unsigned char * chain_buffer_flatten(chain_buffer_t * buf, size_t * p_length)
+{
+	assert(buf);
+	if(p_length) *p_length = buf->length;
+
+	struct chain_buffer_chunk * head = buf->head;
+	if(NULL == head) return (const unsigned char *)"";
+	if(NULL == head->next && (head->start_pos + head->length) < head->size) {
+		head->data[head->start_pos + head->length] = '\0';
+		return head->data + head->start_pos;
+	}
+
+	// the merged block is never returned to the pool (size != pool->chunk_size)
+	size_t size = buf->length + 1;
+	if(size == buf->pool->chunk_size) ++size;
+	struct chain_buffer_chunk * block = malloc(sizeof(*block) + size);
+	assert(block);
+	if(NULL == block) return NULL;
+
+	block->next = NULL;
+	block->size = size;
+	block->start_pos = 0;
+	block->length = chain_buffer_read(buf, block->data, buf->length);
+	block->data[block->length] = '\0';
+
+	buf->head = buf->tail = block;
+	buf->length = block->length;
+	buf->num_chunks = 1;
+	return block->data;
+}
+
+size_t chain_buffer_curl_read(char * ptr, size_t size, size_t n, void * user_data)
+{
+	assert(user_data);
+	return chain_buffer_read(user_data, (unsigned char *)ptr, size * n);
+}
+
+size_t chain_buffer_curl_write(char * ptr, size_t size, size_t n, void * user_data)
+{
+	assert(user_data);
+	size_t cb = size * n;
+	if(cb == 0) return 0;
+	if(chain_buffer_push(user_data, ptr, cb)) return 0;
+	return cb;
+}
+
+
+#if defined(_TEST_CHAIN_BUFFER) && defined(_STAND_ALONE)
+#include <fcntl.h>
+#include "auto_buffer.h"
+#include "app_timer.h"
+static void bench_append(size_t total, int rounds);
+
+/*
+ * usage: chain_buffer [total_mb] [rounds]
+ */
+int main(int argc, char ** argv)
+{
+	struct chain_buffer_pool pool[1];
+	chain_buffer_pool_init(pool, 1000, 16);
+
+	chain_buffer_t buf[1];
+	chain_buffer_init(buf, pool);
+
+	// test 1. push / pop across chunk boundaries
+	unsigned char data[4096], out[4096];
+	for(size_t i = 0; i < sizeof(data); ++i) data[i] = (unsigned char)i;
+	chain_buffer_push(buf, data, 100);
+	chain_buffer_push(buf, data + 100, sizeof(data) - 100);
+	assert(buf->length == sizeof(data) && buf->num_chunks == 5);
+
+	struct iovec iov[8];
+	assert(5 == chain_buffer_get_iovec(buf, iov, 8));
+	assert(iov[0].iov_len == 1000 && iov[4].iov_len == 96);
+
+	assert(1500 == chain_buffer_pop(buf, out, 1500));
+	assert(0 == memcmp(out, data, 1500) && buf->num_chunks == 4);
+	assert(pool->num_free == 1);	// the first chunk went back to the pool
+
+	// test 2. flatten
+	size_t length = 0;
+	const unsigned char * p = chain_buffer_flatten(buf, &length);
+	assert(length == sizeof(data) - 1500 && buf->num_chunks == 1);
+	assert(0 == memcmp(p, data + 1500, length) && p[length] == '\0');
+	chain_buffer_cleanup(buf);
+	assert(pool->num_free == 5 && buf->length == 0);	// the flattened block is not pooled
+
+	// test 3. curl callbacks, chunks are reused
+	long num_allocs = pool->num_allocs;
+	assert(sizeof(data) == chain_buffer_curl_write((char *)data, 1, sizeof(data), buf));
+	char upload[3000];
+	size_t cb_upload = 0;
+	size_t cb;
+	while((cb = chain_buffer_curl_read(upload, 1, sizeof(upload), buf)) > 0) {
+		assert(0 == memcmp(upload, data + cb_upload, cb));
+		cb_upload += cb;
+	}
+	assert(cb_upload == sizeof(data) && buf->length == 0 && NULL == buf->head);
+	assert(pool->num_allocs == num_allocs);	// no malloc in steady state
+
+	// test 4. writev
+	int fd = open("/dev/null", O_WRONLY);
+	assert(fd >= 0);
+	chain_buffer_push(buf, data, sizeof(data));
+	assert(sizeof(data) == chain_buffer_writev(buf, fd));
+	assert(buf->length == 0);
+	close(fd);
+
+	chain_buffer_cleanup(buf);
+	chain_buffer_pool_cleanup(pool);
+
+	size_t total = 256;
+	int rounds = 4;
+	if(argc > 1) total = atol(argv[1]);
+	if(argc > 2) rounds = atoi(argv[2]);
+	bench_append(total << 20, rounds);
+	return 0;
+}
+
+/*
+ * receive a body in 16 KB pieces (curl write callback) and write it out to /dev/null,
+ * repeated @rounds times with the same buffer object (steady state of a client)
+ */
+static void bench_append(size_t total, int rounds)
+{
+	static char piece[16384];
+	int fd = open("/dev/null", O_WRONLY);
+	assert(fd >= 0);
+	printf("==== %s(): %zu MB x %d rounds ====\n", __FUNCTION__, total >> 20, rounds);
+
+	app_timer_t timer[1];
+	auto_buffer_t abuf[1];
+	auto_buffer_init(abuf, 0);
+	app_timer_start(timer);
+	for(int r = 0; r < rounds; ++r) {
+		for(size_t length = 0; length < total; length += sizeof(piece)) auto_buffer_push(abuf, piece, sizeof(piece));
+		ssize_t cb = write(fd, auto_buffer_get_data(abuf), abuf->length);
+		assert(cb == abuf->length);
+		auto_buffer_cleanup(abuf);
+	}
+	double t_auto = app_timer_stop(timer);
+
+	chain_buffer_t cbuf[1];
+	chain_buffer_init(cbuf, NULL);
+	struct chain_buffer_pool * pool = chain_buffer_pool_get_default();
+	pool->max_free = total / pool->chunk_size + 1;
+	app_timer_start(timer);
+	for(int r = 0; r < rounds; ++r) {
+		for(size_t length = 0; length < total; length += sizeof(piece)) chain_buffer_curl_write(piece, 1, sizeof(piece), cbuf);
+		ssize_t cb = chain_buffer_writev(cbuf, fd);
+		assert(cb == total);
+	}
+	double t_chain = app_timer_stop(timer);
+	chain_buffer_cleanup(cbuf);
+
+	printf("auto_buffer : %.6f s (%.1f MB/s)\n", t_auto, (double)(total >> 20) * rounds / t_auto);
+	printf("chain_buffer: %.6f s (%.1f MB/s), chunk mallocs: %ld, reuses: %ld\n", t_chain, (double)(total >> 20) * rounds / t_chain,
+		pool->num_allocs, pool->num_reuses);
+	close(fd);
+}
+#endif
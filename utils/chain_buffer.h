@@ -0,0 +1,98 @@
+#ifndef CHLIB_CHAIN_BUFFER_H_
+#define CHLIB_CHAIN_BUFFER_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+/*
+ * chain_buffer_t: segmented alternative to auto_buffer_t
+ *
+ * Data is appended into a list of fixed-size chunks taken from a chain_buffer_pool,
+ * so a growing buffer never reallocates nor copies what it already holds.
+ * Consumers walk the segments: chain_buffer_get_iovec() for writev(), chain_buffer_curl_read() for uploads.
+ * Call chain_buffer_flatten() only when a contiguous view is really needed.
+ *
+ * usage with net_utils_http_client:
+ *   client->on_response = chain_buffer_curl_write;
+ *   client->on_response_data = chain;
+ */
+#define CHAIN_BUFFER_DEFAULT_CHUNK_SIZE (16384 - 64)
+
+struct chain_buffer_chunk
+{
+	struct chain_buffer_chunk * next;
+	size_t size;		// capacity of data[]
+	size_t start_pos;
+	size_t length;
+	unsigned char data[];
+};
+
+/*
+ * struct chain_buffer_pool
+ * @brief free list of equally-sized chunks, thread-safe (can be shared by buffers used from different threads).
+ *     At most max_free chunks are kept, the others are returned to the system.
+ */
+struct chain_buffer_pool
+{
+	pthread_mutex_t mutex;
+	size_t chunk_size;
+	size_t max_free;
+
+	struct chain_buffer_chunk * free_list;
+	size_t num_free;
+
+	// stats
+	long num_allocs;	// malloc() calls
+	long num_reuses;
+};
+struct chain_buffer_pool * chain_buffer_pool_init(struct chain_buffer_pool * pool, size_t chunk_size, size_t max_free);
+void chain_buffer_pool_cleanup(struct chain_buffer_pool * pool);
+struct chain_buffer_pool * chain_buffer_pool_get_default(void);	// CHAIN_BUFFER_DEFAULT_CHUNK_SIZE, max_free: 1024
+
+typedef struct chain_buffer
+{
+	struct chain_buffer_pool * pool;	// not owned
+	struct chain_buffer_chunk * head;
+	struct chain_buffer_chunk * tail;
+	size_t length;	// total number of bytes in all chunks
+	int num_chunks;
+}chain_buffer_t;
+
+// @param pool: nullable, use the default pool
+chain_buffer_t * chain_buffer_init(chain_buffer_t * buf, struct chain_buffer_pool * pool);
+void chain_buffer_cleanup(chain_buffer_t * buf);	// returns all chunks to the pool, the buffer can be reused
+
+int chain_buffer_push(chain_buffer_t * buf, const void * data, size_t length);
+size_t chain_buffer_pop(chain_buffer_t * buf, void * data, size_t size);	// copy out and consume, @return number of bytes
+size_t chain_buffer_consume(chain_buffer_t * buf, size_t length);		// drop data from the front, e.g. after writev()
+
+/*
+ * chain_buffer_get_iovec()
+ * @brief fill iov[] with the first (at most max_iov) segments, the data is not consumed.
+ * @return number of iovec entries
+ */
+int chain_buffer_get_iovec(const chain_buffer_t * buf, struct iovec * iov, int max_iov);
+
+// writev() as much as possible and consume what was written, @return bytes written or -1 (see errno)
+ssize_t chain_buffer_writev(chain_buffer_t * buf, int fd);
+
+/*
+ * chain_buffer_flatten()
+ * @brief merge all segments into one nul-terminated block (no copying if the data is already in one chunk).
+ *     The pointer is valid until the next modification of the buffer.
+ */
+const unsigned char * chain_buffer_flatten(chain_buffer_t * buf, size_t * p_length);
+
+// curl callbacks, user_data: (chain_buffer_t *)
+size_t chain_buffer_curl_read(char * ptr, size_t size, size_t n, void * user_data);	// CURLOPT_READFUNCTION
+size_t chain_buffer_curl_write(char * ptr, size_t size, size_t n, void * user_data);	// CURLOPT_WRITEFUNCTION
+
+#ifdef __cplusplus
+}
+#endif
+#endif
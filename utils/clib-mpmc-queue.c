@@ -0,0 +1,337 @@
+/*
+ * clib-mpmc-queue.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "clib-mpmc-queue.h"
+
+/*
+ * D. Vyukov's bounded MPMC queue:
+ *   cell->seq == pos          : the cell is free for the producer that claims pos
+ *   cell->seq == pos + 1      : the cell holds the item for the consumer that claims pos
+ *   cell->seq == pos + size   : consumed, free for the producer of the next lap
+ */
+struct clib_mpmc_cell
+{
+	size_t seq;
+	void * data;
+};
+
+static int mpmc_push(struct clib_mpmc_queue * queue, void * data)
+{
+	assert(data);
+	struct clib_mpmc_cell * cell = NULL;
+	size_t pos = __atomic_load_n(&queue->push_pos, __ATOMIC_RELAXED);
+	while(1) {
+		cell = &queue->cells[pos & queue->mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+		if(0 == diff) {
+			if(__atomic_compare_exchange_n(&queue->push_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+			// pos has been reloaded by the failed CAS
+		}else if(diff < 0) {
+			return -1;	// full
+		}else {
+			pos = __atomic_load_n(&queue->push_pos, __ATOMIC_RELAXED);
+		}
+	}
+	cell->data = data;
+	
+	// seq_cst pairs with the increment in pop_wait(): either the consumer sees the item or we see the waiter
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&queue->num_waiters, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&queue->mutex);
+		pthread_cond_signal(&queue->cond);
+		pthread_mutex_unlock(&queue->mutex);
+	}
+	return 0;
+}
+
+static void * mpmc_pop(struct clib_mpmc_queue * queue)
+{
+	struct clib_mpmc_cell * cell = NULL;
+	size_t pos = __atomic_load_n(&queue->pop_pos, __ATOMIC_RELAXED);
+	while(1) {
+		cell = &queue->cells[pos & queue->mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)(pos + 1);
+		if(0 == diff) {
+			if(__atomic_compare_exchange_n(&queue->pop_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}else if(diff < 0) {
+			return NULL;	// empty
+		}else {
+			pos = __atomic_load_n(&queue->pop_pos, __ATOMIC_RELAXED);
+		}
+	}
+	void * data = cell->data;
+	__atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+	return data;
+}
+
+static void * mpmc_pop_wait(struct clib_mpmc_queue * queue, long timeout_ms)
+{
+	void * data = mpmc_pop(queue);
+	if(data || 0 == timeout_ms) return data;
+
+	struct timespec deadline;
+	if(timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_nsec -= 1000000000;
+			++deadline.tv_sec;
+		}
+	}
+
+	pthread_mutex_lock(&queue->mutex);
+	long wakeup_seq = queue->wakeup_seq;
+	__atomic_add_fetch(&queue->num_waiters, 1, __ATOMIC_SEQ_CST);
+	while(NULL == (data = mpmc_pop(queue))) {
+		if(queue->wakeup_seq != wakeup_seq) break;
+		int rc = 0;
+		if(timeout_ms < 0) rc = pthread_cond_wait(&queue->cond, &queue->mutex);
+		else rc = pthread_cond_timedwait(&queue->cond, &queue->mutex, &deadline);
+		if(rc == ETIMEDOUT) {
+			data = mpmc_pop(queue);
+			break;
+		}
+	}
+	__atomic_sub_fetch(&queue->num_waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&queue->mutex);
+	return data;
+}
+
+clib_mpmc_queue_t * clib_mpmc_queue_init(clib_mpmc_queue_t * queue, size_t size)
+{
+	if(NULL == queue) {
+		int rc = posix_memalign((void **)&queue, 64, sizeof(*queue));
+		assert(0 == rc);
+	}
+	assert(queue);
+	memset(queue, 0, sizeof(*queue));
+
+	size_t capacity = 2;
+	while(capacity < size) capacity <<= 1;
+	queue->size = capacity;
+	queue->mask = capacity - 1;
+	queue->cells = calloc(capacity, sizeof(*queue->cells));
+	assert(queue->cells);
+	for(size_t i = 0; i < capacity; ++i) queue->cells[i].seq = i;
+
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+
+	queue->push = mpmc_push;
+	queue->pop = mpmc_pop;
+	queue->pop_wait = mpmc_pop_wait;
+	return queue;
+}
+
+void clib_mpmc_queue_cleanup(clib_mpmc_queue_t * queue)
+{
+	if(NULL == queue || NULL == queue->cells) return;
+	void * data = NULL;
+	while((data = mpmc_pop(queue))) {
+		if(queue->on_free_data) queue->on_free_data(data);
+	}
+	free(queue->cells);
+	queue->cells = NULL;
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->mutex);
+}
+
+void clib_mpmc_queue_wakeup_all(clib_mpmc_queue_t * queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	++queue->wakeup_seq;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_CLIB_MPMC_QUEUE) && defined(_STAND_ALONE)
+#include <sched.h>
+#include "clib-stack.h"
+#include "app_timer.h"
+
+struct test_context
+{
+	clib_mpmc_queue_t * queue;
+	long num_items;	// per producer
+	long sum;
+	long count;
+	int quit;
+
+	// baseline: ring queue + mutex
+	clib_queue_t locked_queue[1];
+	pthread_mutex_t mutex;
+	long num_ops;
+};
+
+static void * producer_thread(void * user_data)
+{
+	struct test_context * ctx = user_data;
+	for(long i = 1; i <= ctx->num_items; ++i) {
+		while(ctx->queue->push(ctx->queue, (void *)i)) sched_yield();	// full
+	}
+	return NULL;
+}
+
+static void * consumer_thread(void * user_data)
+{
+	struct test_context * ctx = user_data;
+	while(1) {
+		void * data = ctx->queue->pop_wait(ctx->queue, 100);
+		if(NULL == data) {
+			if(__atomic_load_n(&ctx->quit, __ATOMIC_ACQUIRE)) break;
+			continue;
+		}
+		__atomic_add_fetch(&ctx->sum, (long)data, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&ctx->count, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static int test_producers_consumers(int num_producers, int num_consumers, long num_items)
+{
+	clib_mpmc_queue_t queue[1];
+	clib_mpmc_queue_init(queue, 256);
+	struct test_context ctx = { .queue = queue, .num_items = num_items };
+
+	pthread_t producers[num_producers], consumers[num_consumers];
+	for(int i = 0; i < num_consumers; ++i) pthread_create(&consumers[i], NULL, consumer_thread, &ctx);
+	for(int i = 0; i < num_producers; ++i) pthread_create(&producers[i], NULL, producer_thread, &ctx);
+	for(int i = 0; i < num_producers; ++i) pthread_join(producers[i], NULL);
+
+	long total = num_items * num_producers;
+	while(__atomic_load_n(&ctx.count, __ATOMIC_RELAXED) < total) sched_yield();
+	__atomic_store_n(&ctx.quit, 1, __ATOMIC_RELEASE);
+	clib_mpmc_queue_wakeup_all(queue);
+	for(int i = 0; i < num_consumers; ++i) pthread_join(consumers[i], NULL);
+
+	printf("producers=%d, consumers=%d: count=%ld, sum=%ld\n", num_producers, num_consumers, ctx.count, ctx.sum);
+	assert(ctx.count == total);
+	assert(ctx.sum == num_producers * (num_items * (num_items + 1) / 2));
+	clib_mpmc_queue_cleanup(queue);
+	return 0;
+}
+
+// every thread pushes then pops, so all threads contend on both ends
+static void * lockfree_worker(void * user_data)
+{
+	struct test_context * ctx = user_data;
+	for(long i = 1; i <= ctx->num_ops; ++i) {
+		while(ctx->queue->push(ctx->queue, (void *)i)) sched_yield();
+		while(NULL == ctx->queue->pop(ctx->queue)) sched_yield();
+	}
+	return NULL;
+}
+
+static void * locked_worker(void * user_data)
+{
+	struct test_context * ctx = user_data;
+	for(long i = 1; i <= ctx->num_ops; ++i) {
+		pthread_mutex_lock(&ctx->mutex);
+		ctx->locked_queue->push(ctx->locked_queue, (void *)i);
+		pthread_mutex_unlock(&ctx->mutex);
+
+		pthread_mutex_lock(&ctx->mutex);
+		void * data = ctx->locked_queue->pop(ctx->locked_queue);
+		pthread_mutex_unlock(&ctx->mutex);
+		assert(data);
+	}
+	return NULL;
+}
+
+static double run_threads(int num_threads, void * (* worker)(void *), struct test_context * ctx)
+{
+	pthread_t threads[num_threads];
+	app_timer_t timer[1];
+	app_timer_start(timer);
+	for(int i = 0; i < num_threads; ++i) pthread_create(&threads[i], NULL, worker, ctx);
+	for(int i = 0; i < num_threads; ++i) pthread_join(threads[i], NULL);
+	return app_timer_stop(timer);
+}
+
+/*
+ * usage: clib-mpmc-queue [max_threads] [ops_per_thread]
+ */
+int main(int argc, char ** argv)
+{
+	int max_threads = 64;
+	long num_ops = 100000;
+	if(argc > 1) max_threads = atoi(argv[1]);
+	if(argc > 2) num_ops = atol(argv[2]);
+	if(max_threads < 1) max_threads = 1;
+
+	// basic
+	clib_mpmc_queue_t queue[1];
+	clib_mpmc_queue_init(queue, 3);
+	assert(queue->size == 4);
+	for(long i = 1; i <= 4; ++i) assert(0 == queue->push(queue, (void *)i));
+	assert(-1 == queue->push(queue, (void *)5L));
+	for(long i = 1; i <= 4; ++i) assert(i == (long)queue->pop(queue));
+	assert(NULL == queue->pop(queue));
+	assert(NULL == queue->pop_wait(queue, 10));	// timeout
+	clib_mpmc_queue_cleanup(queue);
+
+	test_producers_consumers(1, 1, 100000);
+	test_producers_consumers(4, 2, 100000);
+	test_producers_consumers(2, 4, 100000);
+
+	printf("\n== contention benchmark: %ld push+pop per thread ==\n", num_ops);
+	printf("%-8s %14s %14s %14s %14s\n", "threads", "lockfree(ms)", "lockfree(Mops)", "mutex(ms)", "mutex(Mops)");
+	for(int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		struct test_context ctx = { .num_ops = num_ops };
+		ctx.queue = clib_mpmc_queue_init(queue, 1024);
+		double lockfree_cost = run_threads(num_threads, lockfree_worker, &ctx);
+		clib_mpmc_queue_cleanup(queue);
+
+		pthread_mutex_init(&ctx.mutex, NULL);
+		clib_ring_queue_init(ctx.locked_queue);
+		double locked_cost = run_threads(num_threads, locked_worker, &ctx);
+		clib_queue_cleanup(ctx.locked_queue);
+		pthread_mutex_destroy(&ctx.mutex);
+
+		double total_ops = (double)num_ops * num_threads * 2;
+		printf("%-8d %14.3f %14.2f %14.3f %14.2f\n", num_threads,
+			lockfree_cost * 1000.0, total_ops / lockfree_cost / 1000000.0,
+			locked_cost * 1000.0, total_ops / locked_cost / 1000000.0);
+	}
+	return 0;
+}
+#endif
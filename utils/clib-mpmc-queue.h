@@ -0,0 +1,65 @@
+#ifndef CHLIB_MPMC_QUEUE_H_
+#define CHLIB_MPMC_QUEUE_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * clib_mpmc_queue_t
+ * @brief bounded lock-free multi-producer / multi-consumer queue (sequence-numbered ring buffer).
+ *
+ * push() / pop() never take a lock. A mutex + condvar are only used to park consumers in pop_wait(),
+ * producers touch them only when some consumer is actually sleeping.
+ * NULL can't be queued: pop() returns NULL when the queue is empty.
+ */
+struct clib_mpmc_cell;
+typedef struct clib_mpmc_queue
+{
+	size_t size;	// capacity, power of 2
+	size_t mask;
+	struct clib_mpmc_cell * cells;
+
+	// producers and consumers race on different cache lines
+	size_t push_pos __attribute__((aligned(64)));
+	size_t pop_pos __attribute__((aligned(64)));
+
+	int num_waiters __attribute__((aligned(64)));
+	long wakeup_seq;	// bumped by clib_mpmc_queue_wakeup_all()
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	/*
+	 * push()
+	 * @return 0 on success, -1 if the queue is full
+	 */
+	int (* push)(struct clib_mpmc_queue * queue, void * data);
+	// non-blocking, NULL if empty
+	void * (* pop)(struct clib_mpmc_queue * queue);
+	/*
+	 * pop_wait()
+	 * @param timeout_ms: < 0: wait forever
+	 * @return NULL on timeout or clib_mpmc_queue_wakeup_all()
+	 */
+	void * (* pop_wait)(struct clib_mpmc_queue * queue, long timeout_ms);
+
+	void (* on_free_data)(void * data);
+}clib_mpmc_queue_t;
+
+/*
+ * clib_mpmc_queue_init()
+ * @param size: rounded up to a power of 2
+ */
+clib_mpmc_queue_t * clib_mpmc_queue_init(clib_mpmc_queue_t * queue, size_t size);
+void clib_mpmc_queue_cleanup(clib_mpmc_queue_t * queue);
+
+// wake up all consumers blocked in pop_wait(), e.g. before shutdown
+void clib_mpmc_queue_wakeup_all(clib_mpmc_queue_t * queue);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
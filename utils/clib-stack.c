@@ -34,15 +34,97 @@
 #include "clib-stack.h"
 #include "utils.h"
 
-/*************************************
- * stack
- ************************************/
 struct clib_node
 {
 	void * data;
 	struct clib_node * next;
 };
 
+/*************************************
+ * node pool
+ ************************************/
+struct clib_node_chunk
+{
+	struct clib_node_chunk * next;
+	size_t length;	// number of nodes that have been handed out from this chunk
+	struct clib_node nodes[];
+};
+
+struct clib_node_pool * clib_node_pool_init(struct clib_node_pool * pool, size_t nodes_per_chunk)
+{
+	if(NULL == pool) pool = calloc(1, sizeof(*pool));
+	else memset(pool, 0, sizeof(*pool));
+	assert(pool);
+	
+	if(0 == nodes_per_chunk) nodes_per_chunk = CLIB_NODE_POOL_DEFAULT_CHUNK_SIZE;
+	pool->nodes_per_chunk = nodes_per_chunk;
+	return pool;
+}
+
+void clib_node_pool_cleanup(struct clib_node_pool * pool)
+{
+	if(NULL == pool) return;
+	assert(0 == pool->num_used);	// all stacks / queues using this pool should be cleaned up first
+	
+	struct clib_node_chunk * chunk = pool->chunks;
+	while(chunk) {
+		struct clib_node_chunk * next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	pool->chunks = NULL;
+	pool->free_list = NULL;
+	pool->num_chunks = 0;
+}
+
+struct clib_node * clib_node_pool_alloc(struct clib_node_pool * pool)
+{
+	struct clib_node * node = pool->free_list;
+	if(node) {
+		pool->free_list = node->next;
+	}else {
+		struct clib_node_chunk * chunk = pool->chunks;
+		if(NULL == chunk || chunk->length == pool->nodes_per_chunk) {
+			chunk = malloc(sizeof(*chunk) + sizeof(*chunk->nodes) * pool->nodes_per_chunk);
+			assert(chunk);
+			chunk->length = 0;
+			chunk->next = pool->chunks;
+			pool->chunks = chunk;
+			++pool->num_chunks;
+		}
+		node = &chunk->nodes[chunk->length++];
+	}
+	node->data = NULL;
+	node->next = NULL;
+	++pool->num_used;
+	return node;
+}
+
+void clib_node_pool_free(struct clib_node_pool * pool, struct clib_node * node)
+{
+	node->next = pool->free_list;
+	pool->free_list = node;
+	--pool->num_used;
+}
+
+static inline struct clib_node * node_new(struct clib_stack_or_queue * sq)
+{
+	if(sq->pool) return clib_node_pool_alloc(sq->pool);
+	struct clib_node * node = calloc(1, sizeof(*node));
+	assert(node);
+	return node;
+}
+
+static inline void node_free(struct clib_stack_or_queue * sq, struct clib_node * node)
+{
+	if(sq->pool) clib_node_pool_free(sq->pool, node);
+	else free(node);
+}
+
+/*************************************
+ * stack
+ ************************************/
+
 static void * stack_pop(struct clib_stack_or_queue * sq)
 {
 	struct clib_node * node = sq->top;
@@ -50,7 +132,7 @@ static void * stack_pop(struct clib_stack_or_queue * sq)
 
 	sq->top = node->next;
 	void * data = node->data;
-	free(node);
+	node_free(sq, node);
 	--sq->count;
 	
 	//~ debug_printf("data=%ld, count=%d, top=%p", (long)data, sq->count, sq->top);
@@ -59,8 +141,7 @@ static void * stack_pop(struct clib_stack_or_queue * sq)
 
 static int stack_push(struct clib_stack_or_queue * sq, void * data)
 {
-	struct clib_node * node = calloc(1, sizeof(*node));
-	assert(node);
+	struct clib_node * node = node_new(sq);
 	node->data = data;
 	node->next = sq->top;
 	sq->top = node;
@@ -80,7 +161,7 @@ static void * queue_pop(struct clib_stack_or_queue * sq)
 	if(NULL == sq->top) sq->bottom = NULL;
 	
 	void * data = node->data;
-	free(node);
+	node_free(sq, node);
 	
 	--sq->count;
 	
@@ -90,8 +171,7 @@ static void * queue_pop(struct clib_stack_or_queue * sq)
 
 static int queue_push(struct clib_stack_or_queue * sq, void * data)
 {
-	struct clib_node * node = calloc(1, sizeof(*node));
-	assert(node);
+	struct clib_node * node = node_new(sq);
 	node->data = data;
 	
 	if(NULL == sq->top) sq->top = sq->bottom = node;
@@ -105,30 +185,145 @@ static int queue_push(struct clib_stack_or_queue * sq, void * data)
 }
 
 
-struct clib_stack_or_queue * clib_stack_or_queue_init(struct clib_stack_or_queue * sq, int is_queue) 
+static void * linked_peek(struct clib_stack_or_queue * sq)
+{
+	return sq->top?sq->top->data:NULL;
+}
+
+/*************************************
+ * vector stack
+ ************************************/
+static int vector_push(struct clib_stack_or_queue * sq, void * data)
+{
+	if(sq->count == sq->size) {
+		size_t new_size = sq->size?(sq->size * 2):64;
+		sq->items = realloc(sq->items, sizeof(*sq->items) * new_size);
+		assert(sq->items);
+		sq->size = new_size;
+	}
+	sq->items[sq->count++] = data;
+	return 0;
+}
+
+static void * vector_pop(struct clib_stack_or_queue * sq)
+{
+	if(sq->count <= 0) return NULL;
+	return sq->items[--sq->count];
+}
+
+static void * vector_peek(struct clib_stack_or_queue * sq)
+{
+	if(sq->count <= 0) return NULL;
+	return sq->items[sq->count - 1];
+}
+
+/*************************************
+ * ring-buffer queue
+ ************************************/
+static int ring_push(struct clib_stack_or_queue * sq, void * data)
+{
+	if(sq->count == sq->size) {
+		size_t new_size = sq->size?(sq->size * 2):64;
+		void ** items = malloc(sizeof(*items) * new_size);
+		assert(items);
+		
+		// unwrap: [head, size) + [0, head)
+		size_t tail_length = sq->size - sq->head;
+		if(sq->count > 0) {
+			memcpy(items, sq->items + sq->head, sizeof(*items) * tail_length);
+			memcpy(items + tail_length, sq->items, sizeof(*items) * sq->head);
+		}
+		free(sq->items);
+		sq->items = items;
+		sq->size = new_size;
+		sq->head = 0;
+	}
+	sq->items[(sq->head + sq->count) & (sq->size - 1)] = data;
+	++sq->count;
+	return 0;
+}
+
+static void * ring_pop(struct clib_stack_or_queue * sq)
+{
+	if(sq->count <= 0) return NULL;
+	void * data = sq->items[sq->head];
+	sq->head = (sq->head + 1) & (sq->size - 1);
+	--sq->count;
+	return data;
+}
+
+static void * ring_peek(struct clib_stack_or_queue * sq)
+{
+	if(sq->count <= 0) return NULL;
+	return sq->items[sq->head];
+}
+
+struct clib_stack_or_queue * clib_stack_or_queue_init(struct clib_stack_or_queue * sq, int flags) 
+{
+	return clib_stack_or_queue_init_with_pool(sq, flags, NULL);
+}
+
+struct clib_stack_or_queue * clib_stack_or_queue_init_with_pool(struct clib_stack_or_queue * sq, int flags, struct clib_node_pool * pool)
 {
 	if(NULL == sq) sq = calloc(1, sizeof(*sq));
 	else memset(sq, 0, sizeof(*sq));
+	assert(sq);
+	
+	sq->flags = flags;
+	int is_queue = (flags & clib_flag_queue);
+	if(flags & clib_flag_contiguous) {
+		sq->push = is_queue?ring_push:vector_push;
+		sq->pop = is_queue?ring_pop:vector_pop;
+		sq->peek = is_queue?ring_peek:vector_peek;
+		return sq;
+	}
 	
+	sq->pool = pool;
 	sq->push = is_queue?queue_push:stack_push;
 	sq->pop = is_queue?queue_pop:stack_pop;
+	sq->peek = linked_peek;
 	
 	return sq;
 }
 
 void clib_stack_or_queue_cleanup(struct clib_stack_or_queue * sq)
 {
+	if(sq->flags & clib_flag_contiguous) {
+		if(sq->on_free_data) {
+			for(int i = 0; i < sq->count; ++i) {
+				sq->on_free_data(sq->items[(sq->flags & clib_flag_queue)?((sq->head + i) & (sq->size - 1)):i]);
+			}
+		}
+		free(sq->items);
+		sq->items = NULL;
+		sq->size = 0;
+		sq->head = 0;
+		sq->count = 0;
+		return;
+	}
+	
 	struct clib_node * node = NULL;
 	while((node = sq->top)) {
 		sq->top = node->next;
 		if(sq->on_free_data) sq->on_free_data(node->data);
-		free(node);
+		node_free(sq, node);
 	}
 	sq->bottom = NULL;
 	sq->count = 0;
 }
 
 #if defined(_TEST_CLIB_STACK) && defined(_STAND_ALONE)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "app_timer.h"
+static int bench_node_pool(long num_items, int rounds);
+static int bench_backends(long num_items, int rounds);
+
+/*
+ * usage: clib-stack [num_items] [rounds]
+ */
 int main(int argc, char ** argv)
 {
 	void * data = NULL;
@@ -183,6 +378,177 @@ int main(int argc, char ** argv)
 	}
 	assert(queue->count == 0 && NULL == queue->top);
 	
+	// test pooled stack / queue
+	struct clib_node_pool pool[1];
+	clib_node_pool_init(pool, 4);	// small chunks: exercise chunk allocation and the freelist
+	clib_stack_init_with_pool(stack, pool);
+	clib_queue_init_with_pool(queue, pool);
+	for(int i = 1; i <= NUM_ITEMS; ++i) {
+		stack->push(stack, (void *)(long)i);
+		queue->push(queue, (void *)(long)i);
+	}
+	assert(pool->num_used == NUM_ITEMS * 2);
+	for(int i = 1; i <= NUM_ITEMS / 2; ++i) {
+		assert((NUM_ITEMS - i + 1) == (int)(long)stack->pop(stack));
+		assert(i == (int)(long)queue->pop(queue));
+	}
+	long num_chunks = pool->num_chunks;
+	for(int i = 1; i <= NUM_ITEMS / 2; ++i) stack->push(stack, (void *)(long)i);	// reuse freed nodes
+	assert(pool->num_chunks == num_chunks);
+	
+	clib_stack_cleanup(stack);
+	clib_queue_cleanup(queue);
+	assert(0 == pool->num_used);
+	clib_node_pool_cleanup(pool);
+	
+	// test contiguous backends: grow while the ring buffer is wrapped around
+	clib_vector_stack_init(stack);
+	clib_ring_queue_init(queue);
+	long next_in = 1, next_out = 1;
+	for(int i = 1; i <= 100; ++i) {
+		stack->push(stack, (void *)(long)i);
+		queue->push(queue, (void *)next_in++);
+		if(i % 3 == 0) {
+			assert(next_out == (long)queue->peek(queue));
+			assert(next_out++ == (long)queue->pop(queue));
+		}
+	}
+	assert(100 == (long)stack->peek(stack));
+	for(int i = 100; i >= 1; --i) assert(i == (int)(long)stack->pop(stack));
+	assert(NULL == stack->pop(stack) && NULL == stack->peek(stack));
+	while((data = queue->pop(queue))) assert(next_out++ == (long)data);
+	assert(next_out == next_in && 0 == queue->count);
+	clib_stack_cleanup(stack);
+	clib_queue_cleanup(queue);
+	
+	long num_items = 1000000;
+	int rounds = 10;
+	if(argc > 1) num_items = atol(argv[1]);
+	if(argc > 2) rounds = atoi(argv[2]);
+	bench_node_pool(num_items, rounds);
+	bench_backends(num_items, rounds);
+	return 0;
+}
+
+static double bench_push_pop(clib_stack_t * sq, long num_items, int rounds)
+{
+	app_timer_t timer[1];
+	app_timer_start(timer);
+	for(int r = 0; r < rounds; ++r) {
+		for(long i = 1; i <= num_items; ++i) sq->push(sq, (void *)i);
+		while(sq->pop(sq));
+	}
+	return app_timer_stop(timer);
+}
+
+static int bench_node_pool(long num_items, int rounds)
+{
+	printf("\n== benchmark: %ld items x %d rounds ==\n", num_items, rounds);
+	printf("%-8s %-10s %12s %14s\n", "type", "allocator", "time(ms)", "Mops/s");
+	
+	for(int is_queue = 0; is_queue < 2; ++is_queue) {
+		for(int use_pool = 0; use_pool < 2; ++use_pool) {
+			struct clib_node_pool pool[1];
+			clib_node_pool_init(pool, 0);
+			
+			clib_stack_t sq[1];
+			clib_stack_or_queue_init_with_pool(sq, is_queue, use_pool?pool:NULL);
+			double time_cost = bench_push_pop(sq, num_items, rounds);
+			clib_stack_or_queue_cleanup(sq);
+			clib_node_pool_cleanup(pool);
+			
+			printf("%-8s %-10s %12.3f %14.2f\n", 
+				is_queue?"queue":"stack", use_pool?"pool":"calloc",
+				time_cost * 1000.0, 
+				(double)num_items * rounds * 2 / time_cost / 1000000.0);	// push + pop
+		}
+	}
+	return 0;
+}
+
+/*
+ * cache misses of the calling thread, -1 if perf events are not available (e.g. in containers)
+ */
+static int perf_cache_misses_open(void)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * steady state: keep num_items in the container and push / pop through it, 
+ * so the linked nodes end up scattered over the heap.
+ */
+static double bench_steady_state(clib_stack_t * sq, long num_items, int rounds, long * p_cache_misses)
+{
+	for(long i = 1; i <= num_items; ++i) sq->push(sq, (void *)i);
+	
+	int fd = perf_cache_misses_open();
+	if(fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	
+	app_timer_t timer[1];
+	app_timer_start(timer);
+	for(int r = 0; r < rounds; ++r) {
+		for(long i = 1; i <= num_items; ++i) {
+			void * data = sq->pop(sq);
+			sq->push(sq, data);
+		}
+	}
+	double time_cost = app_timer_stop(timer);
+	
+	*p_cache_misses = -1;
+	if(fd >= 0) {
+		long long count = 0;
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if(sizeof(count) == read(fd, &count, sizeof(count))) *p_cache_misses = (long)count;
+		close(fd);
+	}
+	while(sq->pop(sq));
+	return time_cost;
+}
+
+static int bench_backends(long num_items, int rounds)
+{
+	static const char * backends[] = { "linked", "pool", "contiguous" };
+	printf("\n== benchmark backends: %ld items x %d rounds ==\n", num_items, rounds);
+	printf("%-8s %-12s %14s %14s %14s %16s\n", "type", "backend", 
+		"push+pop(Mops)", "steady(ms)", "steady(Mops)", "cache-misses");
+	
+	for(int is_queue = 0; is_queue < 2; ++is_queue) {
+		for(int backend = 0; backend < 3; ++backend) {
+			struct clib_node_pool pool[1];
+			clib_node_pool_init(pool, 0);
+			
+			clib_stack_t sq[1];
+			int flags = (is_queue?clib_flag_queue:0) | ((backend == 2)?clib_flag_contiguous:0);
+			clib_stack_or_queue_init_with_pool(sq, flags, (backend == 1)?pool:NULL);
+			
+			double time_cost = bench_push_pop(sq, num_items, rounds);
+			long cache_misses = -1;
+			double steady_cost = bench_steady_state(sq, num_items, rounds, &cache_misses);
+			clib_stack_or_queue_cleanup(sq);
+			clib_node_pool_cleanup(pool);
+			
+			char sz_misses[32] = "n/a";
+			if(cache_misses >= 0) snprintf(sz_misses, sizeof(sz_misses), "%ld", cache_misses);
+			printf("%-8s %-12s %14.2f %14.3f %14.2f %16s\n",
+				is_queue?"queue":"stack", backends[backend],
+				(double)num_items * rounds * 2 / time_cost / 1000000.0,
+				steady_cost * 1000.0, 
+				(double)num_items * rounds * 2 / steady_cost / 1000000.0,
+				sz_misses);
+		}
+	}
 	return 0;
 }
 #endif
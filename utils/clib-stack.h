@@ -8,23 +8,72 @@ extern "C" {
 struct clib_node;
 #define clib_node_get_data(p_node) *(void **)(p_node)
 
+/*
+ * struct clib_node_pool
+ * @brief slab allocator for clib_nodes: nodes are carved out of chunks and recycled through an intrusive freelist,
+ *     memory is only returned to the system by clib_node_pool_cleanup().
+ *     Not thread-safe, can be shared by several stacks / queues used by the same thread.
+ */
+#define CLIB_NODE_POOL_DEFAULT_CHUNK_SIZE (1024)
+struct clib_node_chunk;
+struct clib_node_pool
+{
+	size_t nodes_per_chunk;
+	struct clib_node_chunk * chunks;
+	struct clib_node * free_list;
+	
+	long num_chunks;
+	long num_used;	// nodes currently in use
+};
+struct clib_node_pool * clib_node_pool_init(struct clib_node_pool * pool, size_t nodes_per_chunk);
+void clib_node_pool_cleanup(struct clib_node_pool * pool);
+struct clib_node * clib_node_pool_alloc(struct clib_node_pool * pool);
+void clib_node_pool_free(struct clib_node_pool * pool, struct clib_node * node);
+
+/*
+ * backends, selected by the flags of clib_stack_or_queue_init():
+ *   0                                      : linked stack (default)
+ *   clib_flag_queue                        : linked queue
+ *   clib_flag_contiguous                   : vector stack, a growable array
+ *   clib_flag_queue | clib_flag_contiguous : ring-buffer queue, the capacity is a power of 2
+ * The contiguous backends don't use top/bottom/pool, use peek() instead of clib_node_get_data(sq->top).
+ */
+enum clib_stack_or_queue_flags
+{
+	clib_flag_queue = 1,
+	clib_flag_contiguous = 2,
+};
+
 typedef struct clib_stack_or_queue
 {
 	struct clib_node * top;
 	struct clib_node * bottom;
 	int count;
+	struct clib_node_pool * pool;	// nullable, not owned
+	
+	// contiguous backends
+	int flags;
+	void ** items;
+	size_t size;
+	size_t head;	// ring buffer: index of the first item
 	
 	int (* push)(struct clib_stack_or_queue * sq, void * data);
 	void * (* pop)(struct clib_stack_or_queue * sq);
+	void * (* peek)(struct clib_stack_or_queue * sq);	// the item that pop() would return, NULL if empty
 	
 	// cleanup callback
 	void (* on_free_data)(void * node_data);
 }clib_stack_t, clib_queue_t;
-struct clib_stack_or_queue * clib_stack_or_queue_init(struct clib_stack_or_queue * sq, int is_queue);
+struct clib_stack_or_queue * clib_stack_or_queue_init(struct clib_stack_or_queue * sq, int flags);
+struct clib_stack_or_queue * clib_stack_or_queue_init_with_pool(struct clib_stack_or_queue * sq, int flags, struct clib_node_pool * pool);
 void clib_stack_or_queue_cleanup(struct clib_stack_or_queue * sq);
 
 #define clib_stack_init(sq) 	clib_stack_or_queue_init(sq, 0)
 #define clib_queue_init(sq) 	clib_stack_or_queue_init(sq, 1)
+#define clib_vector_stack_init(sq) 	clib_stack_or_queue_init(sq, clib_flag_contiguous)
+#define clib_ring_queue_init(sq) 	clib_stack_or_queue_init(sq, clib_flag_queue | clib_flag_contiguous)
+#define clib_stack_init_with_pool(sq, pool) 	clib_stack_or_queue_init_with_pool(sq, 0, pool)
+#define clib_queue_init_with_pool(sq, pool) 	clib_stack_or_queue_init_with_pool(sq, 1, pool)
 #define clib_stack_cleanup(sq) 	clib_stack_or_queue_cleanup(sq)
 #define clib_queue_cleanup(sq) 	clib_stack_or_queue_cleanup(sq)
 
@@ -0,0 +1,428 @@
+/*
+ * compact_map.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "compact_map.h"
+
+uint64_t compact_map_string_prefix(const void * key)
+{
+	const unsigned char * p = key;
+	uint64_t prefix = 0;
+	int i = 0;
+	for(; i < 8 && p[i]; ++i) prefix = (prefix << 8) | p[i];
+	for(; i < 8; ++i) prefix <<= 8;
+	return prefix;
+}
+
+uint64_t compact_map_int_prefix(const void * key)
+{
+	return (uint64_t)(uint32_t)(*(const int *)key) ^ 0x80000000u;
+}
+
+compact_map_t * compact_map_init(compact_map_t * map, compact_map_key_prefix_fn key_prefix, void * user_data)
+{
+	if(NULL == map) map = calloc(1, sizeof(*map));
+	else memset(map, 0, sizeof(*map));
+	assert(map);
+
+	map->key_prefix = key_prefix;
+	map->user_data = user_data;
+	return map;
+}
+
+void compact_map_cleanup(compact_map_t * map)
+{
+	if(NULL == map) return;
+	if(map->on_free_data) {
+		for(ssize_t i = 0; i < map->count; ++i) map->on_free_data(map->keys[i]);
+	}
+	free(map->keys);
+	free(map->prefixes);
+	map->keys = NULL;
+	map->prefixes = NULL;
+	map->count = 0;
+	map->size = 0;
+}
+
+static void compact_map_resize(compact_map_t * map, size_t new_size)
+{
+	if(new_size <= map->size) return;
+	map->keys = realloc(map->keys, sizeof(*map->keys) * new_size);
+	assert(map->keys);
+	if(map->key_prefix) {
+		map->prefixes = realloc(map->prefixes, sizeof(*map->prefixes) * new_size);
+		assert(map->prefixes);
+	}
+	map->size = new_size;
+}
+
+/* index of the first prefix >= prefix (upper == 0) or > prefix (upper == 1) in [lo, hi), branchless */
+static inline size_t prefix_bound(const uint64_t * prefixes, size_t lo, size_t hi, uint64_t prefix, int upper)
+{
+	if(lo >= hi) return lo;
+	const uint64_t * base = prefixes + lo;
+	size_t n = hi - lo;
+	if(upper) {
+		while(n > 1) {
+			size_t half = n >> 1;
+			base = (base[half] <= prefix)?(base + half):base;	// cmov
+			n -= half;
+		}
+		return (base - prefixes) + (*base <= prefix);
+	}
+	while(n > 1) {
+		size_t half = n >> 1;
+		base = (base[half] < prefix)?(base + half):base;
+		n -= half;
+	}
+	return (base - prefixes) + (*base < prefix);
+}
+
+ssize_t compact_map_lower_bound(const compact_map_t * map, const void * key, int (*cmp)(const void *, const void *))
+{
+	size_t lo = 0, hi = map->count;
+	if(map->prefixes) {
+		// narrow down to the keys sharing the prefix, without dereferencing any key
+		uint64_t prefix = map->key_prefix(key);
+		lo = prefix_bound(map->prefixes, 0, hi, prefix, 0);
+		if(lo == hi || map->prefixes[lo] != prefix) return lo;
+		if(lo + 1 < hi && map->prefixes[lo + 1] == prefix) hi = prefix_bound(map->prefixes, lo + 1, hi, prefix, 1);
+		else hi = lo + 1;
+	}
+
+	size_t n = hi - lo;
+	while(n > 0) {
+		size_t half = n >> 1;
+		if(cmp(key, map->keys[lo + half]) > 0) {
+			lo += half + 1;
+			n -= half + 1;
+		}else {
+			n = half;
+		}
+	}
+	return lo;
+}
+
+void * compact_map_find(const compact_map_t * map, const void * key, int (*cmp)(const void *, const void *))
+{
+	ssize_t index = compact_map_lower_bound(map, key, cmp);
+	if(index < map->count && 0 == cmp(key, map->keys[index])) return &map->keys[index];
+	return NULL;
+}
+
+void * compact_map_add(compact_map_t * map, const void * key, int (*cmp)(const void *, const void *))
+{
+	ssize_t index = compact_map_lower_bound(map, key, cmp);
+	if(index < map->count && 0 == cmp(key, map->keys[index])) return &map->keys[index];
+
+	if(map->count == map->size) compact_map_resize(map, map->size?(map->size * 2):64);
+	size_t num_moved = map->count - index;
+	memmove(&map->keys[index + 1], &map->keys[index], sizeof(*map->keys) * num_moved);
+	map->keys[index] = (void *)key;
+	if(map->prefixes) {
+		memmove(&map->prefixes[index + 1], &map->prefixes[index], sizeof(*map->prefixes) * num_moved);
+		map->prefixes[index] = map->key_prefix(key);
+	}
+	++map->count;
+	return &map->keys[index];
+}
+
+void * compact_map_del(compact_map_t * map, const void * key, int (*cmp)(const void *, const void *))
+{
+	ssize_t index = compact_map_lower_bound(map, key, cmp);
+	if(index >= map->count || 0 != cmp(key, map->keys[index])) return NULL;
+
+	void * data = map->keys[index];
+	size_t num_moved = map->count - index - 1;
+	memmove(&map->keys[index], &map->keys[index + 1], sizeof(*map->keys) * num_moved);
+	if(map->prefixes) memmove(&map->prefixes[index], &map->prefixes[index + 1], sizeof(*map->prefixes) * num_moved);
+	--map->count;
+	return data;
+}
+
+/******************************************************
+ * bulk load
+ *****************************************************/
+struct load_item
+{
+	uint64_t prefix;
+	void * key;
+};
+
+static inline int load_item_compare(const struct load_item * a, const struct load_item * b, int (*cmp)(const void *, const void *))
+{
+	if(a->prefix != b->prefix) return (a->prefix < b->prefix)?-1:1;
+	return cmp(a->key, b->key);
+}
+
+// stable bottom-up merge sort, so that the first of several equal keys stays first
+static struct load_item * merge_sort(struct load_item * items, struct load_item * tmp, size_t count, int (*cmp)(const void *, const void *))
+{
+	struct load_item * src = items, * dst = tmp;
+	for(size_t width = 1; width < count; width *= 2) {
+		for(size_t lo = 0; lo < count; lo += width * 2) {
+			size_t mid = lo + width, hi = lo + width * 2;
+			if(mid > count) mid = count;
+			if(hi > count) hi = count;
+
+			size_t i = lo, j = mid, k = lo;
+			while(i < mid && j < hi) {
+				if(load_item_compare(&src[j], &src[i], cmp) < 0) dst[k++] = src[j++];
+				else dst[k++] = src[i++];
+			}
+			while(i < mid) dst[k++] = src[i++];
+			while(j < hi) dst[k++] = src[j++];
+		}
+		struct load_item * swap = src;
+		src = dst;
+		dst = swap;
+	}
+	return src;
+}
+
+ssize_t compact_map_load(compact_map_t * map, void ** keys, size_t count, int (*cmp)(const void *, const void *))
+{
+	if(map->on_free_data) {
+		for(ssize_t i = 0; i < map->count; ++i) map->on_free_data(map->keys[i]);
+	}
+	map->count = 0;
+	if(0 == count) return 0;
+
+	struct load_item * items = malloc(sizeof(*items) * count * 2);
+	assert(items);
+	for(size_t i = 0; i < count; ++i) {
+		items[i].prefix = map->key_prefix?map->key_prefix(keys[i]):0;
+		items[i].key = keys[i];
+	}
+	struct load_item * sorted = merge_sort(items, items + count, count, cmp);
+
+	compact_map_resize(map, count);
+	ssize_t length = 0;
+	for(size_t i = 0; i < count; ++i) {
+		if(length > 0 && 0 == load_item_compare(&sorted[i], &sorted[i - 1], cmp)) continue;	// duplicate
+		map->keys[length] = sorted[i].key;
+		if(map->prefixes) map->prefixes[length] = sorted[i].prefix;
+		++length;
+	}
+	map->count = length;
+	free(items);
+	return length;
+}
+
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_COMPACT_MAP) && defined(_STAND_ALONE)
+#include "avl_tree.h"
+#include "app_timer.h"
+
+static int int_compare(const void * a, const void * b)
+{
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+static int string_compare(const void * a, const void * b)
+{
+	return strcmp(a, b);
+}
+
+static int test_strings(void)
+{
+	// long common prefixes: exercises the tie range of equal prefixes
+	static const char * words[] = {
+		"content-type", "content-length", "content-encoding", "content", "date", 
+		"x-mailer", "x-", "x", "", "content-length", "from", "to", "subject", "contentz",
+	};
+	const size_t num_words = sizeof(words) / sizeof(words[0]);
+	compact_map_t map[1];
+	compact_map_init(map, compact_map_string_prefix, NULL);
+	for(size_t i = 0; i < num_words; ++i) compact_map_add(map, words[i], string_compare);
+	assert(map->count == (ssize_t)num_words - 1);	// one duplicate
+	for(ssize_t i = 1; i < map->count; ++i) assert(strcmp(map->keys[i - 1], map->keys[i]) < 0);
+	for(size_t i = 0; i < num_words; ++i) {
+		void ** slot = compact_map_find(map, words[i], string_compare);
+		assert(slot && 0 == strcmp(*slot, words[i]));
+	}
+	assert(NULL == compact_map_find(map, "content-", string_compare));
+	assert(compact_map_lower_bound(map, "content-", string_compare) + 3 == compact_map_lower_bound(map, "content-z", string_compare));
+
+	// bulk load gives the same result
+	compact_map_t loaded[1];
+	compact_map_init(loaded, compact_map_string_prefix, NULL);
+	assert(map->count == compact_map_load(loaded, (void **)words, num_words, string_compare));
+	for(ssize_t i = 0; i < map->count; ++i) assert(0 == strcmp(loaded->keys[i], map->keys[i]));
+	assert(0 == memcmp(loaded->prefixes, map->prefixes, sizeof(*map->prefixes) * map->count));
+
+	assert(compact_map_del(map, "x-", string_compare));
+	assert(NULL == compact_map_find(map, "x-", string_compare));
+	assert(NULL == compact_map_del(map, "x-", string_compare));
+	compact_map_cleanup(map);
+	compact_map_cleanup(loaded);
+	return 0;
+}
+
+static int test_random_ints(long num_keys)
+{
+	int * values = malloc(sizeof(*values) * num_keys);
+	assert(values);
+	srand(2);
+	for(long i = 0; i < num_keys; ++i) values[i] = rand() % (num_keys * 2) - num_keys;	// with duplicates and negatives
+
+	avl_tree_t tree[1];
+	memset(tree, 0, sizeof(tree));
+	avl_tree_init(tree, NULL);
+	compact_map_t map[1], plain[1];
+	compact_map_init(map, compact_map_int_prefix, NULL);
+	compact_map_init(plain, NULL, NULL);
+	for(long i = 0; i < num_keys; ++i) {
+		avl_tree_add(tree, &values[i], int_compare);
+		compact_map_add(map, &values[i], int_compare);
+		compact_map_add(plain, &values[i], int_compare);
+		if(i % 3 == 0) {
+			int key = rand() % (num_keys * 2) - num_keys;
+			int found = (NULL != avl_tree_del(tree, &key, int_compare));
+			assert(found == (NULL != compact_map_del(map, &key, int_compare)));
+			assert(found == (NULL != compact_map_del(plain, &key, int_compare)));
+		}
+	}
+	assert(tree->count == map->count && tree->count == plain->count);
+
+	avl_tree_iter_t iter[1];
+	avl_tree_iter_init(iter, tree, 0);
+	for(ssize_t i = 0; i < map->count; ++i) {
+		struct avl_node * node = avl_tree_iter_get_next(iter);
+		assert(node && avl_node_get_data(node) == map->keys[i] && map->keys[i] == plain->keys[i]);
+	}
+	for(int key = -num_keys - 1; key <= num_keys; ++key) {
+		int found = (NULL != avl_tree_find(tree, &key, int_compare));
+		assert(found == (NULL != compact_map_find(map, &key, int_compare)));
+		assert(found == (NULL != compact_map_find(plain, &key, int_compare)));
+	}
+	printf("%s(%ld): %ld distinct keys OK\n", __FUNCTION__, num_keys, (long)map->count);
+
+	avl_tree_cleanup(tree);
+	compact_map_cleanup(map);
+	compact_map_cleanup(plain);
+	free(values);
+	return 0;
+}
+
+/*
+ * lookup throughput of random existing keys
+ */
+static int bench_lookup(long max_keys, long num_lookups)
+{
+	printf("\n== benchmark: %ld random lookups ==\n", num_lookups);
+	printf("%-10s %14s %14s %14s %14s\n", "keys", "avl(Mops)", "sorted(Mops)", "prefix(Mops)", "load(ms)");
+
+	int * values = malloc(sizeof(*values) * max_keys);
+	void ** keys = malloc(sizeof(*keys) * max_keys);
+	long * lookups = malloc(sizeof(*lookups) * num_lookups);
+	assert(values && keys && lookups);
+
+	for(long num_keys = 1000; num_keys <= max_keys; num_keys *= 10) {
+		for(long i = 0; i < num_keys; ++i) {
+			values[i] = (int)(i * 2 + 1);
+			keys[i] = &values[i];
+		}
+		for(long i = num_keys - 1; i > 0; --i) {	// shuffle, so that the avl nodes are allocated in random order
+			long j = ((long)rand() * RAND_MAX + rand()) % (i + 1);
+			void * tmp = keys[i]; keys[i] = keys[j]; keys[j] = tmp;
+		}
+		for(long i = 0; i < num_lookups; ++i) lookups[i] = ((long)rand() * RAND_MAX + rand()) % num_keys;
+
+		struct avl_node_arena arena[1];
+		avl_node_arena_init(arena, 0);
+		avl_tree_t tree[1];
+		memset(tree, 0, sizeof(tree));
+		avl_tree_init_with_arena(tree, NULL, arena);
+		for(long i = 0; i < num_keys; ++i) avl_tree_add(tree, keys[i], int_compare);
+
+		app_timer_t timer[1];
+		compact_map_t plain[1], map[1];
+		compact_map_init(plain, NULL, NULL);
+		compact_map_init(map, compact_map_int_prefix, NULL);
+		compact_map_load(plain, keys, num_keys, int_compare);
+		app_timer_start(timer);
+		compact_map_load(map, keys, num_keys, int_compare);
+		double load_cost = app_timer_stop(timer);
+
+		double time_cost[3] = { 0 };
+		long hits[3] = { 0 };
+		for(int method = 0; method < 3; ++method) {
+			app_timer_start(timer);
+			for(long i = 0; i < num_lookups; ++i) {
+				int key = (int)(lookups[i] * 2 + 1);
+				void * p = NULL;
+				switch(method) {
+				case 0: p = avl_tree_find(tree, &key, int_compare); break;
+				case 1: p = compact_map_find(plain, &key, int_compare); break;
+				default: p = compact_map_find(map, &key, int_compare); break;
+				}
+				hits[method] += (NULL != p);
+			}
+			time_cost[method] = app_timer_stop(timer);
+			assert(hits[method] == num_lookups);
+		}
+		printf("%-10ld %14.2f %14.2f %14.2f %14.3f\n", num_keys,
+			num_lookups / time_cost[0] / 1000000.0,
+			num_lookups / time_cost[1] / 1000000.0,
+			num_lookups / time_cost[2] / 1000000.0,
+			load_cost * 1000.0);
+
+		avl_tree_cleanup(tree);
+		avl_node_arena_cleanup(arena);
+		compact_map_cleanup(plain);
+		compact_map_cleanup(map);
+	}
+	free(values);
+	free(keys);
+	free(lookups);
+	return 0;
+}
+
+/*
+ * usage: compact_map [max_keys(=1000000, up to 10000000)] [num_lookups]
+ */
+int main(int argc, char ** argv)
+{
+	long max_keys = 1000000;
+	long num_lookups = 1000000;
+	if(argc > 1) max_keys = atol(argv[1]);
+	if(argc > 2) num_lookups = atol(argv[2]);
+
+	test_strings();
+	test_random_ints(20000);
+	return bench_lookup(max_keys, num_lookups);
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef CHLIB_COMPACT_MAP_H_
+#define CHLIB_COMPACT_MAP_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * compact_map_t: sorted-array map, a read-optimized alternative to avl_tree_t
+ *
+ * Keys are kept in one contiguous sorted array, so iteration is a linear scan and no per-key allocation is needed.
+ * If a key_prefix() function is given, an order-preserving 64-bit prefix of every key is stored in a parallel array:
+ * binary search then runs over 8 prefixes per cache line and only dereferences the key(s) with an equal prefix.
+ *   key_prefix(a) < key_prefix(b)  ==>  cmp(a, b) < 0   (must hold)
+ * e.g. the first 8 bytes of a string in big-endian order, or an integer with the sign bit flipped.
+ *
+ * add() / del() are O(n) (memmove), build large maps with compact_map_load() instead.
+ * The returned slot pointers (void **, same usage as avl_node_get_data()) are only valid until the next add / del / load.
+ */
+typedef uint64_t (* compact_map_key_prefix_fn)(const void * key);
+typedef struct compact_map
+{
+	void ** keys;
+	uint64_t * prefixes;	// NULL if key_prefix is NULL
+	ssize_t count;
+	size_t size;
+
+	compact_map_key_prefix_fn key_prefix;
+	void * user_data;
+	void (* on_free_data)(void * data);
+}compact_map_t;
+
+compact_map_t * compact_map_init(compact_map_t * map, compact_map_key_prefix_fn key_prefix, void * user_data);
+void compact_map_cleanup(compact_map_t * map);
+
+/*
+ * compact_map_load()
+ * @brief bulk-load: replace the content with keys[0 .. count), O(n log n) (stable merge sort).
+ *     For duplicate keys only the first one is kept, the others are not referenced (nor freed).
+ * @return number of keys in the map
+ */
+ssize_t compact_map_load(compact_map_t * map, void ** keys, size_t count, int (*cmp)(const void *, const void *));
+
+void * compact_map_add(compact_map_t * map, const void * key, int (*cmp)(const void *, const void *));	// the existing slot if key exists
+void * compact_map_del(compact_map_t * map, const void * key, int (*cmp)(const void *, const void *));	// the removed key, NULL if not found
+void * compact_map_find(const compact_map_t * map, const void * key, int (*cmp)(const void *, const void *));	// the slot, NULL if not found
+
+// index of the first key >= key, map->count if none. keys are iterated as map->keys[index]
+ssize_t compact_map_lower_bound(const compact_map_t * map, const void * key, int (*cmp)(const void *, const void *));
+
+// helpers for key_prefix
+uint64_t compact_map_string_prefix(const void * key);	// (const char *), byte order (strcmp)
+uint64_t compact_map_int_prefix(const void * key);		// (const int *)
+
+#ifdef __cplusplus
+}
+#endif
+#endif
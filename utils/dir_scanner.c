@@ -0,0 +1,490 @@
+/*
+ * dir_scanner.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "dir_scanner.h"
+
+#define DIR_SCANNER_MAX_THREADS (64)
+#define STRING_ARENA_CHUNK_SIZE (64 * 1024)
+
+/******************************************************
+ * string_arena: append-only, pointers stay valid until cleanup
+ *****************************************************/
+struct string_arena_chunk
+{
+	struct string_arena_chunk * next;
+	size_t size;
+	size_t length;
+	char data[];
+};
+
+struct string_arena
+{
+	struct string_arena_chunk * head;
+	size_t total;
+};
+
+static const char * string_arena_add(struct string_arena * arena, const char * str, size_t length)
+{
+	struct string_arena_chunk * chunk = arena->head;
+	if(NULL == chunk || (chunk->length + length + 1) > chunk->size) {
+		size_t size = STRING_ARENA_CHUNK_SIZE;
+		if(size < (length + 1)) size = length + 1;
+		chunk = malloc(sizeof(*chunk) + size);
+		assert(chunk);
+		chunk->size = size;
+		chunk->length = 0;
+		chunk->next = arena->head;
+		arena->head = chunk;
+	}
+	char * dst = chunk->data + chunk->length;
+	memcpy(dst, str, length);
+	dst[length] = '\0';
+	chunk->length += length + 1;
+	arena->total += length + 1;
+	return dst;
+}
+
+static void string_arena_cleanup(struct string_arena * arena)
+{
+	struct string_arena_chunk * chunk = arena->head;
+	while(chunk) {
+		struct string_arena_chunk * next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	arena->head = NULL;
+	arena->total = 0;
+}
+
+/******************************************************
+ * work-stealing pool
+ *****************************************************/
+struct dir_task
+{
+	const char * path;	// relative to the root, "" for the root itself
+	size_t cb_path;
+	int depth;
+};
+
+struct scan_context;
+struct scan_worker
+{
+	struct scan_context * ctx;
+	int id;
+	pthread_t th;
+
+	// deque: the owner pushes / pops at the tail, thieves steal from the head
+	pthread_mutex_t mutex;
+	struct dir_task * tasks;
+	size_t head;
+	size_t tail;
+	size_t size;
+
+	struct string_arena arena[1];
+	char path_name[PATH_MAX];
+
+	long num_files;
+	long num_dirs;
+	long num_errors;
+	long num_steals;
+	long num_reported;
+};
+
+struct scan_context
+{
+	int root_fd;
+	int flags;
+	dir_scanner_callback on_entry;
+	void * user_data;
+
+	int num_workers;
+	struct scan_worker * workers;
+
+	long pending;	// queued + in-progress directories, the scan ends when it drops to 0
+	long queued;	// directories waiting in the deques, only incremented under idle_mutex
+	int quit;
+
+	pthread_mutex_t idle_mutex;
+	pthread_cond_t idle_cond;
+};
+
+static void worker_push(struct scan_worker * worker, const struct dir_task * task)
+{
+	struct scan_context * ctx = worker->ctx;
+	__atomic_add_fetch(&ctx->pending, 1, __ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&worker->mutex);
+	if(worker->tail == worker->size) {
+		if(worker->head > 0) {	// reuse the space consumed by thieves
+			memmove(worker->tasks, worker->tasks + worker->head, sizeof(*worker->tasks) * (worker->tail - worker->head));
+			worker->tail -= worker->head;
+			worker->head = 0;
+		}
+		if(worker->tail == worker->size) {
+			size_t new_size = worker->size?(worker->size * 2):256;
+			worker->tasks = realloc(worker->tasks, sizeof(*worker->tasks) * new_size);
+			assert(worker->tasks);
+			worker->size = new_size;
+		}
+	}
+	worker->tasks[worker->tail++] = *task;
+	pthread_mutex_unlock(&worker->mutex);
+
+	pthread_mutex_lock(&ctx->idle_mutex);
+	__atomic_add_fetch(&ctx->queued, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_signal(&ctx->idle_cond);
+	pthread_mutex_unlock(&ctx->idle_mutex);
+}
+
+static int worker_pop(struct scan_worker * worker, struct dir_task * task)
+{
+	int ok = 0;
+	pthread_mutex_lock(&worker->mutex);
+	if(worker->tail > worker->head) {
+		*task = worker->tasks[--worker->tail];
+		__atomic_sub_fetch(&worker->ctx->queued, 1, __ATOMIC_SEQ_CST);
+		ok = 1;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+	return ok;
+}
+
+static int worker_steal(struct scan_worker * thief, struct dir_task * task)
+{
+	struct scan_context * ctx = thief->ctx;
+	for(int i = 1; i < ctx->num_workers; ++i) {
+		struct scan_worker * victim = &ctx->workers[(thief->id + i) % ctx->num_workers];
+		if(__atomic_load_n(&victim->tail, __ATOMIC_RELAXED) == __atomic_load_n(&victim->head, __ATOMIC_RELAXED)) continue;	// peek, re-checked under the lock
+
+		int ok = 0;
+		pthread_mutex_lock(&victim->mutex);
+		if(victim->tail > victim->head) {
+			*task = victim->tasks[victim->head++];	// the oldest one, usually the largest subtree
+			__atomic_sub_fetch(&ctx->queued, 1, __ATOMIC_SEQ_CST);
+			ok = 1;
+		}
+		pthread_mutex_unlock(&victim->mutex);
+		if(ok) {
+			++thief->num_steals;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int report_entry(struct scan_worker * worker, const char * path_name, size_t cb_path_name, size_t name_offset, unsigned char d_type, int depth)
+{
+	struct scan_context * ctx = worker->ctx;
+	if(NULL == ctx->on_entry) return 0;
+	struct dir_scanner_entry entry = {
+		.path_name = path_name,
+		.cb_path_name = cb_path_name,
+		.name = path_name + name_offset,
+		.d_type = d_type,
+		.depth = depth,
+		.worker_id = worker->id,
+	};
+	++worker->num_reported;
+	return ctx->on_entry(&entry, ctx->user_data);
+}
+
+static void scan_directory(struct scan_worker * worker, const struct dir_task * task)
+{
+	struct scan_context * ctx = worker->ctx;
+	// a fresh open file description for the root too: a dup()ed fd would share root_fd's offset
+	const char * path = task->path[0]?task->path:".";
+	int fd = openat(ctx->root_fd, path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if(fd < 0) {
+		++worker->num_errors;
+		return;
+	}
+	DIR * dir = fdopendir(fd);
+	if(NULL == dir) {
+		++worker->num_errors;
+		close(fd);
+		return;
+	}
+	++worker->num_dirs;
+
+	char * path_name = worker->path_name;
+	size_t prefix_length = 0;
+	if(task->cb_path) {
+		memcpy(path_name, task->path, task->cb_path);
+		path_name[task->cb_path] = '/';
+		prefix_length = task->cb_path + 1;
+	}
+
+	struct dirent * entry = NULL;
+	while(!__atomic_load_n(&ctx->quit, __ATOMIC_RELAXED) && (entry = readdir(dir))) {
+		const char * name = entry->d_name;
+		if(name[0] == '.') {
+			if(name[1] == '\0' || (name[1] == '.' && name[2] == '\0')) continue;
+			if(!(ctx->flags & dir_scanner_flag_include_hidden)) continue;
+		}
+
+		unsigned char d_type = entry->d_type;
+		if(d_type == DT_UNKNOWN) {	// some filesystems (xfs, nfs, ...) don't fill d_type
+			struct stat st[1];
+			if(fstatat(dirfd(dir), name, st, AT_SYMLINK_NOFOLLOW)) continue;
+			if(S_ISREG(st->st_mode)) d_type = DT_REG;
+			else if(S_ISDIR(st->st_mode)) d_type = DT_DIR;
+		}
+		if(d_type != DT_REG && d_type != DT_DIR) continue;
+
+		size_t cb_name = strlen(name);
+		if((prefix_length + cb_name) >= PATH_MAX) {
+			++worker->num_errors;
+			continue;
+		}
+		memcpy(path_name + prefix_length, name, cb_name + 1);
+		size_t cb_path_name = prefix_length + cb_name;
+
+		int rc = 0;
+		if(d_type == DT_REG) {
+			++worker->num_files;
+			rc = report_entry(worker, path_name, cb_path_name, prefix_length, d_type, task->depth);
+		}else {
+			if(ctx->flags & dir_scanner_flag_report_dirs) {
+				rc = report_entry(worker, path_name, cb_path_name, prefix_length, d_type, task->depth);
+			}
+			if(0 == rc && (ctx->flags & dir_scanner_flag_recursive)) {
+				struct dir_task subdir = {
+					.path = string_arena_add(worker->arena, path_name, cb_path_name),
+					.cb_path = cb_path_name,
+					.depth = task->depth + 1,
+				};
+				worker_push(worker, &subdir);
+			}
+		}
+		if(rc) {
+			__atomic_store_n(&ctx->quit, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	closedir(dir);
+}
+
+static void * worker_thread(void * user_data)
+{
+	struct scan_worker * worker = user_data;
+	struct scan_context * ctx = worker->ctx;
+	struct dir_task task;
+
+	while(1) {
+		if(worker_pop(worker, &task) || worker_steal(worker, &task)) {
+			if(!__atomic_load_n(&ctx->quit, __ATOMIC_RELAXED)) scan_directory(worker, &task);
+			if(0 == __atomic_sub_fetch(&ctx->pending, 1, __ATOMIC_SEQ_CST)) {
+				pthread_mutex_lock(&ctx->idle_mutex);
+				pthread_cond_broadcast(&ctx->idle_cond);
+				pthread_mutex_unlock(&ctx->idle_mutex);
+			}
+			continue;
+		}
+
+		// nothing to do: wait for new work or for the scan to finish.
+		// both predicates change under idle_mutex before the signal, so no wakeup can be missed
+		pthread_mutex_lock(&ctx->idle_mutex);
+		while(__atomic_load_n(&ctx->pending, __ATOMIC_SEQ_CST) > 0 && 0 == __atomic_load_n(&ctx->queued, __ATOMIC_SEQ_CST)) {
+			pthread_cond_wait(&ctx->idle_cond, &ctx->idle_mutex);
+		}
+		int done = (0 == __atomic_load_n(&ctx->pending, __ATOMIC_SEQ_CST));
+		pthread_mutex_unlock(&ctx->idle_mutex);
+		if(done) break;
+	}
+	return NULL;
+}
+
+static ssize_t dir_scanner_scan(struct dir_scanner * scanner, const char * root, dir_scanner_callback on_entry, void * user_data)
+{
+	assert(root && root[0]);
+	int root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(root_fd < 0) {
+		perror("dir_scanner::scan()::open()");
+		return -1;
+	}
+
+	struct scan_context ctx[1];
+	memset(ctx, 0, sizeof(ctx));
+	ctx->root_fd = root_fd;
+	ctx->flags = scanner->flags;
+	ctx->on_entry = on_entry;
+	ctx->user_data = user_data;
+	ctx->num_workers = scanner->num_threads;
+	pthread_mutex_init(&ctx->idle_mutex, NULL);
+	pthread_cond_init(&ctx->idle_cond, NULL);
+
+	struct scan_worker * workers = calloc(ctx->num_workers, sizeof(*workers));
+	assert(workers);
+	ctx->workers = workers;
+	for(int i = 0; i < ctx->num_workers; ++i) {
+		workers[i].ctx = ctx;
+		workers[i].id = i;
+		pthread_mutex_init(&workers[i].mutex, NULL);
+	}
+
+	struct dir_task root_task = { .path = "", .cb_path = 0, .depth = 0 };
+	worker_push(&workers[0], &root_task);
+
+	// the calling thread is worker 0
+	for(int i = 1; i < ctx->num_workers; ++i) {
+		int rc = pthread_create(&workers[i].th, NULL, worker_thread, &workers[i]);
+		assert(0 == rc);
+	}
+	worker_thread(&workers[0]);
+
+	ssize_t count = 0;
+	scanner->num_files = 0;
+	scanner->num_dirs = 0;
+	scanner->num_errors = 0;
+	scanner->num_steals = 0;
+	for(int i = 0; i < ctx->num_workers; ++i) {
+		struct scan_worker * worker = &workers[i];
+		if(i > 0) pthread_join(worker->th, NULL);
+
+		count += worker->num_reported;
+		scanner->num_files += worker->num_files;
+		scanner->num_dirs += worker->num_dirs;
+		scanner->num_errors += worker->num_errors;
+		scanner->num_steals += worker->num_steals;
+
+		string_arena_cleanup(worker->arena);
+		free(worker->tasks);
+		pthread_mutex_destroy(&worker->mutex);
+	}
+	free(workers);
+
+	pthread_cond_destroy(&ctx->idle_cond);
+	pthread_mutex_destroy(&ctx->idle_mutex);
+	close(root_fd);
+	return count;
+}
+
+struct dir_scanner * dir_scanner_init(struct dir_scanner * scanner, int num_threads, int flags, void * user_data)
+{
+	if(NULL == scanner) scanner = calloc(1, sizeof(*scanner));
+	assert(scanner);
+
+	if(num_threads <= 0) {
+		num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if(num_threads <= 0) num_threads = 1;
+		if(num_threads > 8) num_threads = 8;
+	}
+	if(num_threads > DIR_SCANNER_MAX_THREADS) num_threads = DIR_SCANNER_MAX_THREADS;
+
+	scanner->user_data = user_data;
+	scanner->num_threads = num_threads;
+	scanner->flags = flags;
+	scanner->scan = dir_scanner_scan;
+	return scanner;
+}
+
+void dir_scanner_cleanup(struct dir_scanner * scanner)
+{
+	if(NULL == scanner) return;
+	scanner->scan = NULL;
+}
+
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_DIR_SCANNER) && defined(_STAND_ALONE)
+#include "app_timer.h"
+#include "utils.h"
+
+static int count_entry(const struct dir_scanner_entry * entry, void * user_data)
+{
+	long * p_total_length = user_data;
+	__atomic_add_fetch(p_total_length, (long)entry->cb_path_name, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int stop_after_first(const struct dir_scanner_entry * entry, void * user_data)
+{
+	__atomic_add_fetch((long *)user_data, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+/*
+ * usage: dir_scanner [root] [max_threads]
+ */
+int main(int argc, char ** argv)
+{
+	const char * root = ".";
+	int max_threads = 8;
+	if(argc > 1) root = argv[1];
+	if(argc > 2) max_threads = atoi(argv[2]);
+	if(max_threads <= 0) max_threads = 1;
+
+	// utils_list_folder_packed() is implemented on top of dir_scanner and returns a sorted list
+	char ** path_names = NULL;
+	ssize_t num_files = utils_list_folder_packed(root, 1, &path_names);
+	assert(num_files >= 0);
+	for(ssize_t i = 1; i < num_files; ++i) assert(strcmp(path_names[i - 1], path_names[i]) < 0);
+	free(path_names);
+	printf("utils_list_folder_packed(%s): %ld files\n", root, (long)num_files);
+
+	struct dir_scanner scanner[1];
+	app_timer_t timer[1];
+	printf("%-8s %10s %10s %10s %12s\n", "threads", "files", "dirs", "steals", "time(ms)");
+	for(int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+		dir_scanner_init(scanner, num_threads, dir_scanner_flag_recursive, NULL);
+		long total_length = 0;
+		app_timer_start(timer);
+		ssize_t count = scanner->scan(scanner, root, count_entry, &total_length);
+		double time_cost = app_timer_stop(timer);
+		assert(count == num_files);
+		assert(scanner->num_files == num_files);
+		printf("%-8d %10ld %10ld %10ld %12.3f\n", num_threads,
+			scanner->num_files, scanner->num_dirs, scanner->num_steals,
+			time_cost * 1000.0);
+		dir_scanner_cleanup(scanner);
+	}
+
+	// a non-zero return value stops the scan early
+	dir_scanner_init(scanner, 1, dir_scanner_flag_recursive, NULL);
+	long num_calls = 0;
+	scanner->scan(scanner, root, stop_after_first, &num_calls);
+	assert(num_files == 0 || num_calls == 1);
+	dir_scanner_cleanup(scanner);
+	return 0;
+}
+#endif
@@ -0,0 +1,74 @@
+#ifndef CHLIB_DIR_SCANNER_H_
+#define CHLIB_DIR_SCANNER_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <sys/types.h>
+
+/*
+ * dir_scanner: thread-safe directory walker
+ *
+ * Every directory is opened by openat(root_fd, relative_path) and read by fdopendir(),
+ * the process cwd is never changed. Subdirectories are distributed to a pool of workers,
+ * each one owns a deque of pending directories (LIFO for the owner, FIFO for thieves).
+ * Directory names are kept in per-worker string arenas which are freed at the end of the scan.
+ *
+ * Symbolic links are never followed (to avoid loops).
+ */
+enum dir_scanner_flags
+{
+	dir_scanner_flag_recursive = 1,
+	dir_scanner_flag_include_hidden = 2,	// names beginning with '.'
+	dir_scanner_flag_report_dirs = 4,		// also invoke the callback on directories
+};
+
+struct dir_scanner_entry
+{
+	const char * path_name;	// relative to the root, only valid during the callback
+	size_t cb_path_name;
+	const char * name;		// points into path_name
+	unsigned char d_type;	// DT_REG or DT_DIR
+	int depth;				// 0: direct children of the root
+	int worker_id;			// [0, num_threads), can be used to index per-thread storage
+};
+
+/*
+ * dir_scanner_callback
+ * @brief invoked concurrently from the worker threads
+ * @return 0 to continue, non-zero to stop the scan
+ */
+typedef int (* dir_scanner_callback)(const struct dir_scanner_entry * entry, void * user_data);
+
+struct dir_scanner
+{
+	void * priv;
+	void * user_data;
+	int num_threads;
+	int flags;
+
+	// stats of the last scan
+	long num_files;
+	long num_dirs;
+	long num_errors;	// directories that could not be opened
+	long num_steals;
+
+	/*
+	 * scan()
+	 * @return number of reported entries, -1 if the root can't be opened
+	 */
+	ssize_t (* scan)(struct dir_scanner * scanner, const char * root, dir_scanner_callback on_entry, void * user_data);
+};
+
+/*
+ * dir_scanner_init()
+ * @param num_threads: <= 0: use the number of online CPUs (at most 8)
+ */
+struct dir_scanner * dir_scanner_init(struct dir_scanner * scanner, int num_threads, int flags, void * user_data);
+void dir_scanner_cleanup(struct dir_scanner * scanner);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
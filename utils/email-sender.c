@@ -222,15 +222,41 @@ static int  email_header_remove(struct email_header * hdr, const char * key)
 static int  email_header_foreach(struct email_header * hdr, int (* callback)(const char * key, const char * value, void * user_data), void * user_data)
 {
 	assert(hdr && callback);
+	avl_tree_iter_t iter[1];
+	avl_tree_iter_init(iter, hdr->root, 0);
+	
 	struct avl_node * p_node = NULL;
-	p_node = avl_tree_iter_begin(hdr->root);
+	while((p_node = avl_tree_iter_get_next(iter))) {
+		skey_value_pair_t * kvp = *(void **)p_node;
+		assert(kvp);
+		callback(kvp->key, kvp->value, user_data);
+	}
+	return 0;
+}
+static int  email_header_foreach_prefix(struct email_header * hdr, const char * prefix, int (* callback)(const char * key, const char * value, void * user_data), void * user_data)
+{
+	assert(hdr && prefix && callback);
+	size_t cb_prefix = strlen(prefix);
+	if(0 == cb_prefix) return email_header_foreach(hdr, callback, user_data);
+	
+	// the keys with the prefix are in [prefix, upper): upper is the prefix with its last byte incremented
+	char * upper = strdup(prefix);
+	assert(upper);
+	while(cb_prefix > 0 && (unsigned char)upper[cb_prefix - 1] == 0xff) upper[--cb_prefix] = '\0';
+	if(cb_prefix > 0) ++upper[cb_prefix - 1];
 	
-	while(p_node) {
+	skey_value_pair_t first = { .key = (char *)prefix };
+	skey_value_pair_t last = { .key = upper };
+	avl_tree_iter_t iter[1];
+	avl_tree_iter_init_range(iter, hdr->root, &first, (cb_prefix > 0)?&last:NULL, skey_value_pair_compare);
+	
+	struct avl_node * p_node = NULL;
+	while((p_node = avl_tree_iter_get_next(iter))) {
 		skey_value_pair_t * kvp = *(void **)p_node;
 		assert(kvp);
 		callback(kvp->key, kvp->value, user_data);
-		p_node = avl_tree_iter_next(hdr->root);
 	}
+	free(upper);
 	return 0;
 }
 static void email_header_clear(struct email_header * hdr)
@@ -250,6 +276,7 @@ struct email_header * email_header_init(struct email_header * hdr, void * user_d
 	hdr->add = email_header_add;
 	hdr->remove = email_header_remove;
 	hdr->foreach = email_header_foreach;
+	hdr->foreach_prefix = email_header_foreach_prefix;
 	hdr->clear = email_header_clear;
 	
 	avl_tree_t * tree = avl_tree_init(hdr->root, hdr);
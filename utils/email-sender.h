@@ -135,6 +135,8 @@ struct email_header
 	int (* add)(struct email_header * hdr, const char * key, const char * value);
 	int (* remove)(struct email_header * hdr, const char * key);
 	int (* foreach)(struct email_header * hdr, int (* callback)(const char * key, const char * value, void * user_data), void * user_data);
+	// only the headers whose key starts with prefix (e.g. "X-"), O(log n) to find the first one
+	int (* foreach_prefix)(struct email_header * hdr, const char * prefix, int (* callback)(const char * key, const char * value, void * user_data), void * user_data);
 	void (* clear)(struct email_header * hdr);
 };
 struct email_header * email_header_init(struct email_header * hdr, void * user_data);
@@ -0,0 +1,385 @@
+/*
+ * script_cache.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "script_cache.h"
+#include "utils.h"
+
+#define SCRIPT_CACHE_MAGIC "JSCACHE"
+#define SCRIPT_CACHE_VERSION (1)
+#define SLOT_EMPTY (0)
+#define SLOT_DELETED (1)
+
+uint64_t script_cache_hash(const void * data, size_t length)
+{
+	const unsigned char * p = data;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static inline uint64_t uri_hash(const char * uri)
+{
+	uint64_t hash = script_cache_hash(uri, strlen(uri));
+	if(hash <= SLOT_DELETED) hash += 2;	// reserved for empty and deleted slots
+	return hash;
+}
+
+static void get_data_filename(struct script_cache * cache, uint64_t content_hash, char * filename, size_t size)
+{
+	snprintf(filename, size, "%s/%.16llx.js", cache->cache_dir, (unsigned long long)content_hash);
+}
+
+static struct script_cache_entry * find_entry(struct script_cache * cache, const char * uri, uint64_t hash)
+{
+	uint32_t max_entries = cache->hdr->max_entries;
+	uint32_t pos = hash % max_entries;
+	for(uint32_t i = 0; i < max_entries; ++i) {
+		struct script_cache_entry * entry = &cache->entries[(pos + i) % max_entries];
+		if(entry->uri_hash == SLOT_EMPTY) break;
+		if(entry->uri_hash == hash && 0 == strcmp(entry->uri, uri)) return entry;
+	}
+	return NULL;
+}
+
+static struct script_cache_entry * find_free_slot(struct script_cache * cache, uint64_t hash)
+{
+	uint32_t max_entries = cache->hdr->max_entries;
+	uint32_t pos = hash % max_entries;
+	for(uint32_t i = 0; i < max_entries; ++i) {
+		struct script_cache_entry * entry = &cache->entries[(pos + i) % max_entries];
+		if(entry->uri_hash <= SLOT_DELETED) return entry;
+	}
+	return &cache->entries[pos];	// table is full, evict the entry at the home position
+}
+
+static void release_data_file(struct script_cache * cache, const struct script_cache_entry * entry)
+{
+	// the data file may be shared by other uris with identical contents
+	uint32_t max_entries = cache->hdr->max_entries;
+	for(uint32_t i = 0; i < max_entries; ++i) {
+		const struct script_cache_entry * other = &cache->entries[i];
+		if(other == entry || other->uri_hash <= SLOT_DELETED) continue;
+		if(other->content_hash == entry->content_hash) return;
+	}
+	char filename[PATH_MAX] = "";
+	get_data_filename(cache, entry->content_hash, filename, sizeof(filename));
+	unlink(filename);
+}
+
+static ssize_t script_cache_load(struct script_cache * cache, const char * uri, char ** p_code, uint32_t * p_flags)
+{
+	assert(cache && cache->hdr);
+	assert(uri && p_code);
+	
+	ssize_t cb = -1;
+	uint64_t hash = uri_hash(uri);
+	char filename[PATH_MAX] = "";
+	struct script_cache_entry entry[1];
+	memset(entry, 0, sizeof(entry));
+	
+	flock(cache->fd, LOCK_SH);
+	struct script_cache_entry * p_entry = find_entry(cache, uri, hash);
+	if(p_entry) *entry = *p_entry;
+	flock(cache->fd, LOCK_UN);
+	
+	if(NULL == p_entry) goto label_final;
+	if(cache->max_age > 0 && (time(NULL) - entry->timestamp) > cache->max_age) goto label_final;
+	
+	char * code = NULL;
+	get_data_filename(cache, entry->content_hash, filename, sizeof(filename));
+	cb = utils_load_file(NULL, filename, (unsigned char **)&code, NULL);
+	if(cb != entry->length || (cb >= 0 && script_cache_hash(code, cb) != entry->content_hash)) {	// missing or corrupted
+		free(code);
+		cb = -1;
+		goto label_final;
+	}
+	*p_code = code;
+	if(p_flags) *p_flags = entry->flags;
+	
+label_final:
+	flock(cache->fd, LOCK_EX);
+	if(cb >= 0) {
+		++cache->hits;
+		++cache->hdr->hits;
+		p_entry = find_entry(cache, uri, hash);
+		if(p_entry) ++p_entry->hits;
+	}else {
+		++cache->misses;
+		++cache->hdr->misses;
+	}
+	flock(cache->fd, LOCK_UN);
+	return cb;
+}
+
+static int script_cache_store(struct script_cache * cache, const char * uri, const char * code, size_t cb_code, uint32_t flags)
+{
+	assert(cache && cache->hdr);
+	assert(uri && code);
+	
+	size_t cb_uri = strlen(uri);
+	if(cb_uri >= SCRIPT_CACHE_URI_MAX_LENGTH) return -1;
+	
+	uint64_t hash = uri_hash(uri);
+	uint64_t content_hash = script_cache_hash(code, cb_code);
+	char filename[PATH_MAX] = "";
+	char tmp_filename[PATH_MAX + 32] = "";
+	
+	// write to a temp file first, then rename it, so readers never see a partial file
+	get_data_filename(cache, content_hash, filename, sizeof(filename));
+	snprintf(tmp_filename, sizeof(tmp_filename), "%s.%ld.tmp", filename, (long)getpid());
+	FILE * fp = fopen(tmp_filename, "wb");
+	if(NULL == fp) {
+		perror("script_cache_store()::fopen()");
+		return -1;
+	}
+	size_t cb = fwrite(code, 1, cb_code, fp);
+	fclose(fp);
+	if(cb != cb_code || rename(tmp_filename, filename)) {
+		unlink(tmp_filename);
+		return -1;
+	}
+	
+	flock(cache->fd, LOCK_EX);
+	struct script_cache_entry * entry = find_entry(cache, uri, hash);
+	if(NULL == entry) {
+		entry = find_free_slot(cache, hash);
+		if(entry->uri_hash <= SLOT_DELETED) ++cache->hdr->num_entries;
+	}
+	if(entry->uri_hash > SLOT_DELETED && entry->content_hash != content_hash) {
+		release_data_file(cache, entry);
+	}
+	
+	entry->uri_hash = hash;
+	entry->content_hash = content_hash;
+	entry->length = cb_code;
+	entry->timestamp = time(NULL);
+	entry->flags = flags;
+	entry->hits = 0;
+	memcpy(entry->uri, uri, cb_uri + 1);
+	flock(cache->fd, LOCK_UN);
+	return 0;
+}
+
+static int script_cache_set_flags(struct script_cache * cache, const char * uri, uint32_t flags)
+{
+	assert(cache && cache->hdr);
+	int rc = -1;
+	flock(cache->fd, LOCK_EX);
+	struct script_cache_entry * entry = find_entry(cache, uri, uri_hash(uri));
+	if(entry) {
+		entry->flags = flags;
+		rc = 0;
+	}
+	flock(cache->fd, LOCK_UN);
+	return rc;
+}
+
+static int script_cache_remove(struct script_cache * cache, const char * uri)
+{
+	assert(cache && cache->hdr);
+	int rc = -1;
+	flock(cache->fd, LOCK_EX);
+	struct script_cache_entry * entry = find_entry(cache, uri, uri_hash(uri));
+	if(entry) {
+		release_data_file(cache, entry);
+		memset(entry, 0, sizeof(*entry));
+		entry->uri_hash = SLOT_DELETED;
+		--cache->hdr->num_entries;
+		rc = 0;
+	}
+	flock(cache->fd, LOCK_UN);
+	return rc;
+}
+
+struct script_cache * script_cache_init(struct script_cache * cache, const char * cache_dir, long max_age)
+{
+	assert(cache_dir && cache_dir[0]);
+	int rc = 0;
+	
+	if(NULL == cache) cache = calloc(1, sizeof(*cache));
+	else memset(cache, 0, sizeof(*cache));
+	assert(cache);
+	cache->fd = -1;
+	
+	strncpy(cache->cache_dir, cache_dir, sizeof(cache->cache_dir) - 1);
+	cache->max_age = max_age;
+	
+	cache->load = script_cache_load;
+	cache->store = script_cache_store;
+	cache->set_flags = script_cache_set_flags;
+	cache->remove = script_cache_remove;
+	
+	rc = mkdir(cache_dir, 0755);
+	if(rc && errno != EEXIST) {
+		perror("script_cache_init()::mkdir()");
+		return NULL;
+	}
+	
+	char index_file[PATH_MAX + 16] = "";
+	snprintf(index_file, sizeof(index_file), "%s/index", cache_dir);
+	int fd = open(index_file, O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		perror("script_cache_init()::open()");
+		return NULL;
+	}
+	
+	size_t map_size = sizeof(struct script_cache_index_header) + sizeof(struct script_cache_entry) * SCRIPT_CACHE_MAX_ENTRIES;
+	flock(fd, LOCK_EX);
+	struct stat st[1];
+	memset(st, 0, sizeof(st));
+	rc = fstat(fd, st);
+	int is_new = (0 == rc && st->st_size == 0);
+	if(0 == rc && st->st_size != map_size) rc = ftruncate(fd, 0) || ftruncate(fd, map_size);	// new file or incompatible layout
+	
+	void * map = NULL;
+	if(0 == rc) {
+		map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED) map = NULL;
+	}
+	if(NULL == map) {
+		perror("script_cache_init()::mmap()");
+		flock(fd, LOCK_UN);
+		close(fd);
+		return NULL;
+	}
+	
+	struct script_cache_index_header * hdr = map;
+	if(is_new || memcmp(hdr->magic, SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC)) || hdr->version != SCRIPT_CACHE_VERSION) {
+		memset(map, 0, map_size);
+		memcpy(hdr->magic, SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC));
+		hdr->version = SCRIPT_CACHE_VERSION;
+		hdr->max_entries = SCRIPT_CACHE_MAX_ENTRIES;
+	}
+	flock(fd, LOCK_UN);
+	
+	cache->fd = fd;
+	cache->map_size = map_size;
+	cache->hdr = hdr;
+	cache->entries = (struct script_cache_entry *)(hdr + 1);
+	return cache;
+}
+
+void script_cache_cleanup(struct script_cache * cache)
+{
+	if(NULL == cache) return;
+	if(cache->hdr) {
+		msync(cache->hdr, cache->map_size, MS_ASYNC);
+		munmap(cache->hdr, cache->map_size);
+		cache->hdr = NULL;
+		cache->entries = NULL;
+	}
+	if(cache->fd >= 0) {
+		close(cache->fd);
+		cache->fd = -1;
+	}
+	return;
+}
+
+#undef SLOT_EMPTY
+#undef SLOT_DELETED
+
+/******************************************************
+ * TEST Module
+ *****************************************************/
+#if defined(_TEST_SCRIPT_CACHE) && defined(_STAND_ALONE)
+int main(int argc, char ** argv)
+{
+	char cache_dir[] = "/tmp/script-cache-test-XXXXXX";
+	char * p_dir = mkdtemp(cache_dir);
+	assert(p_dir);
+	
+	static const char * uri = "https://example.com/lib.js";
+	static const char * code = "var lib = { version: 1 };";
+	char * data = NULL;
+	uint32_t flags = 0;
+	
+	struct script_cache cache[1];
+	struct script_cache * p_cache = script_cache_init(cache, cache_dir, 0);
+	assert(p_cache);
+	
+	// test 1. miss
+	ssize_t cb = cache->load(cache, uri, &data, &flags);
+	assert(cb == -1 && NULL == data);
+	assert(cache->misses == 1 && cache->hits == 0);
+	
+	// test 2. store and hit
+	int rc = cache->store(cache, uri, code, strlen(code), 0);
+	assert(0 == rc);
+	cb = cache->load(cache, uri, &data, &flags);
+	assert(cb == strlen(code) && data && 0 == strcmp(data, code));
+	assert(flags == 0 && cache->hits == 1);
+	free(data); data = NULL;
+	
+	rc = cache->set_flags(cache, uri, script_cache_flag_syntax_checked);
+	assert(0 == rc);
+	script_cache_cleanup(cache);
+	
+	// test 3. persistence across sessions
+	p_cache = script_cache_init(cache, cache_dir, 0);
+	assert(p_cache);
+	cb = cache->load(cache, uri, &data, &flags);
+	assert(cb == strlen(code) && data && flags == script_cache_flag_syntax_checked);
+	free(data); data = NULL;
+	printf("index: entries=%lu, hits=%lu, misses=%lu\n", 
+		(unsigned long)cache->hdr->num_entries, (unsigned long)cache->hdr->hits, (unsigned long)cache->hdr->misses);
+	assert(cache->hdr->hits == 2 && cache->hdr->misses == 1 && cache->hdr->num_entries == 1);
+	
+	// test 4. remove
+	rc = cache->remove(cache, uri);
+	assert(0 == rc);
+	cb = cache->load(cache, uri, &data, &flags);
+	assert(cb == -1);
+	assert(cache->hdr->num_entries == 0);
+	
+	script_cache_cleanup(cache);
+	
+	char index_file[PATH_MAX + 16] = "";
+	snprintf(index_file, sizeof(index_file), "%s/index", cache_dir);
+	unlink(index_file);
+	rmdir(cache_dir);
+	printf("[OK]\n");
+	return 0;
+}
+#endif
@@ -0,0 +1,83 @@
+#ifndef CHLIB_SCRIPT_CACHE_H_
+#define CHLIB_SCRIPT_CACHE_H_
+
+#include <stdio.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <limits.h>
+
+/*
+ * script_cache: on-disk cache for downloaded scripts
+ *
+ * layout:
+ *   ${cache_dir}/index         :  memory-mapped index file (header + open-addressing table keyed by uri hash)
+ *   ${cache_dir}/<hash>.js     :  script content, named by the content hash (shared by identical contents)
+ *
+ * The index is protected by flock(), so it can be shared by multiple processes.
+ */
+#define SCRIPT_CACHE_MAX_ENTRIES (4096)
+#define SCRIPT_CACHE_URI_MAX_LENGTH (1000)
+
+enum script_cache_flags
+{
+	script_cache_flag_syntax_checked = 1,	// jsc_context_check_syntax() passed
+	script_cache_flag_syntax_error = 2,
+};
+
+struct script_cache_entry
+{
+	uint64_t uri_hash;	// 0: empty slot
+	uint64_t content_hash;
+	int64_t length;
+	int64_t timestamp;	// the time it was cached
+	uint32_t flags;
+	uint32_t hits;
+	char uri[SCRIPT_CACHE_URI_MAX_LENGTH];
+};
+
+struct script_cache_index_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t max_entries;
+	uint64_t hits;		// accumulated across all runs
+	uint64_t misses;
+	uint64_t num_entries;
+};
+
+struct script_cache
+{
+	char cache_dir[PATH_MAX];
+	long max_age;	// in seconds, 0: never expire
+
+	// index file
+	int fd;
+	size_t map_size;
+	struct script_cache_index_header * hdr;
+	struct script_cache_entry * entries;
+
+	// counters of the current session
+	long hits;
+	long misses;
+
+	// public methods
+	/*
+	 * load()
+	 * @return length of the script, or -1 on cache miss. *p_code should be freed by free().
+	 */
+	ssize_t (* load)(struct script_cache * cache, const char * uri, char ** p_code, uint32_t * p_flags);
+	int (* store)(struct script_cache * cache, const char * uri, const char * code, size_t cb_code, uint32_t flags);
+	int (* set_flags)(struct script_cache * cache, const char * uri, uint32_t flags);
+	int (* remove)(struct script_cache * cache, const char * uri);
+};
+struct script_cache * script_cache_init(struct script_cache * cache, const char * cache_dir, long max_age);
+void script_cache_cleanup(struct script_cache * cache);
+
+uint64_t script_cache_hash(const void * data, size_t length);	// FNV-1a 64
+
+#ifdef __cplusplus
+}
+#endif
+#endif
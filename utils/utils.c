@@ -33,6 +33,8 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include <errno.h>
 #include <dirent.h>
@@ -41,7 +43,7 @@
 #include <pthread.h>
 
 #include "utils.h"
-#include "clib-stack.h"
+#include "dir_scanner.h"
 
 
 ssize_t unix_time_to_string(
@@ -135,100 +137,219 @@ label_final:
 	return cb;
 }
 
-ssize_t utils_list_folder(const char * path, int recursive, char *** p_path_names) // skip symbolic links to avoid loops
+static int mmap_window(utils_mmap_file_t * map, size_t offset)
 {
-	assert(path && path[0]);
-	int rc = 0;
-	clib_queue_t queue[1];
-	memset(queue, 0, sizeof(queue));
-	clib_queue_init(queue);
-	
-	char old_path[PATH_MAX] = "";
-	char * p_saved_path = getcwd(old_path, sizeof(old_path));
-	if(NULL == p_saved_path) {
-		perror("utils_list_folder()::getcwd()");
-		return -1;
+	static size_t page_size;
+	if(0 == page_size) page_size = sysconf(_SC_PAGESIZE);
+	
+	if(map->map_addr) munmap(map->map_addr, map->map_size);
+	map->map_addr = NULL;
+	map->map_size = 0;
+	map->data = NULL;
+	map->length = 0;
+	map->offset = offset;
+	if(offset >= map->file_size) return 0;
+	
+	size_t map_offset = offset & ~(page_size - 1);
+	size_t map_size = map->file_size - map_offset;
+	if(map->window_size && map_size > (map->window_size + (offset - map_offset))) {
+		map_size = map->window_size + (offset - map_offset);
 	}
 	
-	DIR * dir = opendir(path);
-	if(NULL == dir) {
-		perror("utils_list_folder()::opendir()");
+	void * addr = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, map->fd, map_offset);
+	if(addr == MAP_FAILED) {
+		perror("mmap");
 		return -1;
 	}
 	
-	rc = chdir(path);
-	if(rc) {
-		perror("utils_list_folder()::chdir()");
-		closedir(dir);
-		return -1;
+	int advice = -1;
+	if(map->flags & utils_mmap_flag_sequential) advice = MADV_SEQUENTIAL;
+	else if(map->flags & utils_mmap_flag_random) advice = MADV_RANDOM;
+	if(advice != -1) madvise(addr, map_size, advice);
+	if(map->flags & utils_mmap_flag_willneed) madvise(addr, map_size, MADV_WILLNEED);
+	
+	map->map_addr = addr;
+	map->map_size = map_size;
+	map->data = (unsigned char *)addr + (offset - map_offset);
+	map->length = map_size - (offset - map_offset);
+	return 0;
+}
+
+utils_mmap_file_t * utils_mmap_file_open(utils_mmap_file_t * map, const char * path, const char * filename, size_t window_size, int flags)
+{
+	assert(filename);
+	
+	// no length limit on the path name
+	char * path_name = (char *)filename;
+	size_t cb_path = path?strlen(path):0;
+	if(cb_path > 0 && filename[0] != '/') {
+		path_name = malloc(cb_path + 1 + strlen(filename) + 1);
+		assert(path_name);
+		strcpy(path_name, path);
+		if(path_name[cb_path - 1] != '/') path_name[cb_path++] = '/';
+		strcpy(path_name + cb_path, filename);
 	}
 	
-	ssize_t allocated_size = 4096;
-	ssize_t length = 0;
-	char ** path_names = calloc(allocated_size, sizeof(*path_names));
-	assert(path_names);
+	int fd = open(path_name, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		perror(path_name);
+		if(path_name != filename) free(path_name);
+		return NULL;
+	}
 	
-	#define add_filename(name) ({ int ret = 0; \
-			if(length == allocated_size) { 	\
-				path_names = realloc(path_names, sizeof(*path_names) * allocated_size * 2); \
-				assert(path_names); \
-				memset(path_names + allocated_size, 0, sizeof(*path_names) * allocated_size); \
-				allocated_size *= 2; \
-			} \
-			path_names[length++] = strdup(name); \
-			ret; })
-	
-	struct dirent * entry = NULL;
-	while((entry = readdir(dir))) {
-		if(entry->d_type != DT_REG && entry->d_type != DT_DIR) continue;
-		if(entry->d_name[0] == '.') continue;	// skip '.' '..' and hidden files
-		if(entry->d_type == DT_REG) {
-			add_filename(entry->d_name);
-			continue;
-		}
-		if(!recursive) continue;
-		queue->push(queue, strdup(entry->d_name));
+	struct stat st[1];
+	int rc = fstat(fd, st);
+	if(rc || (st->st_mode & S_IFMT) != S_IFREG) {
+		fprintf(stderr, "not regular file: '%s'\n", path_name);
+		if(path_name != filename) free(path_name);
+		close(fd);
+		return NULL;
 	}
-	closedir(dir);
+	if(path_name != filename) free(path_name);
 	
-	char * subfolder = NULL;
+	utils_mmap_file_t * p_map = map;
+	if(NULL == p_map) p_map = calloc(1, sizeof(*p_map));
+	else memset(p_map, 0, sizeof(*p_map));
+	assert(p_map);
 	
-	while((subfolder = queue->pop(queue))) {
-		dir = opendir(subfolder);
-		printf("opendir %s = %p\n", subfolder, dir);
-		if(NULL == dir) {
-			perror("opendir");
-			free(subfolder);
-			continue;
-		}
-		char full_name[PATH_MAX] = "";
-		while((entry = readdir(dir))) {
-			if(entry->d_type != DT_REG && entry->d_type != DT_DIR) continue;
-			if(entry->d_name[0] == '.') continue;	// skip '.' '..' and hidden files
+	p_map->fd = fd;
+	p_map->is_open = 1;
+	p_map->flags = flags;
+	p_map->file_size = st->st_size;
+	p_map->window_size = window_size;
+	
+	rc = mmap_window(p_map, 0);
+	if(rc) {
+		utils_mmap_file_release(p_map);
+		if(NULL == map) free(p_map);
+		return NULL;
+	}
+	return p_map;
+}
+
+const unsigned char * utils_mmap_file_seek(utils_mmap_file_t * map, size_t offset, size_t * p_length)
+{
+	assert(map && map->is_open);
+	if(p_length) *p_length = 0;
+	if(offset >= map->file_size) return NULL;
+	
+	unsigned char * map_begin = map->map_addr;
+	unsigned char * map_end = map_begin + map->map_size;
+	unsigned char * data = (unsigned char *)map->data + ((ssize_t)offset - (ssize_t)map->offset);
+	if(NULL == map_begin || data < map_begin || data >= map_end) { // out of the current window
+		int rc = mmap_window(map, offset);
+		if(rc) return NULL;
+		data = (unsigned char *)map->data;
+	}else {
+		map->offset = offset;
+		map->data = data;
+		map->length = map_end - data;
+	}
+	
+	if(p_length) *p_length = map->length;
+	return data;
+}
+
+void utils_mmap_file_release(utils_mmap_file_t * map)
+{
+	if(NULL == map) return;
+	if(map->map_addr) munmap(map->map_addr, map->map_size);
+	if(map->is_open) close(map->fd);
+	memset(map, 0, sizeof(*map));
+	map->fd = -1;
+}
+
+/*
+ * list_folder: collect the names reported by dir_scanner into per-worker string tables,
+ * then pack them into a single block: [char * path_names[count]] [names ...]
+ */
+struct list_folder_table
+{
+	char * data;	// '\0' separated names
+	size_t length;
+	size_t size;
+	size_t count;
+};
+
+static int list_folder_on_entry(const struct dir_scanner_entry * entry, void * user_data)
+{
+	struct list_folder_table * table = &((struct list_folder_table *)user_data)[entry->worker_id];
+	size_t cb = entry->cb_path_name + 1;
+	if((table->length + cb) > table->size) {
+		size_t new_size = table->size?(table->size * 2):(64 * 1024);
+		while(new_size < (table->length + cb)) new_size *= 2;
+		table->data = realloc(table->data, new_size);
+		assert(table->data);
+		table->size = new_size;
+	}
+	memcpy(table->data + table->length, entry->path_name, cb);
+	table->length += cb;
+	++table->count;
+	return 0;
+}
+
+static int compare_path_names(const void * a, const void * b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+ssize_t utils_list_folder_packed(const char * path, int recursive, char *** p_path_names) // skip symbolic links to avoid loops
+{
+	assert(path && path[0]);
+	struct dir_scanner scanner[1];
+	memset(scanner, 0, sizeof(scanner));
+	dir_scanner_init(scanner, recursive?0:1, recursive?dir_scanner_flag_recursive:0, NULL);	// a single directory is read inline
+	
+	struct list_folder_table * tables = calloc(scanner->num_threads, sizeof(*tables));
+	assert(tables);
+	
+	ssize_t count = scanner->scan(scanner, path, list_folder_on_entry, tables);
+	if(count > 0) {
+		size_t total_length = 0;
+		for(int i = 0; i < scanner->num_threads; ++i) total_length += tables[i].length;
+		
+		char ** path_names = malloc(sizeof(*path_names) * count + total_length);
+		assert(path_names);
+		char * names = (char *)(path_names + count);
+		ssize_t index = 0;
+		for(int i = 0; i < scanner->num_threads; ++i) {
+			struct list_folder_table * table = &tables[i];
+			if(0 == table->length) continue;
+			memcpy(names, table->data, table->length);
 			
-			snprintf(full_name, sizeof(full_name), "%s/%s", subfolder, entry->d_name);
-			if(entry->d_type == DT_REG) {
-				add_filename(full_name);
-				continue;
+			char * name = names;
+			for(size_t n = 0; n < table->count; ++n) {
+				path_names[index++] = name;
+				name += strlen(name) + 1;
 			}
-			queue->push(queue, strdup(full_name));
+			names += table->length;
 		}
-		free(subfolder);
-		closedir(dir);
+		assert(index == count);
+		qsort(path_names, count, sizeof(*path_names), compare_path_names);
+		*p_path_names = path_names;
 	}
-	#undef add_filename
 	
-	clib_queue_cleanup(queue);
-	rc = chdir(p_saved_path);
-	assert(0 == rc);
+	for(int i = 0; i < scanner->num_threads; ++i) free(tables[i].data);
+	free(tables);
+	dir_scanner_cleanup(scanner);
+	return count;
+}
+
+ssize_t utils_list_folder(const char * path, int recursive, char *** p_path_names)
+{
+	char ** packed = NULL;
+	ssize_t count = utils_list_folder_packed(path, recursive, &packed);
+	if(count <= 0) return count;
 	
-	if(0 == length) {
-		free(path_names);
-		path_names = NULL;
+	char ** path_names = malloc(sizeof(*path_names) * count);
+	assert(path_names);
+	for(ssize_t i = 0; i < count; ++i) {
+		path_names[i] = strdup(packed[i]);
+		assert(path_names[i]);
 	}
-	if(path_names) *p_path_names = realloc(path_names, sizeof(*path_names) * length);
-	
-	return length;
+	free(packed);
+	*p_path_names = path_names;
+	return count;
 }
 
 /******************************************************
@@ -238,10 +359,16 @@ ssize_t utils_list_folder(const char * path, int recursive, char *** p_path_name
 
 int test_list_folder(int argc, char ** argv);
 int test_load_file(int argc, char **argv);
+int bench_mmap_file(int argc, char ** argv);
 
+/*
+ * usage: utils [document_root] [recursive]
+ *        utils --bench-mmap [max_file_size] [tmp_dir]
+ */
 int main(int argc, char ** argv)
 {
 	int rc = 0;
+	if(argc > 1 && 0 == strcmp(argv[1], "--bench-mmap")) return bench_mmap_file(argc - 1, argv + 1);
 	
 	// test unix_time_to_string
 	char sz_time[100] = "";
@@ -266,6 +393,13 @@ int main(int argc, char ** argv)
 	rc = test_load_file(argc, argv);
 	assert(0 == rc);
 	
+	// releasing a never-opened (zero-filled) mapping must not close fd 0
+	utils_mmap_file_t empty_map[1];
+	memset(empty_map, 0, sizeof(empty_map));
+	utils_mmap_file_release(empty_map);
+	utils_mmap_file_release(empty_map);
+	assert(fcntl(STDIN_FILENO, F_GETFD) != -1);
+	
 	
 	// test utils::list_folder
 	
@@ -304,7 +438,7 @@ int test_load_file(int argc, char **argv)
 	printf("\n==== TEST %s(root_path=%s, recursive=%d) ====\n", __FUNCTION__, document_root, recursive);
 	
 	char ** filelist = NULL;
-	ssize_t count = utils_list_folder(document_root, recursive, &filelist);
+	ssize_t count = utils_list_folder_packed(document_root, recursive, &filelist);
 	printf("count = %d\n", (int)count);
 	assert(filelist);
 	for(int i = 0; i < count; ++i) {
@@ -319,9 +453,129 @@ int test_load_file(int argc, char **argv)
 			data, cb_data, filelist[i],
 			(size_t)st->st_size, (long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec);
 		if(data) free(data);
-		free(filelist[i]);
 	}
 	free(filelist);
 	return 0;
 }
+#include <stdint.h>
+#include "app_timer.h"
+static long get_rss_kb(void)
+{
+	long pages = 0, rss = 0;
+	FILE * fp = fopen("/proc/self/statm", "r");
+	if(NULL == fp) return -1;
+	if(2 != fscanf(fp, "%ld %ld", &pages, &rss)) rss = -1;
+	fclose(fp);
+	return (rss < 0)?-1:(rss * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+static uint64_t checksum(const unsigned char * data, size_t length, uint64_t sum)
+{
+	for(size_t i = 0; i < length; i += 64) sum += data[i];	// touch every cache line
+	return sum;
+}
+
+static int create_test_file(const char * path_name, size_t size)
+{
+	FILE * fp = fopen(path_name, "wb");
+	if(NULL == fp) return -1;
+	
+	unsigned char block[65536];
+	for(size_t i = 0; i < sizeof(block); ++i) block[i] = (unsigned char)(i * 31 + 7);
+	while(size > 0) {
+		size_t cb = (size < sizeof(block))?size:sizeof(block);
+		if(fwrite(block, 1, cb, fp) != cb) {
+			fclose(fp);
+			return -1;
+		}
+		size -= cb;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * benchmark: utils_load_file (calloc + fread) vs. utils_mmap_file (whole file / 64MB windows)
+ * file sizes: 1KB ... max_file_size (default: 256MB, up to 4GB), x16 per step
+ */
+int bench_mmap_file(int argc, char ** argv)
+{
+	size_t max_size = 256UL << 20;
+	if(argc > 1) max_size = strtoull(argv[1], NULL, 10);
+	if(max_size > (4UL << 30)) max_size = 4UL << 30;
+	const char * tmp_dir = (argc > 2)?argv[2]:"/tmp";
+	
+	size_t window_size = 64UL << 20;
+	size_t phys_mem = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	
+	char path_name[PATH_MAX] = "";
+	snprintf(path_name, sizeof(path_name), "%s/utils-bench-mmap.%d.dat", tmp_dir, (int)getpid());
+	
+	app_timer_t timer[1];
+	printf("%12s | %14s %9s | %14s %9s | %14s %9s\n", "file size", 
+		"fread (MB/s)", "rss(KB)", "mmap (MB/s)", "rss(KB)", "window (MB/s)", "rss(KB)");
+	for(size_t size = 1024; size <= max_size; size = (size < max_size && size * 16 > max_size)?max_size:(size * 16)) {
+		if(create_test_file(path_name, size)) {
+			perror(path_name);
+			break;
+		}
+		double mb = (double)size / (1 << 20);
+		uint64_t sum[3] = { 0 };
+		double time_cost[3] = { 0 };
+		long rss[3] = { 0 };
+		
+		// 1. fread (skipped if the file does not fit in memory)
+		if(size < phys_mem / 2) {
+			unsigned char * data = NULL;
+			app_timer_start(timer);
+			ssize_t cb = utils_load_file(NULL, path_name, &data, NULL);
+			assert(cb == (ssize_t)size);
+			sum[0] = checksum(data, cb, 0);
+			time_cost[0] = app_timer_stop(timer);
+			rss[0] = get_rss_kb();
+			free(data);
+		}
+		
+		// 2. mmap the whole file
+		utils_mmap_file_t map[1];
+		if(size < phys_mem / 2) {
+			app_timer_start(timer);
+			utils_mmap_file_open(map, NULL, path_name, 0, utils_mmap_flag_sequential | utils_mmap_flag_willneed);
+			sum[1] = checksum(map->data, map->length, 0);
+			time_cost[1] = app_timer_stop(timer);
+			rss[1] = get_rss_kb();
+			utils_mmap_file_release(map);
+		}
+		
+		// 3. mmap with a sliding window
+		app_timer_start(timer);
+		utils_mmap_file_open(map, NULL, path_name, window_size, utils_mmap_flag_sequential | utils_mmap_flag_willneed);
+		size_t offset = 0, length = 0;
+		const unsigned char * data = map->data;
+		length = map->length;
+		long max_rss = 0;
+		while(data) {
+			sum[2] = checksum(data, length, sum[2]);
+			offset += length;
+			long cur_rss = get_rss_kb();
+			if(cur_rss > max_rss) max_rss = cur_rss;
+			data = utils_mmap_file_seek(map, offset, &length);
+		}
+		time_cost[2] = app_timer_stop(timer);
+		rss[2] = max_rss;
+		utils_mmap_file_release(map);
+		assert(offset == size);
+		
+		if(time_cost[0] > 0) assert(sum[0] == sum[2]);
+		if(time_cost[1] > 0) assert(sum[1] == sum[2]);
+		printf("%12zu | %14.1f %9ld | %14.1f %9ld | %14.1f %9ld\n", size,
+			time_cost[0]?(mb / time_cost[0]):0, rss[0], 
+			time_cost[1]?(mb / time_cost[1]):0, rss[1], 
+			mb / time_cost[2], rss[2]);
+		
+		unlink(path_name);
+		if(size == max_size) break;
+	}
+	return 0;
+}
 #endif
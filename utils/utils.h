@@ -27,7 +27,61 @@ ssize_t unix_time_to_string(
 	char * sz_time, size_t max_size
 );
 ssize_t utils_load_file(const char *path, const char *filename, unsigned char **p_data, struct stat * st);
+
+/*
+ * utils_mmap_file: read-only mapping of a regular file (the data is NOT nul-terminated)
+ *   window_size == 0: map the whole file at once.
+ *   window_size > 0: only window_size bytes are mapped at a time, move the window by utils_mmap_file_seek(),
+ *      so files larger than RAM can be processed in constant memory.
+ */
+enum utils_mmap_flags
+{
+	utils_mmap_flag_sequential = 1,	// madvise(MADV_SEQUENTIAL)
+	utils_mmap_flag_willneed = 2,	// madvise(MADV_WILLNEED)
+	utils_mmap_flag_random = 4,		// madvise(MADV_RANDOM)
+};
+typedef struct utils_mmap_file
+{
+	int fd;
+	int is_open;	// fd is owned, set by utils_mmap_file_open(); a zero-filled struct is safe to release
+	int flags;
+	size_t file_size;
+	size_t window_size;
+	
+	// current window
+	size_t offset;	// file offset of data
+	size_t length;
+	const unsigned char * data;
+	
+	void * map_addr;	// page-aligned
+	size_t map_size;
+}utils_mmap_file_t;
+
+/*
+ * utils_mmap_file_open()
+ * @brief open the file (path can be NULL) and map the first window
+ * @return NULL on error
+ */
+utils_mmap_file_t * utils_mmap_file_open(utils_mmap_file_t * map, const char * path, const char * filename, size_t window_size, int flags);
+/*
+ * utils_mmap_file_seek()
+ * @return the data at offset (*p_length: bytes available in the window), NULL if offset >= file_size
+ */
+const unsigned char * utils_mmap_file_seek(utils_mmap_file_t * map, size_t offset, size_t * p_length);
+void utils_mmap_file_release(utils_mmap_file_t * map);
+/*
+ * utils_list_folder()
+ * @brief list the regular files under path (hidden files and symbolic links are skipped), see dir_scanner.h
+ * @param p_path_names: sorted names relative to path, free() every name and then the array.
+ * @return number of files, -1 on error
+ */
 ssize_t utils_list_folder(const char * path, int recursive, char *** p_path_names);
+/*
+ * utils_list_folder_packed()
+ * @brief same as utils_list_folder(), but the names are stored in the same block as the array:
+ *     release them all with a single free(*p_path_names), never free() a single name.
+ */
+ssize_t utils_list_folder_packed(const char * path, int recursive, char *** p_path_names);
 
 #include <json-c/json.h>
 typedef char * string;